@@ -0,0 +1,328 @@
+/*
+ * ashmem-bench.c - ashmem pin/unpin latency under memory pressure
+ *
+ * Forks workers which each own an ashmem area and keep unpinning and
+ * pinning chunks of it again, as a cache of decoded images does, while
+ * a hog process allocates memory so that the ashmem shrinker purges
+ * the unpinned chunks under them.  Pin and unpin latency is reported,
+ * along with how many pins found their chunk purged.
+ *
+ * Build:  gcc -O2 -o ashmem-bench ashmem-bench.c
+ * Usage:  ashmem-bench [-p procs] [-s area_kb] [-c chunk_kb] [-m hog_mb]
+ *                      [-r prio] [-d seconds]
+ *
+ *   -p procs     workers (default four per online CPU)
+ *   -s area_kb   size of each worker's area (default 4096)
+ *   -c chunk_kb  size of each unpinned chunk (default 64)
+ *   -m hog_mb    memory the hog keeps writing (default none); pick it
+ *                close to the free memory so that reclaim runs
+ *   -r prio      run the first worker SCHED_FIFO at prio and report it
+ *                on its own line
+ *   -d seconds   length of the run (default 10)
+ *
+ * The areas are independent, so only locking shared between them, or
+ * with the shrinker, makes a worker wait.  A real-time worker whose tail
+ * latency rises with the number of normal ones is suffering priority
+ * inversion on such a lock.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/types.h>
+
+#include "../../include/linux/ashmem.h"
+
+#define ASHMEM_DEV	"/dev/ashmem"
+#define MAX_PROCS	64
+#define LAT_BUCKETS	10000			/* 1 us each */
+
+struct result {
+	unsigned long ops;
+	unsigned long pin_purged;
+	unsigned long purged_pages;
+	unsigned int pin[LAT_BUCKETS + 1];	/* last is overflow */
+	unsigned int unpin[LAT_BUCKETS + 1];
+};
+
+/* Shared with the children. */
+struct shared {
+	volatile int go;
+	volatile int stop;
+	struct result res[MAX_PROCS];
+};
+
+static struct shared *shared;
+static int ready_pipe[2];
+static long page_size;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void touch_pages(char *p, size_t size)
+{
+	size_t off;
+
+	for (off = 0; off < size; off += page_size)
+		p[off]++;
+}
+
+static void child_ready(void)
+{
+	if (write(ready_pipe[1], "1", 1) != 1)
+		exit(1);
+}
+
+/* Fail a child, without leaving the parent waiting for it. */
+static void child_fail(const char *what)
+{
+	perror(what);
+	if (write(ready_pipe[1], "0", 1) != 1)
+		exit(1);
+	exit(1);
+}
+
+static void record(unsigned int *lat, long long us)
+{
+	lat[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+}
+
+static void worker(int index, size_t area_size, size_t chunk_size,
+		   int rt_prio)
+{
+	struct sched_param param = { .sched_priority = rt_prio };
+	struct result *res = &shared->res[index];
+	struct ashmem_purge_stats stats;
+	struct ashmem_pin pin;
+	unsigned int seed = index;
+	size_t chunks = area_size / chunk_size;
+	long long t0;
+	char *area;
+	int fd, ret;
+
+	fd = open(ASHMEM_DEV, O_RDWR);
+	if (fd < 0 || ioctl(fd, ASHMEM_SET_SIZE, area_size) < 0)
+		child_fail(ASHMEM_DEV);
+	area = mmap(NULL, area_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	if (area == MAP_FAILED)
+		child_fail("mmap");
+	touch_pages(area, area_size);
+
+	if (rt_prio && sched_setscheduler(0, SCHED_FIFO, &param))
+		child_fail("SCHED_FIFO");
+
+	child_ready();
+	while (!shared->go)
+		usleep(1000);
+
+	while (!shared->stop) {
+		pin.offset = rand_r(&seed) % chunks * chunk_size;
+		pin.len = chunk_size;
+
+		t0 = now_us();
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0) {
+			perror("ASHMEM_UNPIN");
+			exit(1);
+		}
+		record(res->unpin, now_us() - t0);
+
+		/* Give the shrinker a chance at it. */
+		sched_yield();
+
+		t0 = now_us();
+		ret = ioctl(fd, ASHMEM_PIN, &pin);
+		if (ret < 0) {
+			perror("ASHMEM_PIN");
+			exit(1);
+		}
+		record(res->pin, now_us() - t0);
+
+		if (ret == ASHMEM_WAS_PURGED)
+			res->pin_purged++;
+		/* Decode the image again, or just use it. */
+		touch_pages(area + pin.offset, chunk_size);
+		res->ops++;
+	}
+
+	if (!ioctl(fd, ASHMEM_GET_PURGE_STATS, &stats))
+		res->purged_pages = stats.purged_pages;
+	exit(0);
+}
+
+/* Keep writing every page of hog_mb of anonymous memory. */
+static void hog(long hog_mb)
+{
+	size_t size = (size_t)hog_mb << 20;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		child_fail("hog mmap");
+	child_ready();
+	for (;;)
+		touch_pages(p, size);
+}
+
+static long percentile(const unsigned int *lat, unsigned long total,
+		       int permille)
+{
+	unsigned long want = (total * permille + 999) / 1000, seen = 0;
+	long i;
+
+	for (i = 0; i <= LAT_BUCKETS; ++i) {
+		seen += lat[i];
+		if (seen >= want)
+			return i;
+	}
+	return LAT_BUCKETS;
+}
+
+static long max_latency(const unsigned int *lat)
+{
+	long i;
+
+	for (i = LAT_BUCKETS; i > 0 && !lat[i]; --i)
+		;
+	return i;
+}
+
+/* Sum workers first to last - 1 and print them as one line. */
+static void report(const char *name, int first, int last, int seconds)
+{
+	static struct result sum;
+	int i, j;
+
+	memset(&sum, 0, sizeof sum);
+	for (i = first; i < last; ++i) {
+		sum.ops += shared->res[i].ops;
+		sum.pin_purged += shared->res[i].pin_purged;
+		sum.purged_pages += shared->res[i].purged_pages;
+		for (j = 0; j <= LAT_BUCKETS; ++j) {
+			sum.pin[j] += shared->res[i].pin[j];
+			sum.unpin[j] += shared->res[i].unpin[j];
+		}
+	}
+
+	printf("%-7s %5d %9lu %6ld %6ld %6ld%s %6ld %6ld %6ld%s "
+	       "%9lu %9lu\n", name, last - first, sum.ops / seconds,
+	       percentile(sum.pin, sum.ops, 500),
+	       percentile(sum.pin, sum.ops, 990),
+	       max_latency(sum.pin),
+	       max_latency(sum.pin) == LAT_BUCKETS ? "+" : " ",
+	       percentile(sum.unpin, sum.ops, 500),
+	       percentile(sum.unpin, sum.ops, 990),
+	       max_latency(sum.unpin),
+	       max_latency(sum.unpin) == LAT_BUCKETS ? "+" : " ",
+	       sum.pin_purged, sum.purged_pages);
+}
+
+int main(int argc, char **argv)
+{
+	int procs = -1, seconds = 10, rt_prio = 0, opt, i, nr = 0;
+	long area_kb = 4096, chunk_kb = 64, hog_mb = 0;
+	pid_t pids[MAX_PROCS + 1];
+	char c;
+
+	while ((opt = getopt(argc, argv, "p:s:c:m:r:d:")) != -1) {
+		switch (opt) {
+		case 'p': procs = atoi(optarg); break;
+		case 's': area_kb = atol(optarg); break;
+		case 'c': chunk_kb = atol(optarg); break;
+		case 'm': hog_mb = atol(optarg); break;
+		case 'r': rt_prio = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-p procs] [-s area_kb] "
+				"[-c chunk_kb] [-m hog_mb] [-r prio] "
+				"[-d seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (procs < 0)
+		procs = 4 * sysconf(_SC_NPROCESSORS_ONLN);
+	if (procs > MAX_PROCS)
+		procs = MAX_PROCS;
+	if (procs < 1 || seconds < 1 || rt_prio < 0 || hog_mb < 0 ||
+	    chunk_kb < 1 || (chunk_kb << 10) % page_size ||
+	    area_kb < chunk_kb) {
+		fprintf(stderr, "%s: bad argument\n", argv[0]);
+		return 1;
+	}
+
+	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED || pipe(ready_pipe)) {
+		perror(argv[0]);
+		return 1;
+	}
+	memset(shared, 0, sizeof *shared);
+
+	for (i = 0; i < procs; ++i) {
+		pids[nr] = fork();
+		if (!pids[nr])
+			worker(i, area_kb << 10, chunk_kb << 10,
+			       i ? 0 : rt_prio);
+		++nr;
+	}
+	if (hog_mb) {
+		pids[nr] = fork();
+		if (!pids[nr])
+			hog(hog_mb);
+		++nr;
+	}
+	for (i = 0; i < nr; ++i) {
+		if (read(ready_pipe[0], &c, 1) != 1 || c != '1') {
+			fprintf(stderr, "%s: a child failed\n", argv[0]);
+			for (i = 0; i < nr; ++i)
+				kill(pids[i], SIGKILL);
+			return 1;
+		}
+	}
+
+	shared->go = 1;
+	sleep(seconds);
+	shared->stop = 1;
+
+	for (i = 0; i < procs; ++i)
+		waitpid(pids[i], NULL, 0);
+	if (hog_mb) {
+		kill(pids[procs], SIGKILL);
+		waitpid(pids[procs], NULL, 0);
+	}
+
+	printf("%d workers, %ld kB areas, %ld kB chunks, %ld MB hog, "
+	       "%d s\n\n", procs, area_kb, chunk_kb, hog_mb, seconds);
+	printf("%-7s %5s %9s %20s  %20s  %9s %9s\n", "", "", "",
+	       "pin us", "unpin us", "pins", "pages");
+	printf("%-7s %5s %9s %6s %6s %6s  %6s %6s %6s  %9s %9s\n", "",
+	       "procs", "ops/s", "p50", "p99", "max", "p50", "p99", "max",
+	       "purged", "purged");
+	if (rt_prio) {
+		report("rt", 0, 1, seconds);
+		if (procs > 1)
+			report("normal", 1, procs, seconds);
+	} else {
+		report("all", 0, procs, seconds);
+	}
+	return 0;
+}
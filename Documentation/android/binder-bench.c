@@ -0,0 +1,726 @@
+/*
+ * binder-bench.c - binder transaction throughput and latency
+ *
+ * Runs pairs of processes, a client and a server, which make binder
+ * calls to each other and to nobody else.  The pairs share nothing
+ * but the driver, so if total throughput stops growing as pairs are
+ * added while there are still idle CPUs, the driver is serializing
+ * them.  Each run reports calls per second and the call latency.
+ *
+ * Build:  gcc -O2 -I../../drivers/staging/android -o binder-bench \
+ *             binder-bench.c -lpthread
+ * Usage:  binder-bench [-P pairs] [-d seconds] [-s bytes] [-a] [-k keep]
+ *         binder-bench -r prio [-b clients] [-t threads] [-w work_us]
+ *                      [-i interval_us] [-d seconds]
+ *
+ *   -P pairs    run this many pairs; otherwise 1, 2, 4 ... pairs up to
+ *               four per online CPU are run in turn
+ *   -d seconds  length of each run (default 5)
+ *   -s bytes    payload of each call (default 128); replies are empty
+ *   -a          buffer allocator mode: run one pair (or -P pairs) with
+ *               parcels of 128 bytes up to 128 kB, each call a random
+ *               size between half and all of that, and after each run
+ *               show the first server's allocator statistics from
+ *               debugfs binder/stats
+ *   -k keep     servers hold on to the last keep parcels before freeing
+ *               them, so that new ones are allocated around them; keep
+ *               times the parcel size must fit the 1 MB mapping
+ *
+ * Many small parcels against few large ones is -a compared on calls/s
+ * and MB/s; -a -k 4 also makes the allocator work around live buffers
+ * and shows the fragmentation and page cache use that results.
+ *
+ *   -r prio     real-time mode: one server with a pool of threads is
+ *               kept busy by background clients, while one SCHED_FIFO
+ *               client at prio calls it every interval_us, as an audio
+ *               thread would; its latency percentiles are reported
+ *   -b clients  background clients (default four per online CPU)
+ *   -t threads  server threads (default 2)
+ *   -w work_us  time a server thread spends on each call (default 1000)
+ *   -i interval_us  time between real-time calls (default 5000)
+ *
+ * Run -r with /sys/module/binder/parameters/inherit_rt set to 0 and 1
+ * to see what priority inheritance buys the real-time caller.
+ *
+ * To see scaling with the CPU count, repeat with CPUs taken offline:
+ *
+ *   echo 0 > /sys/devices/system/cpu/cpu1/online
+ *
+ * The tool is its own context manager, which the driver allows only
+ * once, so servicemanager must not be running ("stop" it first).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define MAP_SIZE	((1 << 20) - 2 * 4096)	/* what libbinder maps */
+#define MAX_PAIRS	64
+#define MAX_PAYLOAD	(256 << 10)
+#define MAX_KEEP	64
+#define LAT_BUCKETS	10000			/* 1 us each */
+#define BINDER_STATS	"/sys/kernel/debug/binder/stats"
+#define INHERIT_RT	"/sys/module/binder/parameters/inherit_rt"
+
+enum {
+	CMD_ADD = 1,		/* register a server */
+	CMD_GET,		/* look one up */
+	CMD_CALL,
+};
+
+/* One thread's end of the driver. */
+struct bthread {
+	int fd;
+	char out[512];
+	size_t out_len;
+	char in[256];
+	size_t in_len, in_pos;
+};
+
+struct result {
+	unsigned long calls;
+	unsigned long errors;
+	unsigned long long bytes;
+	unsigned int lat[LAT_BUCKETS + 1];	/* last is overflow */
+};
+
+/* Shared with the children. */
+struct shared {
+	volatile int go;
+	volatile int stop;
+	struct result res[MAX_PAIRS + 1];
+};
+
+struct server_msg {
+	struct flat_binder_object obj;
+	uint32_t index;
+};
+
+static struct shared *shared;
+static int mgr_fd;
+static int ready_pipe[2];
+static int payload_size = 128;
+static int alloc_mode;
+static int keep;
+static int server_threads;
+static long work_us;
+static int node_cookie;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(long long t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000,
+		.tv_nsec = t % 1000000 * 1000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static int binder_open(void)
+{
+	int fd = open(BINDER_DEV, O_RDWR);
+
+	if (fd < 0)
+		return -1;
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Queue a command; it is sent by the next wait_txn(). */
+static void put(struct bthread *t, uint32_t cmd, const void *data,
+		size_t size)
+{
+	memcpy(t->out + t->out_len, &cmd, sizeof cmd);
+	memcpy(t->out + t->out_len + sizeof cmd, data, size);
+	t->out_len += sizeof cmd + size;
+}
+
+static void put_free(struct bthread *t, struct binder_transaction_data *tr)
+{
+	put(t, BC_FREE_BUFFER, &tr->data.ptr.buffer, sizeof(void *));
+}
+
+static void put_free_ptr(struct bthread *t, const void *buffer)
+{
+	put(t, BC_FREE_BUFFER, &buffer, sizeof(void *));
+}
+
+/*
+ * Send the queued commands, then read until a transaction or a reply
+ * arrives.  Reference count requests from the driver are acknowledged
+ * along the way.  Returns BR_TRANSACTION or BR_REPLY with *tr filled
+ * in, or 0 if the call failed.
+ */
+static uint32_t wait_txn(struct bthread *t, struct binder_transaction_data *tr)
+{
+	struct binder_write_read bwr;
+	uint32_t cmd;
+	void *p;
+
+	for (;;) {
+		while (t->in_pos < t->in_len) {
+			memcpy(&cmd, t->in + t->in_pos, sizeof cmd);
+			p = t->in + t->in_pos + sizeof cmd;
+			t->in_pos += sizeof cmd + _IOC_SIZE(cmd);
+
+			switch (cmd) {
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(tr, p, sizeof *tr);
+				return cmd;
+			case BR_INCREFS:
+				put(t, BC_INCREFS_DONE, p,
+				    sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_ACQUIRE:
+				put(t, BC_ACQUIRE_DONE, p,
+				    sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+			case BR_ERROR:
+				return 0;
+			default:
+				break;
+			}
+		}
+
+		memset(&bwr, 0, sizeof bwr);
+		bwr.write_size = t->out_len;
+		bwr.write_buffer = (unsigned long)t->out;
+		bwr.read_size = sizeof t->in;
+		bwr.read_buffer = (unsigned long)t->in;
+		while (ioctl(t->fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno != EINTR) {
+				perror("BINDER_WRITE_READ");
+				exit(1);
+			}
+		}
+		t->out_len = 0;
+		t->in_len = bwr.read_consumed;
+		t->in_pos = 0;
+	}
+}
+
+static void put_txn(struct bthread *t, uint32_t bc, size_t handle,
+		    uint32_t code, const void *data, size_t size,
+		    const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof tr);
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put(t, bc, &tr, sizeof tr);
+}
+
+/* Serves CMD_ADD and CMD_GET for the servers and clients. */
+static void *manager(void *arg)
+{
+	static uint32_t handles[4096];
+	struct bthread t = { .fd = mgr_fd };
+	struct binder_transaction_data tr;
+	struct flat_binder_object reply;
+	static const size_t off;
+	const struct server_msg *msg;
+	uint32_t index;
+
+	put(&t, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (wait_txn(&t, &tr) != BR_TRANSACTION)
+			continue;
+
+		memset(&reply, 0, sizeof reply);
+		reply.type = BINDER_TYPE_HANDLE;
+		if (tr.code == CMD_ADD && tr.data_size == sizeof *msg) {
+			msg = tr.data.ptr.buffer;
+			index = msg->index % 4096;
+			handles[index] = msg->obj.handle;
+			/* Keep the ref once the buffer holding it is freed. */
+			put(&t, BC_ACQUIRE, &handles[index], sizeof(uint32_t));
+			put_free(&t, &tr);
+			put_txn(&t, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		} else if (tr.code == CMD_GET && tr.data_size == sizeof index) {
+			memcpy(&index, tr.data.ptr.buffer, sizeof index);
+			reply.handle = handles[index % 4096];
+			put_free(&t, &tr);
+			put_txn(&t, BC_REPLY, 0, 0, &reply, sizeof reply,
+				&off, sizeof off);
+		} else {
+			put_free(&t, &tr);
+			put_txn(&t, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+		}
+	}
+	return NULL;
+}
+
+static void child_ready(void)
+{
+	if (write(ready_pipe[1], "1", 1) != 1)
+		exit(1);
+}
+
+/* A server thread: answers calls until killed. */
+static void *looper(void *arg)
+{
+	struct bthread *t = arg;
+	struct binder_transaction_data tr;
+	const void *kept[MAX_KEEP];
+	long long end;
+	int pos = 0;
+
+	memset(kept, 0, sizeof kept);
+	put(t, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (wait_txn(t, &tr) != BR_TRANSACTION)
+			continue;
+		for (end = now_us() + work_us; now_us() < end; )
+			;
+		if (keep) {
+			if (kept[pos])
+				put_free_ptr(t, kept[pos]);
+			kept[pos] = tr.data.ptr.buffer;
+			pos = (pos + 1) % keep;
+		} else {
+			put_free(t, &tr);
+		}
+		put_txn(t, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+	}
+	return NULL;
+}
+
+static void server(uint32_t index)
+{
+	struct bthread t;
+	struct binder_transaction_data tr;
+	struct server_msg msg;
+	static const size_t off;
+	struct bthread *extra;
+	pthread_t thread;
+	int i;
+
+	memset(&t, 0, sizeof t);
+	t.fd = binder_open();
+	if (t.fd < 0) {
+		perror(BINDER_DEV);
+		exit(1);
+	}
+
+	memset(&msg, 0, sizeof msg);
+	msg.obj.type = BINDER_TYPE_BINDER;
+	/* No minimum priority for the threads serving it, as libbinder */
+	msg.obj.flags = 0x7f;
+	msg.obj.binder = &node_cookie;
+	msg.obj.cookie = &node_cookie;
+	msg.index = index;
+	put_txn(&t, BC_TRANSACTION, 0, CMD_ADD, &msg, sizeof msg,
+		&off, sizeof off);
+	if (wait_txn(&t, &tr) != BR_REPLY) {
+		fprintf(stderr, "server %u: registration failed\n", index);
+		exit(1);
+	}
+	put_free(&t, &tr);
+	child_ready();
+
+	for (i = 1; i < server_threads; ++i) {
+		extra = calloc(1, sizeof *extra);
+		extra->fd = t.fd;
+		pthread_create(&thread, NULL, looper, extra);
+	}
+	looper(&t);
+	exit(0);
+}
+
+/*
+ * Call server index until told to stop, at SCHED_FIFO rt_prio if that
+ * is set, and at most once every interval_us if that is.
+ */
+static void client(uint32_t index, struct result *res, int rt_prio,
+		   long interval_us)
+{
+	struct bthread t;
+	struct binder_transaction_data tr;
+	const struct flat_binder_object *obj;
+	struct sched_param param = { .sched_priority = rt_prio };
+	uint32_t handle;
+	long long t0, lat, next;
+	unsigned int seed = index;
+	char *payload;
+	int size;
+
+	memset(&t, 0, sizeof t);
+	t.fd = binder_open();
+	if (t.fd < 0) {
+		perror(BINDER_DEV);
+		exit(1);
+	}
+
+	put_txn(&t, BC_TRANSACTION, 0, CMD_GET, &index, sizeof index,
+		NULL, 0);
+	obj = NULL;
+	if (wait_txn(&t, &tr) == BR_REPLY && tr.data_size == sizeof *obj)
+		obj = tr.data.ptr.buffer;
+	if (!obj || obj->type != BINDER_TYPE_HANDLE) {
+		fprintf(stderr, "client %u: lookup failed\n", index);
+		exit(1);
+	}
+	handle = obj->handle;
+	put(&t, BC_ACQUIRE, &handle, sizeof handle);
+	put_free(&t, &tr);
+
+	if (rt_prio && sched_setscheduler(0, SCHED_FIFO, &param)) {
+		perror("SCHED_FIFO");
+		exit(1);
+	}
+
+	payload = calloc(1, payload_size);
+	child_ready();
+	while (!shared->go)
+		usleep(1000);
+
+	next = now_us();
+	while (!shared->stop) {
+		if (interval_us) {
+			next += interval_us;
+			sleep_until_us(next);
+		}
+		size = payload_size;
+		if (alloc_mode)
+			size -= rand_r(&seed) % (payload_size / 2 + 1);
+
+		t0 = now_us();
+		put_txn(&t, BC_TRANSACTION, handle, CMD_CALL, payload,
+			size, NULL, 0);
+		if (wait_txn(&t, &tr) != BR_REPLY) {
+			res->errors++;
+			continue;
+		}
+		/* Freed along with the next call, as libbinder does. */
+		put_free(&t, &tr);
+
+		lat = now_us() - t0;
+		res->lat[lat < LAT_BUCKETS ? lat : LAT_BUCKETS]++;
+		res->calls++;
+		res->bytes += size;
+	}
+	exit(0);
+}
+
+static long percentile(const unsigned int *lat, unsigned long total,
+		       int permille)
+{
+	unsigned long want = (total * permille + 999) / 1000, seen = 0;
+	long i;
+
+	for (i = 0; i <= LAT_BUCKETS; ++i) {
+		seen += lat[i];
+		if (seen >= want)
+			return i;
+	}
+	return LAT_BUCKETS;
+}
+
+/* Print the allocator lines of the given proc from binder/stats. */
+static void print_alloc_stats(pid_t pid)
+{
+	char line[256], want[32];
+	int found = 0;
+	FILE *f;
+
+	f = fopen(BINDER_STATS, "r");
+	if (!f) {
+		perror("      " BINDER_STATS);
+		return;
+	}
+	snprintf(want, sizeof want, "proc %d\n", pid);
+	while (fgets(line, sizeof line, f)) {
+		if (!strncmp(line, "proc ", 5))
+			found = !strcmp(line, want);
+		else if (found && (strstr(line, "free space") ||
+				   strstr(line, "pages mapped")))
+			printf("      %s", line);
+	}
+	fclose(f);
+}
+
+static void run(int pairs, int seconds)
+{
+	static uint32_t next_index;
+	static unsigned int lat[LAT_BUCKETS + 1];
+	unsigned long calls = 0, errors = 0;
+	unsigned long long bytes = 0;
+	pid_t pids[2 * MAX_PAIRS];
+	int i, j, nr = 0;
+	long max = 0;
+	char c;
+
+	memset(shared, 0, sizeof *shared);
+	memset(lat, 0, sizeof lat);
+	fflush(stdout);
+
+	/* Servers register before their clients look them up. */
+	for (i = 0; i < pairs; ++i) {
+		pids[nr] = fork();
+		if (!pids[nr])
+			server(next_index + i);
+		++nr;
+	}
+	for (i = 0; i < pairs; ++i)
+		if (read(ready_pipe[0], &c, 1) != 1)
+			exit(1);
+
+	for (i = 0; i < pairs; ++i) {
+		pids[nr] = fork();
+		if (!pids[nr])
+			client(next_index + i, &shared->res[i], 0, 0);
+		++nr;
+	}
+	for (i = 0; i < pairs; ++i)
+		if (read(ready_pipe[0], &c, 1) != 1)
+			exit(1);
+	next_index += pairs;
+
+	shared->go = 1;
+	sleep(seconds);
+	shared->stop = 1;
+
+	for (i = pairs; i < nr; ++i)
+		waitpid(pids[i], NULL, 0);
+	for (i = 0; i < pairs; ++i) {
+		calls += shared->res[i].calls;
+		errors += shared->res[i].errors;
+		bytes += shared->res[i].bytes;
+		for (j = 0; j <= LAT_BUCKETS; ++j) {
+			lat[j] += shared->res[i].lat[j];
+			if (shared->res[i].lat[j] && j > max)
+				max = j;
+		}
+	}
+
+	printf("%5d %7d %9lu %7llu %9lu %7ld %7ld %6ld%s %6lu\n", pairs,
+	       payload_size, calls / seconds, bytes / seconds >> 20,
+	       calls / seconds / pairs, percentile(lat, calls, 500),
+	       percentile(lat, calls, 990), max,
+	       max == LAT_BUCKETS ? "+" : " ", errors);
+	/* The servers still hold their buffers. */
+	if (alloc_mode)
+		print_alloc_stats(pids[0]);
+
+	for (i = 0; i < pairs; ++i) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+}
+
+static long max_latency(const unsigned int *lat)
+{
+	long i;
+
+	for (i = LAT_BUCKETS; i > 0 && !lat[i]; --i)
+		;
+	return i;
+}
+
+/*
+ * One server with server_threads threads, background clients keeping
+ * it busy and a real-time client at rt_prio in res[clients].
+ */
+static void run_rt(int clients, int rt_prio, long interval_us, int seconds)
+{
+	struct result *rt = &shared->res[clients];
+	unsigned long calls = 0, errors = 0;
+	pid_t pids[MAX_PAIRS + 2];
+	int i, nr = 0;
+	char c;
+	FILE *f;
+
+	memset(shared, 0, sizeof *shared);
+	fflush(stdout);
+
+	pids[nr] = fork();
+	if (!pids[nr])
+		server(0);
+	++nr;
+	if (read(ready_pipe[0], &c, 1) != 1)
+		exit(1);
+
+	for (i = 0; i <= clients; ++i) {
+		pids[nr] = fork();
+		if (!pids[nr]) {
+			if (i < clients)
+				client(0, &shared->res[i], 0, 0);
+			client(0, rt, rt_prio, interval_us);
+		}
+		++nr;
+	}
+	for (i = 0; i <= clients; ++i)
+		if (read(ready_pipe[0], &c, 1) != 1)
+			exit(1);
+
+	shared->go = 1;
+	sleep(seconds);
+	shared->stop = 1;
+
+	for (i = 1; i < nr; ++i)
+		waitpid(pids[i], NULL, 0);
+	kill(pids[0], SIGKILL);
+	waitpid(pids[0], NULL, 0);
+
+	for (i = 0; i < clients; ++i) {
+		calls += shared->res[i].calls;
+		errors += shared->res[i].errors;
+	}
+
+	c = '?';
+	f = fopen(INHERIT_RT, "r");
+	if (f) {
+		if (fscanf(f, " %c", &c) != 1)
+			c = '?';
+		fclose(f);
+	}
+
+	printf("inherit_rt:    %c\n", c);
+	printf("background:    %d clients, %lu calls/s, %lu errors\n",
+	       clients, calls / seconds, errors);
+	printf("rt calls:      %lu, %lu errors\n", rt->calls, rt->errors);
+	printf("rt latency us: p50 %ld  p99 %ld  p99.9 %ld  max %ld%s\n",
+	       percentile(rt->lat, rt->calls, 500),
+	       percentile(rt->lat, rt->calls, 990),
+	       percentile(rt->lat, rt->calls, 999),
+	       max_latency(rt->lat),
+	       max_latency(rt->lat) == LAT_BUCKETS ? "+" : "");
+}
+
+int main(int argc, char **argv)
+{
+	int pairs = 0, seconds = 5, cpus, opt;
+	int rt_prio = 0, clients = -1;
+	long interval_us = 5000, work = -1;
+	struct sched_param param = { 0 };
+	pthread_t mgr;
+
+	while ((opt = getopt(argc, argv, "P:d:s:ak:r:b:t:w:i:")) != -1) {
+		switch (opt) {
+		case 'P': pairs = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 's': payload_size = atoi(optarg); break;
+		case 'a': alloc_mode = 1; break;
+		case 'k': keep = atoi(optarg); break;
+		case 'r': rt_prio = atoi(optarg); break;
+		case 'b': clients = atoi(optarg); break;
+		case 't': server_threads = atoi(optarg); break;
+		case 'w': work = atol(optarg); break;
+		case 'i': interval_us = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-P pairs] [-d seconds] "
+				"[-s bytes] [-a] [-k keep]\n"
+				"       %s -r prio [-b clients] [-t threads] "
+				"[-w work_us] [-i interval_us] [-d seconds]\n",
+				argv[0], argv[0]);
+			return 1;
+		}
+	}
+	if (pairs < 0 || pairs > MAX_PAIRS || seconds < 1 ||
+	    payload_size < 0 || payload_size > MAX_PAYLOAD ||
+	    keep < 0 || keep > MAX_KEEP || rt_prio < 0 ||
+	    clients > MAX_PAIRS || server_threads < 0 || interval_us < 0) {
+		fprintf(stderr, "%s: bad argument\n", argv[0]);
+		return 1;
+	}
+
+	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED || pipe(ready_pipe)) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	mgr_fd = binder_open();
+	if (mgr_fd < 0) {
+		perror(BINDER_DEV);
+		return 1;
+	}
+	if (ioctl(mgr_fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		return 1;
+	}
+	pthread_create(&mgr, NULL, manager, NULL);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (rt_prio) {
+		/* Fail here rather than in the real-time client. */
+		param.sched_priority = rt_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			perror("SCHED_FIFO");
+			return 1;
+		}
+		param.sched_priority = 0;
+		sched_setscheduler(0, SCHED_OTHER, &param);
+
+		if (clients < 0)
+			clients = 4 * cpus < MAX_PAIRS ? 4 * cpus : MAX_PAIRS;
+		if (!server_threads)
+			server_threads = 2;
+		work_us = work >= 0 ? work : 1000;
+		printf("cpus: %d, %d s, %d server threads, %ld us per call, "
+		       "rt prio %d every %ld us\n\n", cpus, seconds,
+		       server_threads, work_us, rt_prio, interval_us);
+		run_rt(clients, rt_prio, interval_us, seconds);
+		return 0;
+	}
+	work_us = work >= 0 ? work : 0;
+
+	printf("cpus: %d, %d s per run, servers keep %d parcels\n\n",
+	       cpus, seconds, keep);
+	printf("pairs   bytes   calls/s    MB/s  per pair  p50 us  p99 us "
+	       " max us errors\n");
+
+	if (alloc_mode) {
+		if (!pairs)
+			pairs = 1;
+		for (payload_size = 128; payload_size <= 128 << 10;
+		     payload_size *= 4)
+			run(pairs, seconds);
+	} else if (pairs) {
+		run(pairs, seconds);
+	} else {
+		for (pairs = 1; pairs <= 4 * cpus && pairs <= MAX_PAIRS;
+		     pairs *= 2)
+			run(pairs, seconds);
+	}
+	return 0;
+}
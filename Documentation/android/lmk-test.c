@@ -0,0 +1,277 @@
+/*
+ * lmk-test.c - many-process test of the low memory killer
+ *
+ * Spawns procs idle processes spread over oom_adj 1 to 15, each holding
+ * some memory, then lets a hog allocate until the low memory killer has
+ * killed kills of them.  Reports the order of the kills and the longest
+ * time the hog stalled on a single page.  The killer runs inside the
+ * hog's direct reclaim, so its victim selection cost shows up as those
+ * stalls; comparing -n 20 with -n 1000 shows how that cost grows with the
+ * number of processes.
+ *
+ * Build:  gcc -O2 -o lmk-test lmk-test.c
+ * Usage:  lmk-test [-n procs] [-s kb] [-k kills] [-t seconds]
+ *
+ *   -n procs    idle processes (default 500)
+ *   -s kb       memory held by each; process i holds (i % 4 + 1) * kb
+ *               (default 256)
+ *   -k kills    stop once this many have been killed (default 20)
+ *   -t seconds  give up after this long (default 60)
+ *
+ * Victims must go in order: a higher oom_adj before a lower one, and
+ * within one oom_adj the largest first.  Kills that break this order are
+ * counted.  Run as root on an otherwise idle device; the tool protects
+ * itself with oom_adj -17, but anything else may be killed as well.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_PROCS	4096
+#define STALL_BUCKETS	1000			/* 100 us each */
+
+struct proc {
+	pid_t pid;
+	int adj;
+	long kb;
+	int alive;
+};
+
+/* Shared with the hog. */
+struct shared {
+	volatile int stop;
+	long mb;
+	unsigned int stall[STALL_BUCKETS + 1];	/* last is overflow */
+	long long max_stall_us;
+};
+
+static struct proc procs[MAX_PROCS];
+static struct shared *shared;
+static long page_size;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int set_oom_adj(int adj)
+{
+	FILE *f = fopen("/proc/self/oom_adj", "w");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%d\n", adj) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+static void *touch_new(size_t size)
+{
+	char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	size_t off;
+
+	if (p == MAP_FAILED)
+		return NULL;
+	for (off = 0; off < size; off += page_size)
+		p[off] = 1;
+	return p;
+}
+
+static void idle_proc(int adj, long kb, int ready_fd)
+{
+	char c;
+
+	/* Tell the parent either way, so that it does not wait forever. */
+	c = set_oom_adj(adj) || !touch_new(kb << 10) ? '0' : '1';
+	if (write(ready_fd, &c, 1) != 1 || c != '1')
+		_exit(1);
+	for (;;)
+		pause();
+}
+
+/* Allocate a megabyte at a time until told to stop. */
+static void hog(void)
+{
+	long long t0, us;
+	size_t off;
+	char *p;
+
+	set_oom_adj(0);
+	while (!shared->stop) {
+		p = mmap(NULL, 1 << 20, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			_exit(1);
+		for (off = 0; off < 1 << 20 && !shared->stop;
+		     off += page_size) {
+			t0 = now_us();
+			p[off] = 1;
+			us = now_us() - t0;
+			shared->stall[us / 100 < STALL_BUCKETS ?
+				      us / 100 : STALL_BUCKETS]++;
+			if (us > shared->max_stall_us)
+				shared->max_stall_us = us;
+		}
+		shared->mb++;
+	}
+	_exit(0);
+}
+
+static struct proc *find(pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < MAX_PROCS; ++i)
+		if (procs[i].pid == pid)
+			return &procs[i];
+	return NULL;
+}
+
+/* Was some other live process a better victim than p? */
+static int out_of_order(const struct proc *p, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		if (!procs[i].alive || &procs[i] == p)
+			continue;
+		if (procs[i].adj > p->adj ||
+		    (procs[i].adj == p->adj && procs[i].kb > p->kb))
+			return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 500, kills = 20, seconds = 60, opt, i, status;
+	int killed = 0, disorder = 0, ready[2];
+	long kb = 256;
+	unsigned long stalls = 0, seen = 0;
+	long long start, p99 = 0;
+	struct proc *p;
+	pid_t hog_pid, pid;
+	char c;
+
+	while ((opt = getopt(argc, argv, "n:s:k:t:")) != -1) {
+		switch (opt) {
+		case 'n': n = atoi(optarg); break;
+		case 's': kb = atol(optarg); break;
+		case 'k': kills = atoi(optarg); break;
+		case 't': seconds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n procs] [-s kb] "
+				"[-k kills] [-t seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n < 1 || n > MAX_PROCS || kb < 1 || kills < 1 || seconds < 1) {
+		fprintf(stderr, "%s: bad argument\n", argv[0]);
+		return 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	shared = mmap(NULL, sizeof *shared, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED || pipe(ready)) {
+		perror(argv[0]);
+		return 1;
+	}
+	if (set_oom_adj(-17))
+		perror("oom_adj -17");
+
+	for (i = 0; i < n; ++i) {
+		procs[i].adj = i % 15 + 1;
+		procs[i].kb = (i % 4 + 1) * kb;
+		procs[i].alive = 1;
+		procs[i].pid = fork();
+		if (!procs[i].pid)
+			idle_proc(procs[i].adj, procs[i].kb, ready[1]);
+		if (procs[i].pid < 0) {
+			perror("fork");
+			n = i;
+			break;
+		}
+	}
+	for (i = 0; i < n; ++i) {
+		if (read(ready[0], &c, 1) != 1 || c != '1') {
+			fprintf(stderr, "%s: a process failed to start\n",
+				argv[0]);
+			for (i = 0; i < n; ++i)
+				kill(procs[i].pid, SIGKILL);
+			return 1;
+		}
+	}
+	printf("%d processes holding %ld to %ld kB\n", n, kb, 4 * kb);
+
+	start = now_us();
+	hog_pid = fork();
+	if (!hog_pid)
+		hog();
+
+	while (killed < kills && now_us() - start < seconds * 1000000LL) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0) {
+			usleep(1000);
+			continue;
+		}
+		if (pid == hog_pid) {
+			printf("hog exited first, status %x\n", status);
+			hog_pid = 0;
+			break;
+		}
+		p = find(pid);
+		if (!p)
+			continue;
+		if (out_of_order(p, n))
+			++disorder;
+		p->alive = 0;
+		++killed;
+		printf("  killed %5d  adj %2d  %6ld kB  %7lld ms%s\n",
+		       pid, p->adj, p->kb, (now_us() - start) / 1000,
+		       WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL ?
+		       "" : "  (not by SIGKILL)");
+	}
+
+	shared->stop = 1;
+	if (hog_pid)
+		waitpid(hog_pid, NULL, 0);
+	for (i = 0; i < n; ++i) {
+		if (procs[i].alive) {
+			kill(procs[i].pid, SIGKILL);
+			waitpid(procs[i].pid, NULL, 0);
+		}
+	}
+
+	for (i = 0; i <= STALL_BUCKETS; ++i)
+		stalls += shared->stall[i];
+	for (i = 0; i <= STALL_BUCKETS; ++i) {
+		seen += shared->stall[i];
+		if (seen * 100 >= stalls * 99) {
+			p99 = i * 100LL;
+			break;
+		}
+	}
+
+	printf("killed:        %d of %d in %lld ms, %d out of order\n",
+	       killed, n, (now_us() - start) / 1000, disorder);
+	printf("hog:           %ld MB\n", shared->mb);
+	printf("page stall:    p99 %lld us, max %lld us\n", p99,
+	       shared->max_stall_us);
+	return killed < kills;
+}
@@ -0,0 +1,465 @@
+/*
+ * frame-replay.c - replay a frame workload and report how cpufreq kept up
+ *
+ * Replays frames of CPU work, each due by the end of its period, the way
+ * a UI thread renders a scroll.  Reports the time from the first frame
+ * until cpu0 reaches its maximum frequency, and the frames which missed
+ * their deadline.  Runs are repeatable, so governor settings can be
+ * compared, e.g. the interactive governor with input_boost 0 and 1.
+ *
+ * Build:  gcc -O2 -o frame-replay frame-replay.c -lpthread -lm
+ * Usage:  frame-replay [-t trace] [-n frames] [-p period_us] [-w work_us]
+ *                      [-b] [-u] [-s ws_kb] [-m hog_mb]
+ *                      [-F fg_memcg] [-B bg_memcg]
+ *
+ *   -t trace   replay "<period_us> <work_us>" lines from a file
+ *   -n -p -w   otherwise replay n frames of work_us each period_us
+ *              (default 60 frames of 10000 uS every 16667 uS)
+ *   -b         write the governor's boostpulse before the first frame
+ *   -u         send a touch through /dev/uinput before the first frame,
+ *              which is what a real scroll starts with
+ *   -s ws_kb   give the replay a working set of ws_kb, every page of
+ *              which is touched by every frame
+ *   -m hog_mb  run a background process which keeps writing hog_mb of
+ *              anonymous memory, to put the system under memory pressure
+ *   -F -B      memory cgroup directories to move the replay (-F) and the
+ *              hog (-B) into, e.g. /dev/memcg/fg and /dev/memcg/bg
+ *
+ * Work is measured in busy loop iterations, calibrated at the start
+ * while the CPU runs flat out, so a frame of 10000 uS takes 10 ms at
+ * the maximum frequency and longer below it.  The replay starts after
+ * two seconds of idle to let the governor settle at a low speed.
+ *
+ * With -s and -m the replay measures how well reclaim protects a
+ * foreground app: a frame whose working set was swapped out takes major
+ * faults and runs late.  Frame time jitter and the major faults taken
+ * during the replay are reported.  Give the -F group a soft limit above
+ * ws_kb and the -B group a low one, e.g.
+ *
+ *   echo 64M > /dev/memcg/fg/memory.soft_limit_in_bytes
+ *   echo 1M > /dev/memcg/bg/memory.soft_limit_in_bytes
+ *   frame-replay -n 600 -s 32768 -m 400 -F /dev/memcg/fg -B /dev/memcg/bg
+ *
+ * and compare against the same run without -F and -B.  The hog runs on
+ * the last CPU so that it only competes with the replay for memory.
+ * Without cpufreq, e.g. in a virtual machine, the time to max is skipped.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#define CPUFREQ		"/sys/devices/system/cpu/cpu0/cpufreq/"
+#define BOOSTPULSE	"/sys/devices/system/cpu/cpufreq/interactive/boostpulse"
+#define MAX_FRAMES	4096
+
+struct frame {
+	long period_us;
+	long work_us;
+};
+
+static struct frame frames[MAX_FRAMES];
+static int nr_frames;
+
+static char *ws;
+static size_t ws_size;
+static long page_size;
+
+static double loops_per_us;
+static volatile unsigned long sink;
+
+static volatile int polling;
+static long long start_us;
+static long long max_reached_us = -1;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(long long t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000,
+		.tv_nsec = t % 1000000 * 1000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static void spin(unsigned long loops)
+{
+	unsigned long i;
+
+	for (i = 0; i < loops; ++i)
+		sink += i;
+}
+
+static void touch_pages(char *p, size_t size)
+{
+	size_t off;
+
+	for (off = 0; off < size; off += page_size)
+		p[off]++;
+}
+
+static long read_khz(const char *name)
+{
+	char path[128];
+	long khz = -1;
+	FILE *f;
+
+	snprintf(path, sizeof path, CPUFREQ "%s", name);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%ld", &khz) != 1)
+			khz = -1;
+		fclose(f);
+	}
+	return khz;
+}
+
+/* Spin for half a second so the governor goes to max, then measure. */
+static void calibrate(void)
+{
+	const unsigned long loops = 1000000;
+	long long t;
+
+	for (t = now_us() + 500000; now_us() < t; )
+		spin(loops);
+
+	t = now_us();
+	spin(20 * loops);
+	loops_per_us = 20.0 * loops / (now_us() - t);
+}
+
+static void *poll_freq(void *arg)
+{
+	long max = *(long *)arg;
+	cpu_set_t set;
+
+	/* Keep off the CPU doing the work, if there is another one. */
+	CPU_ZERO(&set);
+	CPU_SET(1, &set);
+	sched_setaffinity(0, sizeof set, &set);
+
+	while (polling) {
+		if (max_reached_us < 0 && read_khz("scaling_cur_freq") >= max)
+			max_reached_us = now_us() - start_us;
+		usleep(500);
+	}
+	return NULL;
+}
+
+static int boostpulse(void)
+{
+	int fd = open(BOOSTPULSE, O_WRONLY);
+	int ret;
+
+	if (fd < 0)
+		return -1;
+	ret = write(fd, "1", 1) == 1 ? 0 : -1;
+	close(fd);
+	return ret;
+}
+
+static void emit(int fd, int type, int code, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	if (write(fd, &ev, sizeof ev) != sizeof ev)
+		perror("uinput write");
+}
+
+/* A touchscreen that reports one touch down when asked. */
+static int touch_open(void)
+{
+	struct uinput_user_dev dev;
+	int fd = open("/dev/uinput", O_WRONLY);
+
+	if (fd < 0)
+		return -1;
+
+	memset(&dev, 0, sizeof dev);
+	strcpy(dev.name, "frame-replay touch");
+	dev.id.bustype = BUS_VIRTUAL;
+	dev.absmax[ABS_MT_POSITION_X] = 1023;
+	dev.absmax[ABS_MT_POSITION_Y] = 1023;
+
+	if (ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0 ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X) < 0 ||
+	    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y) < 0 ||
+	    write(fd, &dev, sizeof dev) != sizeof dev ||
+	    ioctl(fd, UI_DEV_CREATE) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void touch(int fd)
+{
+	emit(fd, EV_ABS, ABS_MT_POSITION_X, 512);
+	emit(fd, EV_ABS, ABS_MT_POSITION_Y, 512);
+	emit(fd, EV_SYN, SYN_MT_REPORT, 0);
+	emit(fd, EV_SYN, SYN_REPORT, 0);
+}
+
+static int memcg_attach(const char *dir, pid_t pid)
+{
+	char path[256];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof path, "%s/tasks", dir);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%d\n", pid) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/*
+ * Fork a process which writes every page of hog_mb of anonymous memory
+ * over and over.  Returns once it has been through all of it once.
+ */
+static pid_t hog_start(long hog_mb, const char *memcg)
+{
+	size_t size = hog_mb << 20;
+	int pipefd[2];
+	cpu_set_t set;
+	pid_t pid;
+	char *p;
+
+	if (pipe(pipefd))
+		return -1;
+
+	pid = fork();
+	if (pid) {
+		char c;
+
+		close(pipefd[1]);
+		if (pid > 0 && read(pipefd[0], &c, 1) != 1) {
+			waitpid(pid, NULL, 0);
+			pid = -1;
+		}
+		close(pipefd[0]);
+		return pid;
+	}
+
+	close(pipefd[0]);
+	CPU_ZERO(&set);
+	CPU_SET(sysconf(_SC_NPROCESSORS_ONLN) - 1, &set);
+	sched_setaffinity(0, sizeof set, &set);
+	if (memcg && memcg_attach(memcg, getpid()))
+		perror(memcg);
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("hog mmap");
+		_exit(1);
+	}
+	touch_pages(p, size);
+	if (write(pipefd[1], "1", 1) != 1)
+		_exit(1);
+	close(pipefd[1]);
+	for (;;)
+		touch_pages(p, size);
+}
+
+static int load_trace(const char *name)
+{
+	FILE *f = fopen(name, "r");
+
+	if (!f)
+		return -1;
+	while (nr_frames < MAX_FRAMES &&
+	       fscanf(f, "%ld %ld", &frames[nr_frames].period_us,
+		      &frames[nr_frames].work_us) == 2)
+		++nr_frames;
+	fclose(f);
+	return nr_frames ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	long period_us = 16667, work_us = 10000, max_khz;
+	long long deadline, late, worst = 0, frame_start, frame_us;
+	double sum = 0, sum_sq = 0, mean, var;
+	long long frame_max = 0;
+	long ws_kb = 0, hog_mb = 0;
+	int n = 60, boost = 0, uinput = 0, touch_fd = -1;
+	int i, opt, missed = 0;
+	const char *trace = NULL, *fg_memcg = NULL, *bg_memcg = NULL;
+	struct rusage ru_start, ru_end;
+	pid_t hog = 0;
+	pthread_t poller;
+
+	while ((opt = getopt(argc, argv, "t:n:p:w:bus:m:F:B:")) != -1) {
+		switch (opt) {
+		case 't': trace = optarg; break;
+		case 'n': n = atoi(optarg); break;
+		case 'p': period_us = atol(optarg); break;
+		case 'w': work_us = atol(optarg); break;
+		case 'b': boost = 1; break;
+		case 'u': uinput = 1; break;
+		case 's': ws_kb = atol(optarg); break;
+		case 'm': hog_mb = atol(optarg); break;
+		case 'F': fg_memcg = optarg; break;
+		case 'B': bg_memcg = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-t trace] [-n frames] "
+				"[-p period_us] [-w work_us] [-b] [-u] "
+				"[-s ws_kb] [-m hog_mb] [-F fg_memcg] "
+				"[-B bg_memcg]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (trace) {
+		if (load_trace(trace)) {
+			fprintf(stderr, "%s: no frames\n", trace);
+			return 1;
+		}
+	} else {
+		for (i = 0; i < n && i < MAX_FRAMES; ++i) {
+			frames[i].period_us = period_us;
+			frames[i].work_us = work_us;
+		}
+		nr_frames = i;
+	}
+
+	max_khz = read_khz("scaling_max_freq");
+	if (max_khz < 0)
+		perror(CPUFREQ "scaling_max_freq");
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (fg_memcg && memcg_attach(fg_memcg, getpid())) {
+		perror(fg_memcg);
+		return 1;
+	}
+	if (ws_kb) {
+		ws_size = ws_kb << 10;
+		ws = mmap(NULL, ws_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ws == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+		touch_pages(ws, ws_size);
+	}
+
+	/* The work runs on cpu0, whose frequency is polled. */
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(0, &set);
+		sched_setaffinity(0, sizeof set, &set);
+	}
+
+	if (uinput && (touch_fd = touch_open()) < 0)
+		perror("/dev/uinput");
+
+	calibrate();
+	if (hog_mb && (hog = hog_start(hog_mb, bg_memcg)) < 0) {
+		perror("hog");
+		return 1;
+	}
+	sleep(2);
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	polling = max_khz > 0;
+	start_us = now_us();
+	if (polling)
+		pthread_create(&poller, NULL, poll_freq, &max_khz);
+
+	if (boost && boostpulse())
+		perror(BOOSTPULSE);
+	if (touch_fd >= 0)
+		touch(touch_fd);
+
+	deadline = start_us;
+	for (i = 0; i < nr_frames; ++i) {
+		deadline += frames[i].period_us;
+		frame_start = now_us();
+		if (ws)
+			touch_pages(ws, ws_size);
+		spin(frames[i].work_us * loops_per_us);
+
+		frame_us = now_us() - frame_start;
+		sum += frame_us;
+		sum_sq += (double)frame_us * frame_us;
+		if (frame_us > frame_max)
+			frame_max = frame_us;
+
+		late = now_us() - deadline;
+		if (late > 0) {
+			++missed;
+			if (late > worst)
+				worst = late;
+			/* A late frame pushes the next one back. */
+			deadline = now_us();
+		} else {
+			sleep_until_us(deadline);
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &ru_end);
+	if (polling) {
+		polling = 0;
+		pthread_join(poller, NULL);
+	}
+	if (hog > 0) {
+		kill(hog, SIGKILL);
+		waitpid(hog, NULL, 0);
+	}
+	if (touch_fd >= 0) {
+		ioctl(touch_fd, UI_DEV_DESTROY);
+		close(touch_fd);
+	}
+
+	printf("frames:        %d\n", nr_frames);
+	printf("missed:        %d\n", missed);
+	printf("worst late:    %lld us\n", worst);
+	mean = sum / nr_frames;
+	var = sum_sq / nr_frames - mean * mean;
+	printf("frame time:    %.0f us mean, %.0f us jitter, %lld us max\n",
+	       mean, var > 0 ? sqrt(var) : 0, frame_max);
+	printf("major faults:  %ld\n", ru_end.ru_majflt - ru_start.ru_majflt);
+	if (max_khz < 0)
+		printf("time to max:   no cpufreq\n");
+	else if (max_reached_us >= 0)
+		printf("time to max:   %lld us\n", max_reached_us);
+	else
+		printf("time to max:   never (%ld kHz)\n", max_khz);
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * swap-bench: swap-out and swap-in throughput
+ *
+ * Forks workers which each fill an anonymous buffer with pages of a
+ * chosen compressibility, then keep writing to every page in turn.
+ * With the buffers larger than the memory they may use, every pass
+ * swaps them out and back in, and the pswpout and pswpin counters of
+ * /proc/vmstat give the pages per second moved.
+ *
+ * Build:  gcc -O2 -o swap-bench swap-bench.c
+ * Usage:  swap-bench [-j workers] [-m mb] [-r percent] [-p passes]
+ *                    [-g memcg]
+ *
+ *   -j workers  processes writing at once (default one per online CPU)
+ *   -m mb       buffer size of each worker (default 64)
+ *   -r percent  random bytes per page, the rest being zero; 50 makes
+ *               pages that LZO compresses to a little over half
+ *   -p passes   passes over the buffers after the first fill (default 3)
+ *   -g memcg    memory cgroup directory to run the workers in; give it
+ *               a memory.limit_in_bytes well below workers * mb so that
+ *               the workers swap without pushing the rest of the system
+ *
+ * For ramzswap, compare -j 1 with -j <CPUs>: with one compression
+ * stream per CPU, swap-out throughput should grow with the workers.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_WORKERS	64
+
+static long page_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void vmstat(unsigned long *out, unsigned long *in)
+{
+	char name[64];
+	unsigned long val;
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	*out = *in = 0;
+	if (!f)
+		return;
+	while (fscanf(f, "%63s %lu", name, &val) == 2) {
+		if (!strcmp(name, "pswpout"))
+			*out = val;
+		else if (!strcmp(name, "pswpin"))
+			*in = val;
+	}
+	fclose(f);
+}
+
+static int memcg_attach(const char *dir)
+{
+	char path[256];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/tasks", dir);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%d\n", getpid()) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+/*
+ * Fill the buffer, then make a pass over it each time the parent writes
+ * a byte to go, answering with a byte on done after each.
+ */
+static void worker(int index, size_t size, int percent, int go, int done)
+{
+	unsigned int seed = index + 1;
+	size_t off, i, random = page_size * percent / 100;
+	char *buf, c;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (off = 0; off < size; off += page_size)
+		for (i = 0; i < random; ++i)
+			buf[off + i] = rand_r(&seed);
+	if (write(done, "1", 1) != 1)
+		exit(1);
+
+	while (read(go, &c, 1) == 1) {
+		for (off = 0; off < size; off += page_size)
+			buf[off]++;
+		if (write(done, "1", 1) != 1)
+			exit(1);
+	}
+	exit(0);
+}
+
+/* Wait for every worker to finish its step. */
+static void wait_workers(int done, int workers)
+{
+	char c;
+	int i;
+
+	for (i = 0; i < workers; ++i) {
+		if (read(done, &c, 1) != 1) {
+			fprintf(stderr, "a worker died\n");
+			exit(1);
+		}
+	}
+}
+
+static void report(const char *what, double secs, unsigned long out,
+		   unsigned long in)
+{
+	printf("%-8s %8.2f s %10.0f out/s %10.0f in/s\n",
+	       what, secs, out / secs, in / secs);
+}
+
+int main(int argc, char **argv)
+{
+	int workers = 0, percent = 50, passes = 3, opt, i, j;
+	int go[MAX_WORKERS], done[2], fds[2];
+	long mb = 64;
+	const char *memcg = NULL;
+	unsigned long out0, in0, out1, in1, out_total = 0, in_total = 0;
+	double t0, t1, total = 0;
+	pid_t pids[MAX_WORKERS];
+
+	while ((opt = getopt(argc, argv, "j:m:r:p:g:")) != -1) {
+		switch (opt) {
+		case 'j': workers = atoi(optarg); break;
+		case 'm': mb = atol(optarg); break;
+		case 'r': percent = atoi(optarg); break;
+		case 'p': passes = atoi(optarg); break;
+		case 'g': memcg = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-j workers] [-m mb] "
+				"[-r percent] [-p passes] [-g memcg]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (!workers)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1 || workers > MAX_WORKERS || mb < 1 ||
+	    percent < 0 || percent > 100 || passes < 1) {
+		fprintf(stderr, "%s: bad argument\n", argv[0]);
+		return 1;
+	}
+	if (memcg && memcg_attach(memcg)) {
+		perror(memcg);
+		return 1;
+	}
+	if (pipe(done)) {
+		perror("pipe");
+		return 1;
+	}
+
+	printf("%d workers, %ld MB each, %d%% random\n\n",
+	       workers, mb, percent);
+	fflush(stdout);
+
+	vmstat(&out0, &in0);
+	t0 = now();
+	for (i = 0; i < workers; ++i) {
+		/* One go pipe each, so that every worker makes every pass. */
+		if (pipe(fds)) {
+			perror("pipe");
+			return 1;
+		}
+		pids[i] = fork();
+		if (!pids[i]) {
+			/* Only the parent may hold the go pipes open. */
+			for (j = 0; j < i; ++j)
+				close(go[j]);
+			close(fds[1]);
+			close(done[0]);
+			worker(i, (size_t)mb << 20, percent, fds[0], done[1]);
+		}
+		close(fds[0]);
+		go[i] = fds[1];
+	}
+	close(done[1]);
+	wait_workers(done[0], workers);
+	vmstat(&out1, &in1);
+	report("fill", now() - t0, out1 - out0, in1 - in0);
+
+	for (i = 0; i < passes; ++i) {
+		vmstat(&out0, &in0);
+		t0 = now();
+		for (j = 0; j < workers; ++j)
+			if (write(go[j], "1", 1) != 1)
+				return 1;
+		wait_workers(done[0], workers);
+		t1 = now();
+		vmstat(&out1, &in1);
+
+		report("pass", t1 - t0, out1 - out0, in1 - in0);
+		total += t1 - t0;
+		out_total += out1 - out0;
+		in_total += in1 - in0;
+	}
+	report("passes", total, out_total, in_total);
+
+	for (i = 0; i < workers; ++i) {
+		close(go[i]);
+		waitpid(pids[i], NULL, 0);
+	}
+	return 0;
+}
@@ -22,6 +22,7 @@
 #include <linux/reboot.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/pm_qos_params.h>
 
 #define CPUMON 0
 
@@ -199,8 +200,10 @@ static struct cpufreq_frequency_table s5pv310_freq_table[] = {
 
 #define MAX_LOAD	100
 #define UP_THRESHOLD_DEFAULT	23
+#define CPU_MEM_BOUND_DEFAULT	10
 
 static unsigned int up_threshold;
+static unsigned int cpu_mem_bound;
 static struct s5pv310_dmc_ppmu_hw dmc[2];
 static struct s5pv310_cpu_ppmu_hw cpu;
 static unsigned int bus_utilization[2];
@@ -224,14 +227,18 @@ enum busfreq_level_idx {
 	LV_END
 };
 
-#ifdef SYSFS_DEBUG_BUSFREQ
-static unsigned int time_in_state[LV_END];
-unsigned long prejiffies;
-unsigned long curjiffies;
-#endif
-
 static unsigned int p_idx;
 
+/*
+ * Time spent at each pair of CPU and bus levels, in jiffies, and the
+ * pair the time since last_stat is being spent at.
+ */
+static u64 time_in_state[CPUFREQ_LEVEL_END][LV_END];
+static unsigned int stat_cpu_level, stat_bus_level;
+static u64 last_stat;
+
+static unsigned int s5pv310_cpufreq_min_level(unsigned int freq);
+
 struct busfreq_table {
 	unsigned int idx;
 	unsigned int mem_clk;
@@ -245,26 +252,72 @@ static struct busfreq_table s5pv310_busfreq_table[] = {
 #endif
 	{0, 0, 0},
 };
+
+/*
+ * Operating point pairs: the slowest bus level allowed with the CPU at
+ * cpu_freq or faster, when the CPU is waiting on memory (its share of
+ * the bus is above cpu_mem_bound) and when it is not.  A fast CPU
+ * stalled on a slow bus wastes the power spent on its clock, while a
+ * compute bound or slow CPU gains nothing from a fast bus.  The DMC
+ * load, which includes the other masters, and the pm_qos floor can
+ * still raise the bus above this.
+ */
+struct busfreq_pair {
+	unsigned int cpu_freq;
+	unsigned int mem_bound;
+	unsigned int cpu_bound;
+};
+
+#define BUSFREQ_MIN_LEVEL	(LV_END - 1)
+
+static struct busfreq_pair s5pv310_busfreq_pairs[] = {
+	{1200000, LV_0, LV_1},
+	{ 800000, LV_0, BUSFREQ_MIN_LEVEL},
+	{ 500000, LV_1, BUSFREQ_MIN_LEVEL},
+	{      0, BUSFREQ_MIN_LEVEL, BUSFREQ_MIN_LEVEL},
+};
 #endif
 
-/* This defines are for cpufreq lock */
+/*
+ * This defines are for cpufreq lock
+ *
+ * Frequency floors and ceilings are pm_qos requests.  The levels below
+ * follow the targets of PM_QOS_CPU_FREQ_MIN, PM_QOS_CPU_FREQ_MAX and
+ * PM_QOS_BUS_THROUGHPUT and are set by their notifiers, so the DVFS
+ * paths read them without looking at the requests.
+ */
 #define CPUFREQ_MIN_LEVEL	(CPUFREQ_LEVEL_END - 1)
 
-unsigned int g_cpufreq_lock_id;
-unsigned int g_cpufreq_lock_val[DVFS_LOCK_ID_END];
-unsigned int g_cpufreq_lock_level = CPUFREQ_MIN_LEVEL;
+static unsigned int g_cpufreq_lock_level = CPUFREQ_MIN_LEVEL;
 
 #define CPUFREQ_LIMIT_LEVEL	L0
 
-unsigned int g_cpufreq_limit_id;
-unsigned int g_cpufreq_limit_val[DVFS_LOCK_ID_END];
-unsigned int g_cpufreq_limit_level = CPUFREQ_LIMIT_LEVEL;
+static unsigned int g_cpufreq_limit_level = CPUFREQ_LIMIT_LEVEL;
+
+/* Requests made through the DVFS_LOCK_ID based API below */
+static struct pm_qos_request_list *cpufreq_lock_req[DVFS_LOCK_ID_END];
+static struct pm_qos_request_list *cpufreq_limit_req[DVFS_LOCK_ID_END];
+
+static const char *dvfs_lock_name[DVFS_LOCK_ID_END] = {
+	[DVFS_LOCK_ID_G2D]	= "G2D",
+	[DVFS_LOCK_ID_MFC]	= "MFC",
+	[DVFS_LOCK_ID_USB]	= "USB",
+	[DVFS_LOCK_ID_CAM]	= "CAM",
+	[DVFS_LOCK_ID_APP]	= "APP",
+	[DVFS_LOCK_ID_PM]	= "PM",
+	[DVFS_LOCK_ID_TSP]	= "TSP",
+	[DVFS_LOCK_ID_TMU]	= "TMU",
+	[DVFS_LOCK_ID_TMU_GOV]	= "TMU_GOV",
+};
 
-#define BUSFREQ_MIN_LEVEL	(LV_END - 1)
+#ifdef CONFIG_S5PV310_BUSFREQ
+/* Two 32-bit DDR channels move 16 bytes per memory clock */
+#define BUSFREQ_BYTES_PER_CLK	16
 
-unsigned int g_busfreq_lock_id;
-unsigned int g_busfreq_lock_val[DVFS_LOCK_ID_END];
-unsigned int g_busfreq_lock_level = BUSFREQ_MIN_LEVEL;
+static unsigned int g_busfreq_lock_level = BUSFREQ_MIN_LEVEL;
+
+static struct pm_qos_request_list *busfreq_lock_req[DVFS_LOCK_ID_END];
+#endif
 
 #ifdef CONFIG_CPU_S5PV310_EVT1
 static unsigned int clkdiv_cpu0[CPUFREQ_LEVEL_END][7] = {
@@ -1484,19 +1537,27 @@ static unsigned int get_ppc_load(void)
 	return bus_load;
 }
 
+/* Slowest bus level paired with the CPU running at cpu_freq */
+static unsigned int busfreq_pair_level(unsigned int cpu_freq,
+				       unsigned int cpu_bus_load)
+{
+	struct busfreq_pair *pair = s5pv310_busfreq_pairs;
+
+	while (pair->cpu_freq > cpu_freq)
+		pair++;
+
+	return cpu_bus_load > cpu_mem_bound ? pair->mem_bound : pair->cpu_bound;
+}
+
 static int busload_observor(struct busfreq_table *freq_table,
 			unsigned int bus_load,
 			unsigned int cpu_bus_load,
+			unsigned int cpu_freq,
 			unsigned int pre_idx,
 			unsigned int *index)
 {
 	unsigned int i, target_freq, idx = 0;
 
-	if ((freqs.new == s5pv310_freq_table[L0].frequency)) {
-		*index = LV_0;
-		return 0;
-	}
-
 	if (bus_load > MAX_LOAD)
 		return -EINVAL;
 
@@ -1509,7 +1570,7 @@ static int busload_observor(struct busfreq_table *freq_table,
 		bus_load = 50;
 	}
 
-	if (bus_load >= up_threshold || cpu_bus_load > 10) {
+	if (bus_load >= up_threshold) {
 		target_freq = freq_table[0].mem_clk;
 		idx = 0;
 	} else if (bus_load < (up_threshold - 2)) {
@@ -1539,11 +1600,7 @@ static int busload_observor(struct busfreq_table *freq_table,
 		idx = pre_idx;
 	}
 
-	if ((freqs.new == s5pv310_freq_table[L0].frequency) && (bus_load == 0))
-		idx = pre_idx;
-
-	if ((idx > LV_1) && (cpu_bus_load > 5))
-		idx = LV_1;
+	idx = min(idx, busfreq_pair_level(cpu_freq, cpu_bus_load));
 
 	if (idx > g_busfreq_lock_level)
 		idx = g_busfreq_lock_level;
@@ -1553,16 +1610,30 @@ static int busload_observor(struct busfreq_table *freq_table,
 	return 0;
 }
 
+/*
+ * Charges the time since the last call to the pair of levels the CPU
+ * and the bus were at.  Called with set_bus_freq_change held whenever
+ * either of them may have changed.
+ */
+static void busfreq_update_stats(unsigned int cpu_freq)
+{
+	u64 now = get_jiffies_64();
+
+	time_in_state[stat_cpu_level][stat_bus_level] += now - last_stat;
+	last_stat = now;
+	stat_cpu_level = s5pv310_cpufreq_min_level(cpu_freq);
+	stat_bus_level = busfreq_fix ? pre_fix_busfreq_level : p_idx;
+}
+
 static void busfreq_target(void)
 {
 	unsigned int i, index = 0, ret, voltage;
-	unsigned int bus_load, cpu_bus_load;
-#ifdef SYSFS_DEBUG_BUSFREQ
-	unsigned long level_state_jiffies;
-#endif
+	unsigned int bus_load, cpu_bus_load, cpu_freq;
 
 	mutex_lock(&set_bus_freq_change);
 
+	cpu_freq = s5pv310_getspeed(0);
+
 	if (busfreq_fix) {
 		for (i = 0; i < 2; i++)
 			s5pv310_dmc_ppmu_stop(&dmc[i]);
@@ -1572,52 +1643,14 @@ static void busfreq_target(void)
 	}
 
 	cpu_bus_load = get_cpu_ppmu_load();
-
-	if (cpu_bus_load > 10) {
-		if (p_idx != LV_0) {
-			voltage = s5pv310_busfreq_table[LV_0].volt;
-#if defined(CONFIG_REGULATOR)
-			regulator_set_voltage(int_regulator, voltage, voltage);
-#endif
-			s5pv310_set_busfreq(LV_0);
-		}
-	  p_idx = LV_0;
-
-	  goto out;
-	}
-
 	bus_load = get_ppc_load();
 
 	/* Change bus frequency */
-	ret = busload_observor(s5pv310_busfreq_table,
-				bus_load, cpu_bus_load, p_idx, &index);
+	ret = busload_observor(s5pv310_busfreq_table, bus_load, cpu_bus_load,
+				cpu_freq, p_idx, &index);
 	if (ret < 0)
 		printk(KERN_ERR "%s:fail to check load (%d)\n", __func__, ret);
 
-#ifdef SYSFS_DEBUG_BUSFREQ
-	curjiffies = jiffies;
-	if (prejiffies != 0)
-		level_state_jiffies = curjiffies - prejiffies;
-	else
-		level_state_jiffies = 0;
-
-	prejiffies = jiffies;
-
-	switch (p_idx) {
-	case LV_0:
-		time_in_state[LV_0] += level_state_jiffies;
-		break;
-	case LV_1:
-		time_in_state[LV_1] += level_state_jiffies;
-		break;
-	case LV_2:
-		time_in_state[LV_2] += level_state_jiffies;
-		break;
-	default:
-		break;
-	}
-#endif
-
 	if (p_idx != index) {
 		voltage = s5pv310_busfreq_table[index].volt;
 		if (p_idx > index) {
@@ -1636,88 +1669,137 @@ static void busfreq_target(void)
 		smp_mb();
 		p_idx = index;
 	}
-out:
+
 	busfreq_ppmu_init();
 	cpu_ppmu_init();
 fix_out:
+	busfreq_update_stats(cpu_freq);
 	mutex_unlock(&set_bus_freq_change);
 
 }
 #endif
 
-int s5pv310_cpufreq_lock(unsigned int nId,
-			enum cpufreq_level_request cpufreq_level)
+/* Slowest level running at @freq or faster, or L0 if none does */
+static unsigned int s5pv310_cpufreq_min_level(unsigned int freq)
 {
-	int ret = 0, cpu = 0;
-	unsigned int cur_freq;
+	unsigned int i, level = L0;
 
-	if (!s5pv310_cpufreq_init_done)
-		return 0;
+	for (i = L0; i < CPUFREQ_LEVEL_END; i++) {
+		if (s5pv310_freq_table[i].frequency == CPUFREQ_TABLE_END)
+			break;
+		if (s5pv310_freq_table[i].frequency == CPUFREQ_ENTRY_INVALID)
+			continue;
+		if (s5pv310_freq_table[i].frequency < freq)
+			break;
+		level = i;
+	}
 
-	if (s5pv310_max_armclk != ARMCLOCK_1600MHZ) {
-		if (cpufreq_level != CPU_L0) {
-			cpufreq_level -= 1;
-		} else {
-			printk(KERN_WARNING
-				"[CPUFREQ]cpufreq lock to 1GHz in place of 1.6GHz\n");
-		}
+	return level;
+}
+
+/* Fastest level running at @freq or slower, or the slowest one */
+static unsigned int s5pv310_cpufreq_max_level(unsigned int freq)
+{
+	unsigned int i, level = L0;
+
+	for (i = L0; i < CPUFREQ_LEVEL_END; i++) {
+		if (s5pv310_freq_table[i].frequency == CPUFREQ_TABLE_END)
+			break;
+		if (s5pv310_freq_table[i].frequency == CPUFREQ_ENTRY_INVALID)
+			continue;
+		level = i;
+		if (s5pv310_freq_table[i].frequency <= freq)
+			break;
 	}
 
-	if (g_cpufreq_lock_id & (1 << nId)) {
-		printk(KERN_ERR
-		"[CPUFREQ]This device [%d] already locked cpufreq\n", nId);
+	return level;
+}
+
+static int s5pv310_cpufreq_qos_notify(unsigned int level, bool raise)
+{
+	struct cpufreq_policy *policy;
+	unsigned int cur_freq, freq;
+	int ret = 0;
+
+	policy = cpufreq_cpu_get(0);
+	if (!policy)
 		return 0;
-	}
-	mutex_lock(&set_cpu_freq_lock);
-	g_cpufreq_lock_id |= (1 << nId);
-	g_cpufreq_lock_val[nId] = cpufreq_level;
 
-	/* If the requested cpufreq is higher than current min frequency */
-	if (cpufreq_level < g_cpufreq_lock_level)
-		g_cpufreq_lock_level = cpufreq_level;
-	mutex_unlock(&set_cpu_freq_lock);
+	cur_freq = s5pv310_getspeed(0);
+	freq = s5pv310_freq_table[level].frequency;
+	if (raise ? cur_freq < freq : cur_freq > freq)
+		ret = cpufreq_driver_target(policy, freq,
+					    MASK_ONLY_SET_CPUFREQ);
 
-	/* If current frequency is lower than requested freq, need to update */
-	cur_freq = s5pv310_getspeed(cpu);
-	if (cur_freq < s5pv310_freq_table[cpufreq_level].frequency) {
-		ret = cpufreq_driver_target(cpufreq_cpu_get(cpu),
-				s5pv310_freq_table[cpufreq_level].frequency,
-				MASK_ONLY_SET_CPUFREQ);
-	}
+	cpufreq_cpu_put(policy);
 
 	return ret;
 }
 
-void s5pv310_cpufreq_lock_free(unsigned int nId)
+static int s5pv310_cpufreq_min_notify(struct notifier_block *nb,
+				      unsigned long val, void *v)
 {
-	unsigned int i;
+	g_cpufreq_lock_level = s5pv310_cpufreq_min_level(val);
 
-	if (!s5pv310_cpufreq_init_done)
-		return;
+	/* If current frequency is lower than requested freq, need to update */
+	s5pv310_cpufreq_qos_notify(g_cpufreq_lock_level, true);
 
-	mutex_lock(&set_cpu_freq_lock);
+	return NOTIFY_OK;
+}
 
-	g_cpufreq_lock_id &= ~(1 << nId);
-	g_cpufreq_lock_val[nId] = CPUFREQ_MIN_LEVEL;
-	g_cpufreq_lock_level = CPUFREQ_MIN_LEVEL;
-	if (g_cpufreq_lock_id) {
-		for (i = 0; i < DVFS_LOCK_ID_END; i++) {
-			if (g_cpufreq_lock_val[i] < g_cpufreq_lock_level)
-				g_cpufreq_lock_level = g_cpufreq_lock_val[i];
-		}
-	}
+static struct notifier_block s5pv310_cpufreq_min_notifier = {
+	.notifier_call = s5pv310_cpufreq_min_notify,
+};
 
-	mutex_unlock(&set_cpu_freq_lock);
+static int s5pv310_cpufreq_max_notify(struct notifier_block *nb,
+				      unsigned long val, void *v)
+{
+	g_cpufreq_limit_level = s5pv310_cpufreq_max_level(val);
+
+	/* If cur frequency is higher than limit freq, it needs to update */
+	s5pv310_cpufreq_qos_notify(g_cpufreq_limit_level, false);
+
+	return NOTIFY_OK;
 }
 
-int s5pv310_cpufreq_upper_limit(unsigned int nId, enum cpufreq_level_request cpufreq_level)
+static struct notifier_block s5pv310_cpufreq_max_notifier = {
+	.notifier_call = s5pv310_cpufreq_max_notify,
+};
+
+/*
+ * The DVFS_LOCK_ID based API is kept for existing drivers; each lock
+ * ID owns one named pm_qos request.  New users should add their own
+ * PM_QOS_CPU_FREQ_MIN/MAX or PM_QOS_BUS_THROUGHPUT requests instead.
+ */
+static int s5pv310_dvfs_request(struct pm_qos_request_list **req,
+				int pm_qos_class, unsigned int nId, s32 value)
 {
-	int ret = 0, cpu = 0;
-	unsigned int cur_freq;
+	if (nId >= DVFS_LOCK_ID_END)
+		return -EINVAL;
 
-	if (!s5pv310_cpufreq_init_done)
+	if (*req) {
+		pm_qos_update_request(*req, value);
 		return 0;
+	}
+
+	*req = pm_qos_add_named_request(pm_qos_class, value,
+					dvfs_lock_name[nId]);
+
+	return *req ? 0 : -ENOMEM;
+}
 
+static void s5pv310_dvfs_request_free(struct pm_qos_request_list **req,
+				      unsigned int nId)
+{
+	if (nId >= DVFS_LOCK_ID_END)
+		return;
+
+	pm_qos_remove_request(*req);
+	*req = NULL;
+}
+
+static unsigned int s5pv310_cpufreq_level_adjust(unsigned int cpufreq_level)
+{
 	if (s5pv310_max_armclk != ARMCLOCK_1600MHZ) {
 		if (cpufreq_level != CPU_L0) {
 			cpufreq_level -= 1;
@@ -1727,93 +1809,146 @@ int s5pv310_cpufreq_upper_limit(unsigned int nId, enum cpufreq_level_request cpu
 		}
 	}
 
-	if (g_cpufreq_limit_id & (1 << nId)) {
-		printk(KERN_ERR "[CPUFREQ]This device [%d] already limited cpufreq\n", nId);
+	return cpufreq_level;
+}
+
+int s5pv310_cpufreq_lock(unsigned int nId,
+			enum cpufreq_level_request cpufreq_level)
+{
+	int ret;
+
+	if (!s5pv310_cpufreq_init_done)
 		return 0;
-	}
+
+	cpufreq_level = s5pv310_cpufreq_level_adjust(cpufreq_level);
 
 	mutex_lock(&set_cpu_freq_lock);
-	g_cpufreq_limit_id |= (1 << nId);
-	g_cpufreq_limit_val[nId] = cpufreq_level;
+	ret = s5pv310_dvfs_request(&cpufreq_lock_req[nId], PM_QOS_CPU_FREQ_MIN,
+			nId, s5pv310_freq_table[cpufreq_level].frequency);
+	mutex_unlock(&set_cpu_freq_lock);
 
-	/* If the requested limit level is lower than current value */
-	if (cpufreq_level > g_cpufreq_limit_level)
-		g_cpufreq_limit_level = cpufreq_level;
+	return ret;
+}
 
+void s5pv310_cpufreq_lock_free(unsigned int nId)
+{
+	if (!s5pv310_cpufreq_init_done)
+		return;
+
+	mutex_lock(&set_cpu_freq_lock);
+	s5pv310_dvfs_request_free(&cpufreq_lock_req[nId], nId);
 	mutex_unlock(&set_cpu_freq_lock);
+}
 
-	/* If cur frequency is higher than limit freq, it needs to update */
-	cur_freq = s5pv310_getspeed(cpu);
-	if (cur_freq > s5pv310_freq_table[cpufreq_level].frequency) {
-		ret = cpufreq_driver_target(cpufreq_cpu_get(cpu),
-				s5pv310_freq_table[cpufreq_level].frequency,
-				MASK_ONLY_SET_CPUFREQ);
-	}
+int s5pv310_cpufreq_upper_limit(unsigned int nId, enum cpufreq_level_request cpufreq_level)
+{
+	int ret;
+
+	if (!s5pv310_cpufreq_init_done)
+		return 0;
+
+	cpufreq_level = s5pv310_cpufreq_level_adjust(cpufreq_level);
+
+	mutex_lock(&set_cpu_freq_lock);
+	ret = s5pv310_dvfs_request(&cpufreq_limit_req[nId], PM_QOS_CPU_FREQ_MAX,
+			nId, s5pv310_freq_table[cpufreq_level].frequency);
+	mutex_unlock(&set_cpu_freq_lock);
 
 	return ret;
 }
 
 void s5pv310_cpufreq_upper_limit_free(unsigned int nId)
 {
-	unsigned int i;
-
 	if (!s5pv310_cpufreq_init_done)
 		return;
 
 	mutex_lock(&set_cpu_freq_lock);
-	g_cpufreq_limit_id &= ~(1 << nId);
-	g_cpufreq_limit_val[nId] = CPUFREQ_LIMIT_LEVEL;
-	g_cpufreq_limit_level = CPUFREQ_LIMIT_LEVEL;
-	if (g_cpufreq_limit_id) {
-		for (i = 0; i < DVFS_LOCK_ID_END; i++) {
-			if (g_cpufreq_limit_val[i] > g_cpufreq_limit_level)
-				g_cpufreq_limit_level = g_cpufreq_limit_val[i];
-		}
-	}
+	s5pv310_dvfs_request_free(&cpufreq_limit_req[nId], nId);
 	mutex_unlock(&set_cpu_freq_lock);
 }
 
+/*
+ * Frequency of @cpufreq_level, in kHz, and the dynamic power of one core
+ * running flat out at it, f * V^2 in MHz * V^2, for the thermal model of
+ * the TMU driver.
+ */
+int s5pv310_cpufreq_level_power(enum cpufreq_level_request cpufreq_level,
+				unsigned int *freq, unsigned int *power)
+{
+	unsigned int mv;
+
+	if (!s5pv310_cpufreq_init_done || cpufreq_level >= CPU_LEVEL_END)
+		return -EINVAL;
+
+	cpufreq_level = s5pv310_cpufreq_level_adjust(cpufreq_level);
+	if (cpufreq_level >= CPUFREQ_LEVEL_END ||
+	    s5pv310_freq_table[cpufreq_level].frequency == CPUFREQ_TABLE_END)
+		return -EINVAL;
+
+	*freq = s5pv310_freq_table[cpufreq_level].frequency;
+	mv = exp_UV_mV[cpufreq_level] / 1000;
+	*power = *freq / 1000 * (mv * mv / 1000) / 1000;
+
+	return 0;
+}
+
 #ifdef CONFIG_S5PV310_BUSFREQ
-int s5pv310_busfreq_lock(unsigned int nId,
-			enum busfreq_level_request busfreq_level)
+/* Slowest bus level giving @kbps, or LV_0 if none does */
+static unsigned int s5pv310_busfreq_min_level(unsigned int kbps)
 {
-	if (g_busfreq_lock_id & (1 << nId)) {
-		printk(KERN_ERR
-		"[BUSFREQ] This device [%d] already locked busfreq\n", nId);
-		return 0;
+	unsigned int i, level = LV_0;
+
+	for (i = LV_0; i < LV_END; i++) {
+		if (s5pv310_busfreq_table[i].mem_clk * BUSFREQ_BYTES_PER_CLK
+		    < kbps)
+			break;
+		level = i;
 	}
-	mutex_lock(&set_bus_freq_lock);
-	g_busfreq_lock_id |= (1 << nId);
-	g_busfreq_lock_val[nId] = busfreq_level;
 
-	/* If the requested cpufreq is higher than current min frequency */
-	if (busfreq_level < g_busfreq_lock_level) {
-		g_busfreq_lock_level = busfreq_level;
-		mutex_unlock(&set_bus_freq_lock);
+	return level;
+}
+
+static int s5pv310_busfreq_notify(struct notifier_block *nb,
+				  unsigned long val, void *v)
+{
+	unsigned int level = s5pv310_busfreq_min_level(val);
+	bool raise = level < g_busfreq_lock_level;
+
+	g_busfreq_lock_level = level;
+
+	/* If the requested busfreq is higher than current min frequency */
+	if (raise)
 		busfreq_target();
-	} else
-		mutex_unlock(&set_bus_freq_lock);
 
-	return 0;
+	return NOTIFY_OK;
 }
 
-void s5pv310_busfreq_lock_free(unsigned int nId)
+static struct notifier_block s5pv310_busfreq_notifier = {
+	.notifier_call = s5pv310_busfreq_notify,
+};
+
+int s5pv310_busfreq_lock(unsigned int nId,
+			enum busfreq_level_request busfreq_level)
 {
-	unsigned int i;
+	int ret;
 
-	mutex_lock(&set_bus_freq_lock);
+	if (busfreq_level >= LV_END)
+		busfreq_level = BUSFREQ_MIN_LEVEL;
 
-	g_busfreq_lock_id &= ~(1 << nId);
-	g_busfreq_lock_val[nId] = BUSFREQ_MIN_LEVEL;
-	g_busfreq_lock_level = BUSFREQ_MIN_LEVEL;
+	mutex_lock(&set_bus_freq_lock);
+	ret = s5pv310_dvfs_request(&busfreq_lock_req[nId],
+			PM_QOS_BUS_THROUGHPUT, nId,
+			s5pv310_busfreq_table[busfreq_level].mem_clk *
+			BUSFREQ_BYTES_PER_CLK);
+	mutex_unlock(&set_bus_freq_lock);
 
-	if (g_busfreq_lock_id) {
-		for (i = 0; i < DVFS_LOCK_ID_END; i++) {
-			if (g_busfreq_lock_val[i] < g_busfreq_lock_level)
-				g_busfreq_lock_level = g_busfreq_lock_val[i];
-		}
-	}
+	return ret;
+}
 
+void s5pv310_busfreq_lock_free(unsigned int nId)
+{
+	mutex_lock(&set_bus_freq_lock);
+	s5pv310_dvfs_request_free(&busfreq_lock_req[nId], nId);
 	mutex_unlock(&set_bus_freq_lock);
 }
 #endif
@@ -2573,8 +2708,6 @@ static int s5pv310_update_dvfs_table()
 
 static int __init s5pv310_cpufreq_init(void)
 {
-	int i;
-
 	printk(KERN_INFO "++ %s\n", __func__);
 
 	arm_clk = clk_get(NULL, "armclk");
@@ -2626,6 +2759,7 @@ static int __init s5pv310_cpufreq_init(void)
 
 #ifdef CONFIG_S5PV310_BUSFREQ
 	up_threshold = UP_THRESHOLD_DEFAULT;
+	cpu_mem_bound = CPU_MEM_BOUND_DEFAULT;
 	cpu.cpu_hw_base = S5PV310_VA_PPMU_CPU;
 	dmc[DMC0].dmc_hw_base = S5P_VA_DMC0;
 	dmc[DMC1].dmc_hw_base = S5P_VA_DMC1;
@@ -2633,12 +2767,16 @@ static int __init s5pv310_cpufreq_init(void)
 	busfreq_ppmu_init();
 	cpu_ppmu_init();
 
-	for (i = 0; i < DVFS_LOCK_ID_END; i++)
-		g_busfreq_lock_val[i] = BUSFREQ_MIN_LEVEL;
-
+	g_busfreq_lock_level = s5pv310_busfreq_min_level(
+				pm_qos_request(PM_QOS_BUS_THROUGHPUT));
+	pm_qos_add_notifier(PM_QOS_BUS_THROUGHPUT, &s5pv310_busfreq_notifier);
 #endif
-	for (i = 0; i < DVFS_LOCK_ID_END; i++)
-		g_cpufreq_lock_val[i] = CPUFREQ_MIN_LEVEL;
+	g_cpufreq_lock_level = s5pv310_cpufreq_min_level(
+				pm_qos_request(PM_QOS_CPU_FREQ_MIN));
+	g_cpufreq_limit_level = s5pv310_cpufreq_max_level(
+				pm_qos_request(PM_QOS_CPU_FREQ_MAX));
+	pm_qos_add_notifier(PM_QOS_CPU_FREQ_MIN, &s5pv310_cpufreq_min_notifier);
+	pm_qos_add_notifier(PM_QOS_CPU_FREQ_MAX, &s5pv310_cpufreq_max_notifier);
 
 	register_pm_notifier(&s5pv310_cpufreq_notifier);
 	register_reboot_notifier(&s5pv310_cpufreq_reboot_notifier);
@@ -2760,33 +2898,103 @@ static ssize_t store_fix_busfreq_level(struct device *dev,
 static DEVICE_ATTR(fix_busfreq_level, 0644, show_fix_busfreq_level,
 				store_fix_busfreq_level);
 
-#ifdef SYSFS_DEBUG_BUSFREQ
+/*
+ * time_in_state: "<mem_clk> <time>" for each bus level.
+ * cpu_bus_time_in_state: "<cpu_freq> <mem_clk> <time>" for each pair.
+ * Times are in 10ms units like the cpufreq statistics.
+ */
 static ssize_t show_time_in_state(struct device *dev,
 				struct device_attribute *attr,
 				char *buf)
 {
 	ssize_t len = 0;
-	int i;
+	u64 t;
+	int i, j;
+
+	mutex_lock(&set_bus_freq_change);
+	busfreq_update_stats(s5pv310_getspeed(0));
+
+	for (i = 0; i < LV_END; i++) {
+		for (t = 0, j = 0; j < CPUFREQ_LEVEL_END; j++)
+			t += time_in_state[j][i];
+		len += sprintf(buf + len, "%u %llu\n",
+			s5pv310_busfreq_table[i].mem_clk,
+			(unsigned long long)jiffies_64_to_clock_t(t));
+	}
+
+	mutex_unlock(&set_bus_freq_change);
+
+	return len;
+}
+
+static DEVICE_ATTR(time_in_state, 0444, show_time_in_state, NULL);
+
+static ssize_t show_cpu_bus_time_in_state(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	ssize_t len = 0;
+	int i, j;
 
-	for (i = 0; i < LV_END; i++)
-		len += sprintf(buf + len, "%u: %u\n",
-			s5pv310_busfreq_table[i].mem_clk, time_in_state[i]);
+	mutex_lock(&set_bus_freq_change);
+	busfreq_update_stats(s5pv310_getspeed(0));
+
+	for (j = 0; j < CPUFREQ_LEVEL_END; j++) {
+		if (s5pv310_freq_table[j].frequency == CPUFREQ_TABLE_END)
+			break;
+		for (i = 0; i < LV_END; i++)
+			len += sprintf(buf + len, "%u %u %llu\n",
+				s5pv310_freq_table[j].frequency,
+				s5pv310_busfreq_table[i].mem_clk,
+				(unsigned long long)
+				jiffies_64_to_clock_t(time_in_state[j][i]));
+	}
+
+	mutex_unlock(&set_bus_freq_change);
 
 	return len;
 }
 
-static ssize_t store_time_in_state(struct device *dev,
+static DEVICE_ATTR(cpu_bus_time_in_state, 0444,
+		   show_cpu_bus_time_in_state, NULL);
+
+static ssize_t show_cpu_mem_bound(struct device *dev,
+				struct device_attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%u\n", cpu_mem_bound);
+}
+
+static ssize_t store_cpu_mem_bound(struct device *dev,
 				struct device_attribute *attr,
 				const char *buf,
 				size_t count)
 {
+	unsigned int val;
+
+	if (sscanf(buf, "%u", &val) != 1 || val > MAX_LOAD)
+		return -EINVAL;
+
+	cpu_mem_bound = val;
 
 	return count;
 }
 
-static DEVICE_ATTR(time_in_state, 0644, show_time_in_state,
-				store_time_in_state);
+static DEVICE_ATTR(cpu_mem_bound, 0644, show_cpu_mem_bound,
+		   store_cpu_mem_bound);
 
+static struct attribute *busfreq_stat_attrs[] = {
+	&dev_attr_time_in_state.attr,
+	&dev_attr_cpu_bus_time_in_state.attr,
+	&dev_attr_cpu_mem_bound.attr,
+	NULL,
+};
+
+static struct attribute_group busfreq_stat_attr_group = {
+	.attrs = busfreq_stat_attrs,
+};
+
+#ifdef SYSFS_DEBUG_BUSFREQ
 static ssize_t show_up_threshold(struct device *dev,
 				struct device_attribute *attr,
 				char *buf)
@@ -2825,26 +3033,26 @@ static int sysfs_busfreq_create(struct device *dev)
 	if (ret)
 		goto failed;
 
-#ifdef SYSFS_DEBUG_BUSFREQ
-	ret = device_create_file(dev, &dev_attr_up_threshold);
+	ret = sysfs_create_group(&dev->kobj, &busfreq_stat_attr_group);
 
 	if (ret)
 		goto failed_fix_busfreq_level;
 
-	ret = device_create_file(dev, &dev_attr_time_in_state);
+#ifdef SYSFS_DEBUG_BUSFREQ
+	ret = device_create_file(dev, &dev_attr_up_threshold);
 
 	if (ret)
-		goto failed_up_threshold;
+		goto failed_stat;
+#endif
 
-    return ret;
+	return ret;
 
-failed_up_threshold:
-	device_remove_file(dev, &dev_attr_up_threshold);
+#ifdef SYSFS_DEBUG_BUSFREQ
+failed_stat:
+	sysfs_remove_group(&dev->kobj, &busfreq_stat_attr_group);
+#endif
 failed_fix_busfreq_level:
 	device_remove_file(dev, &dev_attr_fix_busfreq_level);
-#else
-    return ret;
-#endif
 failed:
 	device_remove_file(dev, &dev_attr_busfreq_fix);
 
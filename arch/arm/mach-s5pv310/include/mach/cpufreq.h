@@ -40,6 +40,7 @@ enum cpufreq_lock_ID{
 	DVFS_LOCK_ID_PM, 	/* PM */
 	DVFS_LOCK_ID_TSP,   /*TSP*/
 	DVFS_LOCK_ID_TMU,   /*TMU*/
+	DVFS_LOCK_ID_TMU_GOV,	/* TMU predictive governor */
 	DVFS_LOCK_ID_END,
 };
 
@@ -51,3 +52,20 @@ void s5pv310_busfreq_lock_free(unsigned int nId);
 
 int s5pv310_cpufreq_upper_limit(unsigned int nId, enum cpufreq_level_request cpufreq_level);
 void s5pv310_cpufreq_upper_limit_free(unsigned int nId);
+
+int s5pv310_cpufreq_level_power(enum cpufreq_level_request cpufreq_level,
+				unsigned int *freq, unsigned int *power);
+
+#ifdef CONFIG_S5PV310_PM_HOTPLUG
+int s5pv310_hotplug_lock(unsigned int nId, unsigned int min_cpus);
+void s5pv310_hotplug_lock_free(unsigned int nId);
+#else
+static inline int s5pv310_hotplug_lock(unsigned int nId, unsigned int min_cpus)
+{
+	return 0;
+}
+
+static inline void s5pv310_hotplug_lock_free(unsigned int nId)
+{
+}
+#endif
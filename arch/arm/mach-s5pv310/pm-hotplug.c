@@ -26,20 +26,35 @@
 #include <linux/sched.h>
 #include <linux/suspend.h>
 #include <linux/reboot.h>
+#include <linux/math64.h>
 
 #include <plat/map-base.h>
 #include <plat/gpio-cfg.h>
 
 #include <mach/regs-gpio.h>
 #include <mach/regs-irq.h>
+#include <mach/cpufreq.h>
 #include <linux/gpio.h>
 #include <linux/cpufreq.h>
 
-#define CPUMON 0
-
-#define CHECK_DELAY	(.5*HZ)
+/*
+ * The policy samples every CHECK_DELAY.  A CPU is brought up after
+ * UP_SAMPLES samples in a row with both high utilisation and more
+ * runnable tasks than online CPUs, and taken down after DOWN_SAMPLES
+ * samples in a row where the work would fit on fewer CPUs.  Coming up
+ * fast and going down slowly keeps bursty UI work from waiting for the
+ * second core without leaving it on for steady light loads.
+ *
+ * Run-queue depths are averages over the sample period, in hundredths
+ * of a task per online CPU, taken from sched_nr_running_sum().
+ */
+#define CHECK_DELAY	(HZ / 20)
 #define TRANS_LOAD_L	20
 #define TRANS_LOAD_H	(TRANS_LOAD_L*3)
+#define NR_RUN_L	40
+#define NR_RUN_H	150
+#define UP_SAMPLES	2
+#define DOWN_SAMPLES	10
 
 #define HOTPLUG_UNLOCKED 0
 #define HOTPLUG_LOCKED 1
@@ -47,6 +62,7 @@
 static struct workqueue_struct *hotplug_wq;
 
 static struct delayed_work hotplug_work;
+static struct work_struct hotplug_lock_work;
 
 static unsigned int hotpluging_rate = CHECK_DELAY;
 module_param_named(rate, hotpluging_rate, uint, 0644);
@@ -56,33 +72,90 @@ static unsigned int trans_load_l = TRANS_LOAD_L;
 module_param_named(loadl, trans_load_l, uint, 0644);
 static unsigned int trans_load_h = TRANS_LOAD_H;
 module_param_named(loadh, trans_load_h, uint, 0644);
+static unsigned int nr_run_l = NR_RUN_L;
+module_param_named(nr_run_l, nr_run_l, uint, 0644);
+static unsigned int nr_run_h = NR_RUN_H;
+module_param_named(nr_run_h, nr_run_h, uint, 0644);
+static unsigned int up_samples = UP_SAMPLES;
+module_param_named(up_samples, up_samples, uint, 0644);
+static unsigned int down_samples = DOWN_SAMPLES;
+module_param_named(down_samples, down_samples, uint, 0644);
 
 struct cpu_time_info {
 	cputime64_t prev_cpu_idle;
 	cputime64_t prev_cpu_wall;
+	u64 prev_nr_sum;
+	u64 prev_nr_clock;
 	unsigned int load;
+	unsigned int nr_run;
 };
 
 static DEFINE_PER_CPU(struct cpu_time_info, hotplug_cpu_time);
 
+/* Times are in ns; "latency" is from the first sample or lock request
+   asking for another CPU until that CPU is online. */
+struct hotplug_stats {
+	unsigned long up;
+	unsigned long up_failed;
+	unsigned long down;
+	u64 up_time_total;
+	u64 up_time_max;
+	u64 latency_total;
+	u64 latency_max;
+};
+
 /* mutex can be used since hotplug_timer does not run in
    timer(softirq) context but in process context */
 static DEFINE_MUTEX(hotplug_lock);
 
-static void hotplug_timer(struct work_struct *work)
+/* protected by hotplug_lock */
+static unsigned int up_count, down_count;
+static u64 up_demand;
+static struct hotplug_stats hotplug_stats;
+
+/* minimum number of online CPUs requested through s5pv310_hotplug_lock() */
+static DEFINE_SPINLOCK(hotplug_req_lock);
+static unsigned int hotplug_req[DVFS_LOCK_ID_END];
+static u64 hotplug_req_stamp;
+
+static unsigned int hotplug_min_cpus(u64 *stamp)
 {
-	unsigned int i, avg_load = 0, load = 0;
-	unsigned int cur_freq;
+	unsigned long flags;
+	unsigned int i, min_cpus = 1;
 
-	mutex_lock(&hotplug_lock);
+	spin_lock_irqsave(&hotplug_req_lock, flags);
+	for (i = 0; i < DVFS_LOCK_ID_END; i++)
+		min_cpus = max(min_cpus, hotplug_req[i]);
+	if (stamp)
+		*stamp = hotplug_req_stamp;
+	spin_unlock_irqrestore(&hotplug_req_lock, flags);
 
-	if (user_lock == 1)
-		goto no_hotplug;
+	return min_cpus;
+}
+
+static void hotplug_sample_reset(unsigned int cpu)
+{
+	struct cpu_time_info *tmp_info = &per_cpu(hotplug_cpu_time, cpu);
+
+	tmp_info->prev_cpu_idle = get_cpu_idle_time_us(cpu,
+						       &tmp_info->prev_cpu_wall);
+	tmp_info->prev_nr_sum = sched_nr_running_sum(cpu,
+						     &tmp_info->prev_nr_clock);
+}
+
+/*
+ * Average utilisation in percent and run-queue depth in hundredths of
+ * a task of the online CPUs since the previous sample.
+ */
+static int hotplug_sample(unsigned int *avg_load, unsigned int *avg_nr_run)
+{
+	unsigned int i, load = 0, nr_run = 0;
 
 	for_each_online_cpu(i) {
 		struct cpu_time_info *tmp_info;
 		cputime64_t cur_wall_time, cur_idle_time;
 		unsigned int idle_time, wall_time;
+		u64 nr_sum, nr_clock;
 
 		tmp_info = &per_cpu(hotplug_cpu_time, i);
 
@@ -96,37 +169,130 @@ static void hotplug_timer(struct work_struct *work)
 							tmp_info->prev_cpu_wall);
 		tmp_info->prev_cpu_wall = cur_wall_time;
 
-		if (wall_time < idle_time)
-			goto no_hotplug;
+		nr_sum = sched_nr_running_sum(i, &nr_clock);
+		if (nr_clock > tmp_info->prev_nr_clock)
+			tmp_info->nr_run = div64_u64(100 *
+				(nr_sum - tmp_info->prev_nr_sum),
+				nr_clock - tmp_info->prev_nr_clock);
+		else
+			tmp_info->nr_run = 0;
+		tmp_info->prev_nr_sum = nr_sum;
+		tmp_info->prev_nr_clock = nr_clock;
+
+		if (!wall_time || wall_time < idle_time)
+			return -EAGAIN;
 
 		tmp_info->load = 100 * (wall_time - idle_time) / wall_time;
 
 		load += tmp_info->load;
+		nr_run += tmp_info->nr_run;
 	}
 
-	avg_load = load / num_online_cpus();
+	*avg_load = load / num_online_cpus();
+	*avg_nr_run = nr_run / num_online_cpus();
 
-	cur_freq = cpufreq_get(0);
+	return 0;
+}
+
+/* Must be called with hotplug_lock held */
+static int hotplug_cpu_up(void)
+{
+	unsigned int cpu = cpumask_next_zero(0, cpu_online_mask);
+	ktime_t start, end;
+	u64 t;
+	int ret;
+
+	if (cpu >= nr_cpu_ids || !cpu_present(cpu))
+		return -ENODEV;
+
+	pr_debug("cpu%u turning on!\n", cpu);
+	start = ktime_get();
+	ret = cpu_up(cpu);
+	end = ktime_get();
+	if (ret) {
+		hotplug_stats.up_failed++;
+		return ret;
+	}
+
+	hotplug_stats.up++;
+	t = ktime_to_ns(ktime_sub(end, start));
+	hotplug_stats.up_time_total += t;
+	hotplug_stats.up_time_max = max(hotplug_stats.up_time_max, t);
+
+	if (up_demand) {
+		t = ktime_to_ns(end) - up_demand;
+		hotplug_stats.latency_total += t;
+		hotplug_stats.latency_max = max(hotplug_stats.latency_max, t);
+		up_demand = 0;
+	}
+
+	hotplug_sample_reset(cpu);
+
+	return 0;
+}
+
+/* Must be called with hotplug_lock held */
+static int hotplug_cpu_down(void)
+{
+	unsigned int i, cpu = 0;
+	int ret;
+
+	for_each_online_cpu(i)
+		cpu = i;
+	if (!cpu)
+		return -ENODEV;
+
+	pr_debug("cpu%u turning off!\n", cpu);
+	ret = cpu_down(cpu);
+	if (!ret)
+		hotplug_stats.down++;
+
+	return ret;
+}
+
+static void hotplug_timer(struct work_struct *work)
+{
+	unsigned int avg_load, avg_nr_run, online, min_cpus;
+	unsigned int cur_freq;
+
+	mutex_lock(&hotplug_lock);
+
+	if (user_lock == 1)
+		goto no_hotplug;
 
-	if (((avg_load < trans_load_l) || (cur_freq <= 200 * 1000)) &&
-	    (cpu_online(1) == 1)) {
-		printk("cpu1 turning off!\n");
-		cpu_down(1);
-#if CPUMON
-		printk(KERN_ERR "CPUMON D %d\n", avg_load);
-#endif
-		printk("cpu1 off end!\n");
-		hotpluging_rate = CHECK_DELAY;
-	} else if (((avg_load > trans_load_h) && (cur_freq > 200 * 1000)) &&
-		   (cpu_online(1) == 0)) {
-		printk("cpu1 turning on!\n");
-		cpu_up(1);
-#if CPUMON
-		printk(KERN_ERR "CPUMON U %d\n", avg_load);
-#endif
-		printk("cpu1 on end!\n");
-		hotpluging_rate = CHECK_DELAY * 4;
+	if (hotplug_sample(&avg_load, &avg_nr_run))
+		goto no_hotplug;
+
+	cur_freq = cpufreq_get(0);
+	online = num_online_cpus();
+	min_cpus = hotplug_min_cpus(NULL);
+
+	if (online < min_cpus) {
+		/* a lock request arrived while hotplug was disabled */
+		up_count = down_count = 0;
+		hotplug_cpu_up();
+	} else if (online < num_present_cpus() && cur_freq > 200 * 1000 &&
+		   avg_load >= trans_load_h && avg_nr_run >= nr_run_h) {
+		down_count = 0;
+		if (!up_count++)
+			up_demand = ktime_to_ns(ktime_get());
+		if (up_count >= up_samples) {
+			up_count = 0;
+			hotplug_cpu_up();
+		}
+	} else if (online > min_cpus && (cur_freq <= 200 * 1000 ||
+		   avg_load < trans_load_l || avg_nr_run < nr_run_l)) {
+		up_count = 0;
+		up_demand = 0;
+		if (++down_count >= down_samples) {
+			down_count = 0;
+			hotplug_cpu_down();
+		}
+	} else {
+		up_count = down_count = 0;
+		up_demand = 0;
 	}
+
  no_hotplug:
 
 	queue_delayed_work_on(0, hotplug_wq, &hotplug_work, hotpluging_rate);
@@ -134,6 +300,71 @@ static void hotplug_timer(struct work_struct *work)
 	mutex_unlock(&hotplug_lock);
 }
 
+/* Brings up the CPUs a lock request asks for without waiting a sample. */
+static void hotplug_lock_timer(struct work_struct *work)
+{
+	unsigned int min_cpus;
+	u64 stamp;
+
+	mutex_lock(&hotplug_lock);
+
+	min_cpus = hotplug_min_cpus(&stamp);
+	if (user_lock == 1 || num_online_cpus() >= min_cpus)
+		goto out;
+
+	if (!up_demand || stamp < up_demand)
+		up_demand = stamp;
+	up_count = down_count = 0;
+	while (num_online_cpus() < min_cpus)
+		if (hotplug_cpu_up())
+			break;
+ out:
+	mutex_unlock(&hotplug_lock);
+}
+
+/**
+ * s5pv310_hotplug_lock - keep a minimum number of CPUs online
+ * @nId: lock owner, one of DVFS_LOCK_ID_*
+ * @min_cpus: number of CPUs which must stay online
+ *
+ * The policy keeps at least the largest of all requests online.  CPUs
+ * which are missing are brought up from the hotplug workqueue right
+ * away, so this may be called from atomic context.
+ */
+int s5pv310_hotplug_lock(unsigned int nId, unsigned int min_cpus)
+{
+	unsigned long flags;
+
+	if (nId >= DVFS_LOCK_ID_END)
+		return -EINVAL;
+
+	min_cpus = min(min_cpus, num_present_cpus());
+
+	spin_lock_irqsave(&hotplug_req_lock, flags);
+	hotplug_req[nId] = min_cpus;
+	hotplug_req_stamp = ktime_to_ns(ktime_get());
+	spin_unlock_irqrestore(&hotplug_req_lock, flags);
+
+	if (hotplug_wq && min_cpus > num_online_cpus())
+		queue_work_on(0, hotplug_wq, &hotplug_lock_work);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(s5pv310_hotplug_lock);
+
+void s5pv310_hotplug_lock_free(unsigned int nId)
+{
+	unsigned long flags;
+
+	if (nId >= DVFS_LOCK_ID_END)
+		return;
+
+	spin_lock_irqsave(&hotplug_req_lock, flags);
+	hotplug_req[nId] = 0;
+	spin_unlock_irqrestore(&hotplug_req_lock, flags);
+}
+EXPORT_SYMBOL_GPL(s5pv310_hotplug_lock_free);
+
 static int s5pv310_pm_hotplug_notifier_event(struct notifier_block *this,
 					     unsigned long event, void *ptr)
 {
@@ -189,6 +420,7 @@ static int __init s5pv310_pm_hotplug_init(void)
 	}
 
 	INIT_DELAYED_WORK_DEFERRABLE(&hotplug_work, hotplug_timer);
+	INIT_WORK(&hotplug_lock_work, hotplug_lock_timer);
 
 	queue_delayed_work_on(0, hotplug_wq, &hotplug_work, 60 * HZ);
 
@@ -200,9 +432,58 @@ static int __init s5pv310_pm_hotplug_init(void)
 
 late_initcall(s5pv310_pm_hotplug_init);
 
+static ssize_t show_stats(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct hotplug_stats s;
+
+	mutex_lock(&hotplug_lock);
+	s = hotplug_stats;
+	mutex_unlock(&hotplug_lock);
+
+	return sprintf(buf, "up %lu\nup_failed %lu\ndown %lu\n"
+		       "up_time_avg_us %llu\nup_time_max_us %llu\n"
+		       "latency_avg_us %llu\nlatency_max_us %llu\n",
+		       s.up, s.up_failed, s.down,
+		       s.up ? div64_u64(s.up_time_total, s.up * 1000) : 0,
+		       div64_u64(s.up_time_max, 1000),
+		       s.up ? div64_u64(s.latency_total, s.up * 1000) : 0,
+		       div64_u64(s.latency_max, 1000));
+}
+
+/* Writing anything clears the statistics */
+static ssize_t store_stats(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	mutex_lock(&hotplug_lock);
+	memset(&hotplug_stats, 0, sizeof(hotplug_stats));
+	mutex_unlock(&hotplug_lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(stats, 0644, show_stats, store_stats);
+
+static struct attribute *s5pv310_pm_hotplug_attrs[] = {
+	&dev_attr_stats.attr,
+	NULL,
+};
+
+static struct attribute_group s5pv310_pm_hotplug_attr_group = {
+	.attrs = s5pv310_pm_hotplug_attrs,
+};
+
+static const struct attribute_group *s5pv310_pm_hotplug_attr_groups[] = {
+	&s5pv310_pm_hotplug_attr_group,
+	NULL,
+};
+
 static struct platform_device s5pv310_pm_hotplug_device = {
 	.name = "s5pv310-dynamic-cpu-hotplug",
 	.id = -1,
+	.dev = {
+		.groups = s5pv310_pm_hotplug_attr_groups,
+	},
 };
 
 static int __init s5pv310_pm_hotplug_device_init(void)
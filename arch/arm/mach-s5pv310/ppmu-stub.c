@@ -0,0 +1,114 @@
+/* linux/arch/arm/mach-s5pv310/ppmu-stub.c
+ *
+ * Copyright (c) 2010 Samsung Electronics Co., Ltd.
+ *		http://www.samsung.com/
+ *
+ * S5PV310 - Software PPMU
+ *
+ * Stands in for the DMC and CPU PPMU drivers (dmc.c, cpu_ppmu.c) so
+ * that the bus DVFS policy can be driven with known loads.  Loads are
+ * percentages of the sampled cycles, set through debugfs:
+ *
+ *	/sys/kernel/debug/ppmu-stub/dmc0	DMC0 utilisation
+ *	/sys/kernel/debug/ppmu-stub/dmc1	DMC1 utilisation
+ *	/sys/kernel/debug/ppmu-stub/cpu		CPU share of the bus
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+*/
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/debugfs.h>
+
+#include <mach/map.h>
+#include <mach/dmc.h>
+
+/* Cycles counted between two updates */
+#define PPMU_STUB_CYCLES	(1 << 20)
+
+static u32 dmc_load[2];
+static u32 cpu_load;
+
+static unsigned int ppmu_stub_count(u32 load)
+{
+	return min_t(u32, load, 100) * (PPMU_STUB_CYCLES / 100);
+}
+
+void s5pv310_dmc_ppmu_reset(struct s5pv310_dmc_ppmu_hw *ppmu)
+{
+	ppmu->ccnt = 0;
+	ppmu->event = 0;
+	memset(ppmu->count, 0, sizeof(ppmu->count));
+}
+
+void s5pv310_dmc_ppmu_setevent(struct s5pv310_dmc_ppmu_hw *ppmu,
+				  unsigned int evt)
+{
+	ppmu->event = evt;
+}
+
+void s5pv310_dmc_ppmu_start(struct s5pv310_dmc_ppmu_hw *ppmu)
+{
+}
+
+void s5pv310_dmc_ppmu_stop(struct s5pv310_dmc_ppmu_hw *ppmu)
+{
+}
+
+void s5pv310_dmc_ppmu_update(struct s5pv310_dmc_ppmu_hw *ppmu)
+{
+	u32 load = dmc_load[ppmu->dmc_hw_base == S5P_VA_DMC1];
+
+	ppmu->ccnt = PPMU_STUB_CYCLES;
+	ppmu->count[0] = ppmu_stub_count(load);
+}
+
+void s5pv310_cpu_ppmu_reset(struct s5pv310_cpu_ppmu_hw *ppmu)
+{
+	ppmu->ccnt = 0;
+	ppmu->event = 0;
+	memset(ppmu->count, 0, sizeof(ppmu->count));
+}
+
+void s5pv310_cpu_ppmu_setevent(struct s5pv310_cpu_ppmu_hw *ppmu,
+				  unsigned int evt, unsigned int evt_num)
+{
+	ppmu->event = evt;
+}
+
+void s5pv310_cpu_ppmu_start(struct s5pv310_cpu_ppmu_hw *ppmu)
+{
+}
+
+void s5pv310_cpu_ppmu_stop(struct s5pv310_cpu_ppmu_hw *ppmu)
+{
+}
+
+void s5pv310_cpu_ppmu_update(struct s5pv310_cpu_ppmu_hw *ppmu)
+{
+	ppmu->ccnt = PPMU_STUB_CYCLES;
+	ppmu->count[0] = ppmu_stub_count(cpu_load);
+	ppmu->count[1] = 0;
+}
+
+static int __init s5pv310_ppmu_stub_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("ppmu-stub", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return -ENODEV;
+
+	debugfs_create_u32("dmc0", 0644, dir, &dmc_load[0]);
+	debugfs_create_u32("dmc1", 0644, dir, &dmc_load[1]);
+	debugfs_create_u32("cpu", 0644, dir, &cpu_load);
+
+	printk(KERN_INFO "S5PV310 PPMU: software stub\n");
+
+	return 0;
+}
+
+late_initcall(s5pv310_ppmu_stub_init);
@@ -25,6 +25,10 @@
 #include <linux/irq.h>
 #include <linux/gpio.h>
 #include <linux/slab.h>
+#include <linux/cpufreq.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 
 #include <asm/irq.h>
 
@@ -152,6 +156,8 @@ struct s5p_tmu_info {
 	unsigned int irq;
 	unsigned int reg_save[TMU_SAVE_NUM];
 	int tmu_status;
+	int irq_enabled;
+	struct dentry *debugfs;
 };
 struct s5p_tmu_info *tmu_info;
 
@@ -338,6 +344,228 @@ static int tmu_tripped_cb(int state)
 	return psy->set_property(psy, POWER_SUPPLY_PROP_HEALTH, &value);
 }
 
+#ifdef CONFIG_S5PV310_TMU_EMUL
+/*
+ * Emulated temperature source.  A trace of temperatures in celsius,
+ * written to debugfs tmu/emul_temp, is replayed one value per sample in
+ * place of the sensor, so that throttling can be tested with known and
+ * repeatable heat profiles.  The trip and shutdown paths act on the
+ * replayed values as well.
+ */
+#define TMU_EMUL_MAX	2048
+
+static struct {
+	int temp[TMU_EMUL_MAX];
+	unsigned int len;
+	unsigned int pos;
+} tmu_emul;
+
+static inline bool tmu_emul_active(void)
+{
+	return tmu_emul.pos < tmu_emul.len;
+}
+#else
+static inline bool tmu_emul_active(void)
+{
+	return false;
+}
+#endif
+
+/* Current temperature in celsius, 0 below the 25 degree sensor range */
+static int tmu_read_temp(void)
+{
+	int cur_temp;
+
+#ifdef CONFIG_S5PV310_TMU_EMUL
+	if (tmu_emul_active())
+		return tmu_emul.temp[tmu_emul.pos++];
+#endif
+
+	/* Compensation temperature */
+	cur_temp = (__raw_readl(tmu_info->ctz->tmu_base + CURRENT_TEMP) & 0xff)
+			- tmu_info->ctz->data.te1 + TMU_DC_VALUE;
+	if (cur_temp < 25) {
+		/* temperature code range is from 25 to 125 */
+		pr_info("current temp is under 25 celsius degree!\n");
+		cur_temp = 0;
+	}
+
+	return cur_temp;
+}
+
+#ifdef CONFIG_S5PV310_TMU_PREDICTIVE
+/*
+ * Predictive throttling.
+ *
+ * The states below clamp the CPU by several levels when a trigger
+ * temperature is crossed and release it a few degrees lower, which
+ * under a sustained load alternates between full speed and heavy
+ * throttling.  Instead, on every sample, predict the temperature
+ * gov_horizon seconds ahead for each CPU level and cap the CPU at the
+ * fastest level predicted to stay below gov_target.  The reactive
+ * states are left as a safety net.
+ *
+ * The die is modelled as a single thermal RC of time constant gov_tau.
+ * At the present power it heads for T + tau * dT/dt; running the online
+ * CPUs at another level moves that by gov_resistance (in m'C per unit of
+ * f * V^2, see s5pv310_cpufreq_level_power()) times the change of their
+ * dynamic power.  After h seconds, the die is about h / (h + tau) of
+ * the way there.
+ */
+#define GOV_HYSTERESIS	1000	/* m'C below the target to raise the cap */
+
+static unsigned int gov_target = TEMP_TROTTLED_CELCIUS - 2;
+module_param(gov_target, uint, 0644);
+MODULE_PARM_DESC(gov_target, "temperature to keep below, celsius");
+
+static unsigned int gov_tau = 20;
+module_param(gov_tau, uint, 0644);
+MODULE_PARM_DESC(gov_tau, "thermal time constant, seconds");
+
+static unsigned int gov_horizon = 5;
+module_param(gov_horizon, uint, 0644);
+MODULE_PARM_DESC(gov_horizon, "prediction horizon, seconds");
+
+static unsigned int gov_resistance = 8;
+module_param(gov_resistance, uint, 0644);
+MODULE_PARM_DESC(gov_resistance, "m'C per unit of CPU power");
+
+struct tmu_gov_level {
+	unsigned int freq;	/* kHz */
+	unsigned int power;	/* MHz * V^2 */
+};
+
+static struct {
+	struct tmu_gov_level level[CPU_LEVEL_END];
+	int nr_levels;		/* 0 until cpufreq is up */
+	int temp;		/* m'C */
+	int slope;		/* m'C/s, smoothed */
+	int predicted;		/* m'C, at the cap */
+	int cap;		/* CPU_Lx */
+	unsigned long stamp;	/* jiffies of temp, 0 before the first */
+	u64 time_at_cap[CPU_LEVEL_END];
+} tmu_gov;
+
+static int tmu_gov_init_levels(void)
+{
+	struct tmu_gov_level *l = tmu_gov.level;
+	int i;
+
+	for (i = CPU_L0; i < CPU_LEVEL_END; i++)
+		if (s5pv310_cpufreq_level_power(i, &l[i].freq, &l[i].power))
+			break;
+	tmu_gov.nr_levels = i;
+
+	return i ? 0 : -EAGAIN;
+}
+
+/* Temperature, in m'C, gov_horizon seconds ahead at level @cap */
+static int tmu_gov_predict(int cap, int cur)
+{
+	int dp = tmu_gov.level[cap].power - tmu_gov.level[cur].power;
+	int rise = (int)gov_tau * tmu_gov.slope +
+		   (int)gov_resistance * (int)num_online_cpus() * dp;
+
+	return tmu_gov.temp +
+		rise * (int)gov_horizon / (int)(gov_horizon + gov_tau);
+}
+
+static void tmu_gov_update(int cur_temp)
+{
+	unsigned long now = jiffies;
+	unsigned int cur_freq;
+	int temp = cur_temp * 1000;
+	int cur, cap, limit;
+
+	if (!tmu_gov.nr_levels && tmu_gov_init_levels())
+		return;
+
+	if (tmu_gov.stamp && time_after(now, tmu_gov.stamp)) {
+		int slope = (temp - tmu_gov.temp) * HZ /
+			    (int)(now - tmu_gov.stamp);
+
+		tmu_gov.slope += (slope - tmu_gov.slope) / 4;
+		tmu_gov.time_at_cap[tmu_gov.cap] += now - tmu_gov.stamp;
+	}
+	tmu_gov.temp = temp;
+	tmu_gov.stamp = now;
+
+	/* Level the CPU runs at, i.e. the power the slope was measured at */
+	cur_freq = cpufreq_quick_get(0);
+	for (cur = 0; cur < tmu_gov.nr_levels - 1; cur++)
+		if (tmu_gov.level[cur].freq <= cur_freq)
+			break;
+
+	for (cap = 0; cap < tmu_gov.nr_levels - 1; cap++) {
+		limit = gov_target * 1000;
+		if (cap < tmu_gov.cap)
+			limit -= GOV_HYSTERESIS;
+		if (tmu_gov_predict(cap, cur) <= limit)
+			break;
+	}
+
+	/* Come down at once, but go up one level per sample */
+	if (cap < tmu_gov.cap - 1)
+		cap = tmu_gov.cap - 1;
+	tmu_gov.predicted = tmu_gov_predict(cap, cur);
+
+	if (cap == tmu_gov.cap)
+		return;
+
+	pr_debug("%s: %d m'C, %d m'C/s: cap %u kHz\n", __func__,
+		 temp, tmu_gov.slope, tmu_gov.level[cap].freq);
+
+	if (cap == CPU_L0)
+		s5pv310_cpufreq_upper_limit_free(DVFS_LOCK_ID_TMU_GOV);
+	else
+		s5pv310_cpufreq_upper_limit(DVFS_LOCK_ID_TMU_GOV, cap);
+	tmu_gov.cap = cap;
+}
+
+static int tmu_gov_show(struct seq_file *s, void *unused)
+{
+	int i;
+
+	mutex_lock(&tmu_lock);
+	seq_printf(s, "temp %d\nslope %d\npredicted %d\ncap %u\n",
+		   tmu_gov.temp, tmu_gov.slope, tmu_gov.predicted,
+		   tmu_gov.nr_levels ? tmu_gov.level[tmu_gov.cap].freq : 0);
+	for (i = 0; i < tmu_gov.nr_levels; i++)
+		seq_printf(s, "%u %llu\n", tmu_gov.level[i].freq,
+			   (unsigned long long)
+			   jiffies_64_to_clock_t(tmu_gov.time_at_cap[i]));
+	mutex_unlock(&tmu_lock);
+
+	return 0;
+}
+
+static int tmu_gov_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tmu_gov_show, NULL);
+}
+
+static const struct file_operations tmu_gov_fops = {
+	.open		= tmu_gov_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static inline bool tmu_keep_polling(void)
+{
+	return true;
+}
+#else
+static inline void tmu_gov_update(int cur_temp)
+{
+}
+
+static inline bool tmu_keep_polling(void)
+{
+	return tmu_emul_active();
+}
+#endif
+
 #ifdef CONFIG_TMU_DEBUG_ENABLE
 static void tmu_mon_timer(struct work_struct *work)
 {
@@ -376,7 +604,6 @@ static void tmu_mon_timer(struct work_struct *work)
 
 static void tmu_poll_testmode(void)
 {
-	unsigned char cur_temp_adc;
 	int cur_temp;
 	int thr_temp, trip_temp, warn_temp;
 	static int cpufreq_limited_thr	= 0;
@@ -388,16 +615,7 @@ static void tmu_poll_testmode(void)
 	warn_temp = set_warn_temp;
 	trip_temp = set_trip_temp;
 
-	/* Compensation temperature */
-	cur_temp_adc =
-		__raw_readl(tmu_info->ctz->tmu_base + CURRENT_TEMP) & 0xff;
-	cur_temp = cur_temp_adc - tmu_info->ctz->data.te1 + TMU_DC_VALUE;
-	if (cur_temp < 25) {
-		/* temperature code range is from 25 to 125 */
-		pr_info("current temp is under 25 celsius degree!\n");
-		cur_temp = 0;
-	}
-
+	cur_temp = tmu_read_temp();
 	pr_info("current temp = %d, tmu_state = %d\n",
 			cur_temp, tmu_info->ctz->data.tmu_flag);
 
@@ -413,6 +631,7 @@ static void tmu_poll_testmode(void)
 			/* To prevent from interrupt by current pending bit */
 			__raw_writel(INTCLEARALL,
 					tmu_info->ctz->tmu_base + INTCLEAR);
+			tmu_info->irq_enabled = 1;
 			enable_irq(tmu_info->irq);
 			return;
 		}
@@ -512,6 +731,7 @@ static void tmu_poll_testmode(void)
 
 	case TMU_STATUS_INIT: /* sned tmu initial status to battery drvier */
 		disable_irq(tmu_info->irq);
+		tmu_info->irq_enabled = 0;
 
 		if (cur_temp <= tmu_info->temp->thr_low)
 			tmu_info->ctz->data.tmu_flag = TMU_STATUS_NORMAL;
@@ -598,31 +818,33 @@ static void tmu_poll_timer(struct work_struct *work)
 #endif
 	mutex_lock(&tmu_lock);
 
-	/* Compensation temperature */
-	cur_temp = (__raw_readl(tmu_info->ctz->tmu_base + CURRENT_TEMP) & 0xff)
-			- tmu_info->ctz->data.te1 + TMU_DC_VALUE;
-	if (cur_temp < 25) {
-		/* temperature code range is from 25 to 125 */
-		pr_info("current temp is under 25 celsius degree!\n");
-		cur_temp = 0;
-	}
-	pr_info("current temp = %d, tmu_state = %d\n",
+	cur_temp = tmu_read_temp();
+	pr_debug("current temp = %d, tmu_state = %d\n",
 			cur_temp, tmu_info->ctz->data.tmu_flag);
 
+	tmu_gov_update(cur_temp);
+
 	switch (tmu_info->ctz->data.tmu_flag) {
 	case TMU_STATUS_NORMAL:
 		if (cur_temp <= tmu_info->temp->thr_low) {
-			if (tmu_tripped_cb(TMU_STATUS_NORMAL) < 0) 
-				pr_err("Error inform to battery driver !\n");
-			else
-				pr_info("normal: interrupt enable.\n");
-
-			/* clear to prevent from interfupt by peindig bit */
-			__raw_writel(INTCLEARALL,
-					tmu_info->ctz->tmu_base + INTCLEAR);
-			enable_irq(tmu_info->irq);
-			mutex_unlock(&tmu_lock);
-			return;
+			if (!tmu_info->irq_enabled) {
+				if (tmu_tripped_cb(TMU_STATUS_NORMAL) < 0)
+					pr_err("Error inform to battery driver !\n");
+				else
+					pr_info("normal: interrupt enable.\n");
+
+				/* clear to prevent from interfupt by peindig bit */
+				__raw_writel(INTCLEARALL,
+						tmu_info->ctz->tmu_base + INTCLEAR);
+				tmu_info->irq_enabled = 1;
+				enable_irq(tmu_info->irq);
+			}
+			/* the governor keeps sampling below the trigger */
+			if (!tmu_keep_polling()) {
+				mutex_unlock(&tmu_lock);
+				return;
+			}
+			break;
 		}
 		if (cur_temp >= TEMP_TROTTLED_CELCIUS) { /* 87 */
 			tmu_info->ctz->data.tmu_flag = TMU_STATUS_THROTTLED;
@@ -736,6 +958,7 @@ static void tmu_poll_timer(struct work_struct *work)
 
 	case TMU_STATUS_INIT: /* sned tmu initial status to battery drvier */
 		disable_irq(tmu_info->irq);
+		tmu_info->irq_enabled = 0;
 
 		if (cur_temp <= tmu_info->temp->thr_low)
 			tmu_info->ctz->data.tmu_flag = TMU_STATUS_NORMAL;
@@ -778,6 +1001,96 @@ static void tmu_poll_timer(struct work_struct *work)
 	return;
 }
 
+#ifdef CONFIG_S5PV310_TMU_EMUL
+static int tmu_emul_show(struct seq_file *s, void *unused)
+{
+	mutex_lock(&tmu_lock);
+	seq_printf(s, "%u/%u\n", tmu_emul.pos, tmu_emul.len);
+	mutex_unlock(&tmu_lock);
+
+	return 0;
+}
+
+static int tmu_emul_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tmu_emul_show, NULL);
+}
+
+/*
+ * Replaces the trace with the temperatures written, separated by white
+ * space, and starts replaying it at the next sample.  An empty write
+ * goes back to the sensor.
+ */
+static ssize_t tmu_emul_write(struct file *file, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	char *buf, *p, *end;
+	unsigned int len = 0;
+	long temp;
+
+	buf = kmalloc(count + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	if (copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	mutex_lock(&tmu_lock);
+	for (p = skip_spaces(buf); *p; p = skip_spaces(end)) {
+		temp = simple_strtol(p, &end, 10);
+		if (end == p || len == TMU_EMUL_MAX ||
+		    temp < 0 || temp > TEMP_MAX_CELCIUS) {
+			len = 0;
+			break;
+		}
+		tmu_emul.temp[len++] = temp;
+	}
+	if (len || !*p) {
+		tmu_emul.len = len;
+		tmu_emul.pos = 0;
+	}
+	mutex_unlock(&tmu_lock);
+
+	kfree(buf);
+	if (!len && *p)
+		return -EINVAL;
+
+	if (len)
+		queue_delayed_work_on(0, tmu_monitor_wq,
+				&tmu_info->polling_work, 0);
+
+	return count;
+}
+
+static const struct file_operations tmu_emul_fops = {
+	.open		= tmu_emul_open,
+	.read		= seq_read,
+	.write		= tmu_emul_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
+static void tmu_debugfs_init(void)
+{
+	tmu_info->debugfs = debugfs_create_dir("tmu", NULL);
+	if (IS_ERR_OR_NULL(tmu_info->debugfs)) {
+		tmu_info->debugfs = NULL;
+		return;
+	}
+
+#ifdef CONFIG_S5PV310_TMU_PREDICTIVE
+	debugfs_create_file("governor", S_IRUGO, tmu_info->debugfs, NULL,
+			&tmu_gov_fops);
+#endif
+#ifdef CONFIG_S5PV310_TMU_EMUL
+	debugfs_create_file("emul_temp", S_IRUGO | S_IWUSR, tmu_info->debugfs,
+			NULL, &tmu_emul_fops);
+#endif
+}
+
 static int tmu_initialize(struct platform_device *pdev)
 {
 	struct s5p_tmu *tz = platform_get_drvdata(pdev);
@@ -872,6 +1185,7 @@ static irqreturn_t s5p_tmu_irq(int irq, void *id)
 	unsigned int status;
 
 	disable_irq_nosync(irq);
+	tmu_info->irq_enabled = 0;
 
 	status = __raw_readl(tz->tmu_base + INTSTAT);
 
@@ -985,12 +1299,14 @@ static int __devinit s5p_tmu_probe(struct platform_device *pdev)
 		dev_err(&pdev->dev, "IRQ%d error %d\n", tmu_info->irq, ret);
 		goto err_irq;
 	}
+	tmu_info->irq_enabled = 1;
 
 	ret = tmu_initialize(pdev);
 	if (ret)
 		goto err_init;
 
 	tmu_start(pdev);
+	tmu_debugfs_init();
 
 	return ret;
 
@@ -1020,6 +1336,10 @@ static int __devinit s5p_tmu_remove(struct platform_device *pdev)
 	struct s5p_tmu *tz = platform_get_drvdata(pdev);
 
 	cancel_delayed_work(&tmu_info->polling_work);
+	debugfs_remove_recursive(tmu_info->debugfs);
+#ifdef CONFIG_S5PV310_TMU_PREDICTIVE
+	s5pv310_cpufreq_upper_limit_free(DVFS_LOCK_ID_TMU_GOV);
+#endif
 
 	if (tmu_info->irq >= 0)
 		free_irq(tmu_info->irq, tz);
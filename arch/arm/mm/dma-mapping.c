@@ -17,6 +17,7 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/cma.h>
 
 #include <asm/memory.h>
 #include <asm/highmem.h>
@@ -649,3 +650,22 @@ void dma_sync_sg_for_device(struct device *dev, struct scatterlist *sg,
 	}
 }
 EXPORT_SYMBOL(dma_sync_sg_for_device);
+
+#ifdef CONFIG_CMA_MIGRATE
+/*
+ * Pages of a CMA chunk that were lent to the page allocator may still
+ * have data lurking in the kernel direct-mapped region.
+ */
+void cma_arch_flush_range(dma_addr_t start, size_t size)
+{
+	struct page *last = pfn_to_page((start + size - 1) >> PAGE_SHIFT);
+
+	if (PageHighMem(last)) {
+		flush_cache_all();
+	} else {
+		void *ptr = phys_to_virt(start);
+		dmac_flush_range(ptr, ptr + size);
+	}
+	outer_flush_range(start, start + size);
+}
+#endif
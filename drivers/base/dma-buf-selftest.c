@@ -0,0 +1,218 @@
+/*
+ * Shared DMA buffers self test
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License or (at your optional) any later version of the license.
+ *
+ * A software exporter backed by scattered pages and a software
+ * importer standing in for a device.  The "device" reads and writes
+ * the pages through the kernel mapping between map and unmap, and
+ * the test checks both the data and that caches were maintained
+ * exactly once per change of ownership.
+ */
+
+#define pr_fmt(fmt) "dma-buf selftest: " fmt
+
+#include <linux/dma-buf.h>
+#include <linux/file.h>
+#include <linux/gfp.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+
+
+#define TEST_PAGES 4
+
+struct test_exporter {
+	struct sg_table sgt;
+	struct page *pages[TEST_PAGES];
+	bool released;
+};
+
+static void test_free(struct test_exporter *exp, unsigned nr_pages)
+{
+	while (nr_pages--)
+		__free_page(exp->pages[nr_pages]);
+	sg_free_table(&exp->sgt);
+}
+
+static void test_release(struct dma_buf *buf)
+{
+	struct test_exporter *exp = buf->priv;
+
+	test_free(exp, TEST_PAGES);
+	exp->released = true;
+}
+
+static const struct dma_buf_ops test_ops = {
+	.release = test_release,
+};
+
+/* What the importing "device" does between map and unmap. */
+static void test_device_fill(struct sg_table *sgt, u8 val)
+{
+	struct scatterlist *sg;
+	unsigned i;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+		memset(sg_virt(sg), val, sg_dma_len(sg));
+}
+
+static bool test_device_check(struct sg_table *sgt, u8 val)
+{
+	struct scatterlist *sg;
+	unsigned i, j;
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+		for (j = 0; j < sg_dma_len(sg); ++j)
+			if (((u8 *)sg_virt(sg))[j] != val)
+				return false;
+	return true;
+}
+
+#define CHECK(cond) do {						\
+		if (!(cond)) {						\
+			pr_err("%s:%d: %s\n", __func__, __LINE__, #cond); \
+			ret = -EINVAL;					\
+			goto out;					\
+		}							\
+	} while (0)
+
+#define CHECK_SYNCS(dev, cpu)						\
+	CHECK(buf->syncs_for_device == (dev) && buf->syncs_for_cpu == (cpu))
+
+static int __init dma_buf_selftest(void)
+{
+	static struct test_exporter exp;
+	struct platform_device *pdev;
+	struct dma_buf_attachment *a = NULL, *b = NULL;
+	struct dma_buf *buf = NULL, *got;
+	struct sg_table *sgt;
+	struct scatterlist *sg;
+	unsigned i;
+	int fd, ret = 0;
+
+	pdev = platform_device_register_simple("dma-buf-selftest", -1, NULL, 0);
+	if (IS_ERR(pdev))
+		return PTR_ERR(pdev);
+
+	if (sg_alloc_table(&exp.sgt, TEST_PAGES, GFP_KERNEL)) {
+		ret = -ENOMEM;
+		goto out_dev;
+	}
+	for_each_sg(exp.sgt.sgl, sg, TEST_PAGES, i) {
+		exp.pages[i] = alloc_page(GFP_KERNEL);
+		if (!exp.pages[i]) {
+			test_free(&exp, i);
+			ret = -ENOMEM;
+			goto out_dev;
+		}
+		sg_set_page(sg, exp.pages[i], PAGE_SIZE, 0);
+	}
+
+	buf = dma_buf_export(&pdev->dev, &exp.sgt, TEST_PAGES * PAGE_SIZE,
+			     &test_ops, &exp, "selftest");
+	if (IS_ERR(buf)) {
+		test_free(&exp, TEST_PAGES);
+		ret = PTR_ERR(buf);
+		buf = NULL;
+		goto out_dev;
+	}
+
+	/* The file descriptor leads back to the same buffer. */
+	fd = dma_buf_fd(buf, O_CLOEXEC);
+	CHECK(fd >= 0);
+	got = dma_buf_get(fd);
+	sys_close(fd);
+	if (got != buf) {
+		/* Closing the descriptor dropped the last reference. */
+		pr_err("dma_buf_get() returned %p for %p\n", got, buf);
+		buf = NULL;
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* The exporter fills the buffer. */
+	CHECK(!dma_buf_begin_cpu_access(buf, DMA_TO_DEVICE));
+	for (i = 0; i < TEST_PAGES; ++i)
+		memset(page_address(exp.pages[i]), 0xa5, PAGE_SIZE);
+	dma_buf_end_cpu_access(buf, DMA_TO_DEVICE);
+	CHECK_SYNCS(0, 0);
+
+	/* First device reads it and writes it back: one clean. */
+	a = dma_buf_attach(buf, &pdev->dev);
+	CHECK(!IS_ERR(a));
+	sgt = dma_buf_map_attachment(a, DMA_BIDIRECTIONAL);
+	CHECK(!IS_ERR(sgt));
+	CHECK(sg_dma_address(sgt->sgl) == page_to_phys(exp.pages[0]));
+	CHECK(test_device_check(sgt, 0xa5));
+	test_device_fill(sgt, 0x5a);
+	dma_buf_unmap_attachment(a);
+	CHECK_SYNCS(1, 0);
+
+	/* Second device picks it up: devices pass it on for free. */
+	b = dma_buf_attach(buf, NULL);
+	CHECK(!IS_ERR(b));
+	sgt = dma_buf_map_attachment(b, DMA_TO_DEVICE);
+	CHECK(!IS_ERR(sgt));
+	CHECK(test_device_check(sgt, 0x5a));
+	dma_buf_unmap_attachment(b);
+	sgt = dma_buf_map_attachment(a, DMA_FROM_DEVICE);
+	CHECK(!IS_ERR(sgt));
+	dma_buf_unmap_attachment(a);
+	CHECK_SYNCS(1, 0);
+
+	/* CPU reads the result: one invalidate, and reading twice or
+	 * handing a clean buffer back to a device costs nothing. */
+	CHECK(!dma_buf_begin_cpu_access(buf, DMA_FROM_DEVICE));
+	dma_buf_end_cpu_access(buf, DMA_FROM_DEVICE);
+	CHECK(!dma_buf_begin_cpu_access(buf, DMA_FROM_DEVICE));
+	dma_buf_end_cpu_access(buf, DMA_FROM_DEVICE);
+	CHECK_SYNCS(1, 1);
+	sgt = dma_buf_map_attachment(b, DMA_TO_DEVICE);
+	CHECK(!IS_ERR(sgt));
+	dma_buf_unmap_attachment(b);
+	CHECK_SYNCS(1, 1);
+
+	/* CPU writes: next device access cleans again. */
+	CHECK(!dma_buf_begin_cpu_access(buf, DMA_BIDIRECTIONAL));
+	dma_buf_end_cpu_access(buf, DMA_BIDIRECTIONAL);
+	sgt = dma_buf_map_attachment(b, DMA_TO_DEVICE);
+	CHECK(!IS_ERR(sgt));
+	dma_buf_unmap_attachment(b);
+	CHECK_SYNCS(2, 1);
+
+	/* A device keeping the buffer mapped, as UMP does, gets the CPU
+	 * writes cleaned when the CPU is done, not at the next map. */
+	sgt = dma_buf_map_attachment(a, DMA_TO_DEVICE);
+	CHECK(!IS_ERR(sgt));
+	CHECK(!dma_buf_begin_cpu_access(buf, DMA_TO_DEVICE));
+	CHECK_SYNCS(2, 1);
+	dma_buf_end_cpu_access(buf, DMA_TO_DEVICE);
+	CHECK_SYNCS(3, 1);
+	dma_buf_unmap_attachment(a);
+
+out:
+	if (!IS_ERR_OR_NULL(b))
+		dma_buf_detach(buf, b);
+	if (!IS_ERR_OR_NULL(a))
+		dma_buf_detach(buf, a);
+	if (buf) {
+		/* Reference taken by dma_buf_get(); the fd's is gone. */
+		dma_buf_put(buf);
+		if (!ret && !exp.released) {
+			pr_err("buffer not released\n");
+			ret = -EINVAL;
+		}
+	}
+out_dev:
+	platform_device_unregister(pdev);
+	if (!ret)
+		pr_info("passed\n");
+	return ret;
+}
+late_initcall(dma_buf_selftest);
@@ -0,0 +1,542 @@
+/*
+ * Shared DMA buffers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License or (at your optional) any later version of the license.
+ *
+ * See Documentation/dma-buf-sharing.txt for details.
+ */
+
+#define pr_fmt(fmt) "dma-buf: " fmt
+
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/dma-buf.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+
+static const struct file_operations dma_buf_fops;
+
+
+/************************* Cache maintenance *************************/
+
+/*
+ * The CPU caches are the only thing that needs to be kept coherent:
+ * none of the importers sits behind an IOMMU, so the bus address of
+ * every page is its physical address.  dma_sync_sg_for_*() are used
+ * rather than dma_map_sg() so that mapping a buffer for another
+ * device costs nothing unless ownership actually moves.
+ */
+
+static void __dma_buf_sync_for_device(struct dma_buf *buf, struct device *dev)
+{
+	dma_sync_sg_for_device(dev, buf->sgt->sgl, buf->sgt->nents,
+			       DMA_TO_DEVICE);
+	buf->cpu_dirty = 0;
+	++buf->syncs_for_device;
+}
+
+static void __dma_buf_sync_for_cpu(struct dma_buf *buf)
+{
+	dma_sync_sg_for_cpu(buf->dev, buf->sgt->sgl, buf->sgt->nents,
+			    DMA_FROM_DEVICE);
+	buf->dev_dirty = 0;
+	++buf->syncs_for_cpu;
+}
+
+/* An attachment a device keeps mapped, if any; called under lock. */
+static struct dma_buf_attachment *__dma_buf_mapped(struct dma_buf *buf)
+{
+	struct dma_buf_attachment *attach;
+
+	list_for_each_entry(attach, &buf->attachments, node)
+		if (attach->mapped)
+			return attach;
+	return NULL;
+}
+
+/* Whether a device may still write to the buffer; called under lock. */
+static bool __dma_buf_dev_writing(struct dma_buf *buf)
+{
+	struct dma_buf_attachment *attach;
+
+	list_for_each_entry(attach, &buf->attachments, node)
+		if (attach->mapped && attach->dir != DMA_TO_DEVICE)
+			return true;
+	return false;
+}
+
+
+/******************************* Exporter *******************************/
+
+/**
+ * dma_buf_export() - wraps a buffer into a new dma-buf.
+ * @dev:	exporter's device.
+ * @sgt:	pages backing the buffer.  Every entry must have a struct
+ *		page; the table stays owned by the exporter and must not
+ *		change until @ops->release is called.
+ * @size:	size of the buffer.
+ * @ops:	exporter callbacks; @ops->release is mandatory.
+ * @priv:	exporter's private data.
+ * @name:	exporter's name.
+ *
+ * The buffer starts owned by the CPU with caches possibly dirty so
+ * whatever the exporter wrote into it reaches the first importer.
+ * The returned buffer holds one reference which is passed on by
+ * dma_buf_fd() or dropped by dma_buf_put().  Returns an ERR_PTR()
+ * on error.
+ */
+struct dma_buf *dma_buf_export(struct device *dev, struct sg_table *sgt,
+			       size_t size, const struct dma_buf_ops *ops,
+			       void *priv, const char *name)
+{
+	struct dma_buf *buf;
+	struct file *file;
+
+	if (WARN_ON(!sgt || !sgt->nents || !size || !ops || !ops->release))
+		return ERR_PTR(-EINVAL);
+
+	buf = kzalloc(sizeof *buf, GFP_KERNEL);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+
+	buf->size   = size;
+	buf->sgt    = sgt;
+	buf->dev    = dev;
+	buf->ops    = ops;
+	buf->priv   = priv;
+	buf->name   = name;
+	buf->owner  = DMA_BUF_OWNER_CPU;
+	buf->cpu_dirty = 1;
+	mutex_init(&buf->lock);
+	INIT_LIST_HEAD(&buf->attachments);
+
+	file = anon_inode_getfile("dmabuf", &dma_buf_fops, buf, O_RDWR);
+	if (IS_ERR(file)) {
+		kfree(buf);
+		return ERR_CAST(file);
+	}
+	buf->file = file;
+
+	pr_debug("%s: exported %zu bytes in %u chunks\n",
+		 name, size, sgt->nents);
+
+	return buf;
+}
+EXPORT_SYMBOL_GPL(dma_buf_export);
+
+
+struct dma_buf_contig {
+	struct sg_table sgt;
+	void (*release)(void *priv);
+	void *priv;
+};
+
+static void dma_buf_contig_release(struct dma_buf *buf)
+{
+	struct dma_buf_contig *contig = buf->priv;
+
+	contig->release(contig->priv);
+	sg_free_table(&contig->sgt);
+	kfree(contig);
+}
+
+static const struct dma_buf_ops dma_buf_contig_ops = {
+	.release = dma_buf_contig_release,
+};
+
+/**
+ * dma_buf_export_contig() - wraps a physically contiguous buffer.
+ * @dev:	exporter's device.
+ * @start:	physical address of the buffer.
+ * @size:	size of the buffer.
+ * @release:	called with @priv when the last reference goes away.
+ * @priv:	exporter's private data.
+ * @name:	exporter's name.
+ *
+ * Helper for the carve-out allocators (CMA, pmem) which hand out
+ * plain physical ranges.  The range must be covered by the memory
+ * map.  Note that buf->priv is not @priv.
+ */
+struct dma_buf *dma_buf_export_contig(struct device *dev, dma_addr_t start,
+				      size_t size, void (*release)(void *priv),
+				      void *priv, const char *name)
+{
+	struct dma_buf_contig *contig;
+	struct dma_buf *buf;
+	unsigned long pfn = start >> PAGE_SHIFT;
+
+	if (!release || !size || (start & ~PAGE_MASK) ||
+	    !pfn_valid(pfn) || !pfn_valid(pfn + PAGE_ALIGN(size) / PAGE_SIZE - 1))
+		return ERR_PTR(-EINVAL);
+
+	contig = kmalloc(sizeof *contig, GFP_KERNEL);
+	if (!contig)
+		return ERR_PTR(-ENOMEM);
+
+	if (sg_alloc_table(&contig->sgt, 1, GFP_KERNEL)) {
+		kfree(contig);
+		return ERR_PTR(-ENOMEM);
+	}
+	sg_set_page(contig->sgt.sgl, pfn_to_page(pfn), size, 0);
+	contig->release = release;
+	contig->priv    = priv;
+
+	buf = dma_buf_export(dev, &contig->sgt, size, &dma_buf_contig_ops,
+			     contig, name);
+	if (IS_ERR(buf)) {
+		sg_free_table(&contig->sgt);
+		kfree(contig);
+	}
+	return buf;
+}
+EXPORT_SYMBOL_GPL(dma_buf_export_contig);
+
+
+/**
+ * dma_buf_fd() - installs a file descriptor for a buffer.
+ * @buf:	the buffer.
+ * @flags:	O_CLOEXEC or zero.
+ *
+ * Passes the caller's reference to the new descriptor.
+ */
+int dma_buf_fd(struct dma_buf *buf, int flags)
+{
+	int fd;
+
+	if (!buf || !buf->file)
+		return -EINVAL;
+
+	fd = get_unused_fd_flags(flags & O_CLOEXEC);
+	if (fd >= 0)
+		fd_install(fd, buf->file);
+	return fd;
+}
+EXPORT_SYMBOL_GPL(dma_buf_fd);
+
+
+/******************************* Importer *******************************/
+
+/**
+ * dma_buf_get() - takes a reference to the buffer behind a descriptor.
+ * @fd:	file descriptor.
+ */
+struct dma_buf *dma_buf_get(int fd)
+{
+	struct file *file = fget(fd);
+
+	if (!file)
+		return ERR_PTR(-EBADF);
+
+	if (file->f_op != &dma_buf_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return file->private_data;
+}
+EXPORT_SYMBOL_GPL(dma_buf_get);
+
+/**
+ * dma_buf_put() - drops a reference taken by dma_buf_get().
+ * @buf:	the buffer.
+ */
+void dma_buf_put(struct dma_buf *buf)
+{
+	if (!WARN_ON(!buf || !buf->file))
+		fput(buf->file);
+}
+EXPORT_SYMBOL_GPL(dma_buf_put);
+
+
+/**
+ * dma_buf_attach() - registers a device as a user of a buffer.
+ * @buf:	the buffer.
+ * @dev:	importing device, or NULL for devices which are not
+ *		represented by one (such as the GPU behind UMP).
+ *
+ * Builds the device's view of the buffer; no cache maintenance is
+ * done until the attachment is mapped.
+ */
+struct dma_buf_attachment *dma_buf_attach(struct dma_buf *buf,
+					  struct device *dev)
+{
+	struct dma_buf_attachment *attach;
+	struct scatterlist *src, *dst;
+	unsigned i;
+
+	if (WARN_ON(!buf))
+		return ERR_PTR(-EINVAL);
+
+	attach = kzalloc(sizeof *attach, GFP_KERNEL);
+	if (!attach)
+		return ERR_PTR(-ENOMEM);
+
+	if (sg_alloc_table(&attach->sgt, buf->sgt->nents, GFP_KERNEL)) {
+		kfree(attach);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	dst = attach->sgt.sgl;
+	for_each_sg(buf->sgt->sgl, src, buf->sgt->nents, i) {
+		sg_set_page(dst, sg_page(src), src->length, src->offset);
+		sg_dma_address(dst) = sg_phys(src);
+		sg_dma_len(dst) = src->length;
+		dst = sg_next(dst);
+	}
+
+	attach->dmabuf = buf;
+	attach->dev    = dev;
+	attach->dir    = DMA_NONE;
+
+	mutex_lock(&buf->lock);
+	list_add(&attach->node, &buf->attachments);
+	mutex_unlock(&buf->lock);
+
+	return attach;
+}
+EXPORT_SYMBOL_GPL(dma_buf_attach);
+
+/**
+ * dma_buf_detach() - undoes dma_buf_attach().
+ * @buf:	the buffer.
+ * @attach:	the attachment; must not be mapped.
+ */
+void dma_buf_detach(struct dma_buf *buf, struct dma_buf_attachment *attach)
+{
+	if (WARN_ON(!buf || !attach || attach->dmabuf != buf))
+		return;
+
+	mutex_lock(&buf->lock);
+	WARN_ON(attach->mapped);
+	list_del(&attach->node);
+	mutex_unlock(&buf->lock);
+
+	sg_free_table(&attach->sgt);
+	kfree(attach);
+}
+EXPORT_SYMBOL_GPL(dma_buf_detach);
+
+
+/**
+ * dma_buf_map_attachment() - hands the buffer over to a device.
+ * @attach:	the attachment.
+ * @dir:	what the device is going to do with the buffer.
+ *
+ * Cleans the CPU caches if the CPU wrote to the buffer since the last
+ * time a device had it; otherwise does nothing.  Returns the buffer
+ * as seen by the device, valid until dma_buf_unmap_attachment().
+ */
+struct sg_table *dma_buf_map_attachment(struct dma_buf_attachment *attach,
+					enum dma_data_direction dir)
+{
+	struct dma_buf *buf;
+
+	if (WARN_ON(!attach || !valid_dma_direction(dir)))
+		return ERR_PTR(-EINVAL);
+
+	buf = attach->dmabuf;
+	mutex_lock(&buf->lock);
+
+	if (buf->cpu_dirty)
+		__dma_buf_sync_for_device(buf, attach->dev ?: buf->dev);
+	if (dir != DMA_TO_DEVICE)
+		buf->dev_dirty = 1;
+	buf->owner = DMA_BUF_OWNER_DEVICE;
+
+	if (attach->mapped++ && attach->dir != dir)
+		attach->dir = DMA_BIDIRECTIONAL;
+	else
+		attach->dir = dir;
+
+	mutex_unlock(&buf->lock);
+
+	return &attach->sgt;
+}
+EXPORT_SYMBOL_GPL(dma_buf_map_attachment);
+
+/**
+ * dma_buf_unmap_attachment() - the device is done with the buffer.
+ * @attach:	the attachment.
+ *
+ * Does no cache maintenance; that is deferred until the CPU asks for
+ * the buffer so that it can go on to another device for free.
+ */
+void dma_buf_unmap_attachment(struct dma_buf_attachment *attach)
+{
+	struct dma_buf *buf;
+
+	if (WARN_ON(!attach))
+		return;
+
+	buf = attach->dmabuf;
+	mutex_lock(&buf->lock);
+	if (!WARN_ON(!attach->mapped) && !--attach->mapped)
+		attach->dir = DMA_NONE;
+	mutex_unlock(&buf->lock);
+}
+EXPORT_SYMBOL_GPL(dma_buf_unmap_attachment);
+
+
+/**
+ * dma_buf_begin_cpu_access() - hands the buffer over to the CPU.
+ * @buf:	the buffer.
+ * @dir:	DMA_FROM_DEVICE if the CPU is only going to read the
+ *		buffer, DMA_TO_DEVICE if only going to write it,
+ *		DMA_BIDIRECTIONAL otherwise.
+ *
+ * Invalidates the CPU caches if a device may have written to the
+ * buffer since the CPU last had it.
+ */
+int dma_buf_begin_cpu_access(struct dma_buf *buf, enum dma_data_direction dir)
+{
+	if (WARN_ON(!buf || !valid_dma_direction(dir)))
+		return -EINVAL;
+
+	mutex_lock(&buf->lock);
+
+	if (buf->dev_dirty) {
+		__dma_buf_sync_for_cpu(buf);
+		/* A device still holding a writable mapping may go on. */
+		buf->dev_dirty = __dma_buf_dev_writing(buf);
+	}
+	if (dir != DMA_FROM_DEVICE)
+		buf->cpu_dirty = 1;
+	buf->owner = DMA_BUF_OWNER_CPU;
+	++buf->cpu_users;
+
+	mutex_unlock(&buf->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(dma_buf_begin_cpu_access);
+
+/**
+ * dma_buf_end_cpu_access() - the CPU is done with the buffer.
+ * @buf:	the buffer.
+ * @dir:	same as passed to dma_buf_begin_cpu_access().
+ *
+ * If a device keeps the buffer mapped, as UMP does for as long as it
+ * holds the memory, the device will not map it again, so the caches
+ * are cleaned here once the last CPU user is done.  Otherwise this
+ * does no cache maintenance and the caches are cleaned only once a
+ * device maps the buffer.
+ */
+void dma_buf_end_cpu_access(struct dma_buf *buf, enum dma_data_direction dir)
+{
+	struct dma_buf_attachment *attach;
+
+	if (WARN_ON(!buf))
+		return;
+
+	mutex_lock(&buf->lock);
+	if (buf->cpu_users)
+		--buf->cpu_users;
+	if (!buf->cpu_users && buf->cpu_dirty) {
+		attach = __dma_buf_mapped(buf);
+		if (attach)
+			__dma_buf_sync_for_device(buf,
+					attach->dev ?: buf->dev);
+	}
+	mutex_unlock(&buf->lock);
+}
+EXPORT_SYMBOL_GPL(dma_buf_end_cpu_access);
+
+
+/******************************* File ops *******************************/
+
+static int dma_buf_file_release(struct inode *inode, struct file *file)
+{
+	struct dma_buf *buf = file->private_data;
+
+	WARN_ON(!list_empty(&buf->attachments));
+
+	pr_debug("%s: released %zu bytes, %lu/%lu syncs for device/cpu\n",
+		 buf->name, buf->size, buf->syncs_for_device,
+		 buf->syncs_for_cpu);
+
+	buf->ops->release(buf);
+	kfree(buf);
+	return 0;
+}
+
+static int dma_buf_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct dma_buf *buf = file->private_data;
+	unsigned long addr = vma->vm_start;
+	unsigned long skip = vma->vm_pgoff << PAGE_SHIFT;
+	struct scatterlist *sg;
+	unsigned i;
+	int ret;
+
+	if (skip >= buf->size || vma->vm_end - vma->vm_start > buf->size - skip)
+		return -EINVAL;
+
+	if (buf->ops->mmap)
+		return buf->ops->mmap(buf, vma);
+
+	for_each_sg(buf->sgt->sgl, sg, buf->sgt->nents, i) {
+		unsigned long len = PAGE_ALIGN(sg->length);
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+
+		len = min(len - skip, vma->vm_end - addr);
+		ret = remap_pfn_range(vma, addr,
+				      page_to_pfn(sg_page(sg)) + (skip >> PAGE_SHIFT),
+				      len, vma->vm_page_prot);
+		if (ret)
+			return ret;
+
+		skip = 0;
+		addr += len;
+		if (addr >= vma->vm_end)
+			break;
+	}
+
+	return 0;
+}
+
+static long dma_buf_file_ioctl(struct file *file, unsigned cmd,
+			       unsigned long arg)
+{
+	static const enum dma_data_direction dirs[] = {
+		[DMA_BUF_SYNC_READ]  = DMA_FROM_DEVICE,
+		[DMA_BUF_SYNC_WRITE] = DMA_TO_DEVICE,
+		[DMA_BUF_SYNC_RW]    = DMA_BIDIRECTIONAL,
+	};
+	struct dma_buf *buf = file->private_data;
+	struct dma_buf_sync sync;
+	unsigned access;
+
+	if (cmd != DMA_BUF_IOCTL_SYNC)
+		return -ENOTTY;
+
+	if (copy_from_user(&sync, (void __user *)arg, sizeof sync))
+		return -EFAULT;
+
+	access = sync.flags & DMA_BUF_SYNC_RW;
+	if ((sync.flags & ~DMA_BUF_SYNC_VALID_FLAGS_MASK) || !access)
+		return -EINVAL;
+
+	if (sync.flags & DMA_BUF_SYNC_END)
+		dma_buf_end_cpu_access(buf, dirs[access]);
+	else
+		return dma_buf_begin_cpu_access(buf, dirs[access]);
+	return 0;
+}
+
+static const struct file_operations dma_buf_fops = {
+	.owner          = THIS_MODULE,
+	.release        = dma_buf_file_release,
+	.mmap           = dma_buf_file_mmap,
+	.unlocked_ioctl = dma_buf_file_ioctl,
+};
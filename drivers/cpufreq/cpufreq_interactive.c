@@ -19,12 +19,15 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
 #include <linux/tick.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
+#include <linux/slab.h>
 
 #include <asm/cputime.h>
 
@@ -67,6 +70,28 @@ static unsigned long go_maxspeed_load;
 #define DEFAULT_MIN_SAMPLE_TIME 80000;
 static unsigned long min_sample_time;
 
+/*
+ * Go to max speed when the runnable load reported by the scheduler is at
+ * or above this value, that is when tasks queue up behind each other.
+ * 100 is one task always runnable.
+ */
+#define DEFAULT_GO_MAXSPEED_RUNNABLE 150
+static unsigned long go_maxspeed_runnable;
+
+/*
+ * Boost: for boostpulse_duration uS after an input event or a write to
+ * boostpulse, do not run below boost_freq (policy max if 0).  This gets
+ * the first frames of a scroll or an app launch to full speed without
+ * waiting for a load sample.
+ */
+#define DEFAULT_BOOSTPULSE_DURATION 80000
+static unsigned long boostpulse_duration;
+static unsigned long boost_freq;
+static unsigned long input_boost;
+
+/* End of the current boost in uS, protected by up_cpumask_lock. */
+static u64 boostpulse_endtime;
+
 #define DEBUG 0
 #define BUFSZ 128
 
@@ -167,12 +192,81 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+/* Lowest table frequency at or above boost_freq, within the policy. */
+static unsigned int cpufreq_interactive_boost_freq(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	unsigned int freq = boost_freq ? boost_freq : pcpu->policy->max;
+	unsigned int index;
+
+	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+					   freq, CPUFREQ_RELATION_L, &index))
+		return pcpu->policy->max;
+
+	return pcpu->freq_table[index].frequency;
+}
+
+static int cpufreq_interactive_boosted(u64 now)
+{
+	unsigned long flags;
+	int boosted;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	boosted = now < boostpulse_endtime;
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	return boosted;
+}
+
+/*
+ * Raise every CPU to the boost frequency right away and keep it there
+ * for boostpulse_duration.  May be called from interrupt context.
+ */
+static void cpufreq_interactive_boost(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	u64 now = ktime_to_us(ktime_get());
+	unsigned int freq;
+	unsigned long flags;
+	int cpu, wake = 0;
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+
+	/* Events come in bursts; only renew a boost half way through. */
+	if (boostpulse_endtime > now + boostpulse_duration / 2) {
+		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+		return;
+	}
+	boostpulse_endtime = now + boostpulse_duration;
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->governor_enabled)
+			continue;
+
+		freq = cpufreq_interactive_boost_freq(pcpu);
+		if (pcpu->target_freq < freq) {
+			pcpu->target_freq = freq;
+			cpumask_set_cpu(cpu, &up_cpumask);
+			wake = 1;
+		}
+	}
+
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (wake) {
+		dbgpr("boost: until %llu\n", now + boostpulse_duration);
+		wake_up_process(up_task);
+	}
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
 	unsigned int delta_time;
 	int cpu_load;
 	int load_since_change;
+	unsigned long runnable_load;
 	u64 time_in_idle;
 	u64 idle_exit_time;
 	struct cpufreq_interactive_cpuinfo *pcpu =
@@ -180,6 +274,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 	u64 now_idle;
 	unsigned int new_freq;
 	unsigned int index;
+	unsigned long flags;
 
 	/*
 	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
@@ -244,11 +339,24 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
-	if (cpu_load >= go_maxspeed_load)
+	/*
+	 * Idle time can only tell how busy the CPU was; the scheduler's
+	 * runnable load also shows work that is waiting to run, and
+	 * reacts within a tick to a task that has just woken up.
+	 */
+	runnable_load = cpu_runnable_load(data);
+	if (runnable_load > cpu_load)
+		cpu_load = min_t(unsigned long, runnable_load, 100);
+
+	if (cpu_load >= go_maxspeed_load ||
+	    runnable_load >= go_maxspeed_runnable)
 		new_freq = pcpu->policy->max;
 	else
 		new_freq = pcpu->policy->max * cpu_load / 100;
 
+	if (cpufreq_interactive_boosted(pcpu->timer_run_time))
+		new_freq = max(new_freq, cpufreq_interactive_boost_freq(pcpu));
+
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
 					   &index)) {
@@ -276,7 +384,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 		}
 	}
 
-	dbgpr("timer %d: load=%d cur=%d tgt=%d queue\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+	dbgpr("timer %d: load=%d runnable=%lu cur=%d tgt=%d queue\n", (int) data, cpu_load, runnable_load, pcpu->target_freq, new_freq);
 
 	if (new_freq < pcpu->target_freq) {
 		pcpu->target_freq = new_freq;
@@ -289,9 +397,9 @@ static void cpufreq_interactive_timer(unsigned long data)
 #if DEBUG
 		up_request_time = ktime_to_us(ktime_get());
 #endif
-		spin_lock(&up_cpumask_lock);
+		spin_lock_irqsave(&up_cpumask_lock, flags);
 		cpumask_set_cpu(data, &up_cpumask);
-		spin_unlock(&up_cpumask_lock);
+		spin_unlock_irqrestore(&up_cpumask_lock, flags);
 		wake_up_process(up_task);
 	}
 
@@ -424,6 +532,7 @@ static int cpufreq_interactive_up_task(void *data)
 	unsigned int cpu;
 	cpumask_t tmp_mask;
 	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned long flags;
 
 #if DEBUG
 	u64 now;
@@ -433,16 +542,16 @@ static int cpufreq_interactive_up_task(void *data)
 
 	while (1) {
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock(&up_cpumask_lock);
+		spin_lock_irqsave(&up_cpumask_lock, flags);
 
 		if (cpumask_empty(&up_cpumask)) {
-			spin_unlock(&up_cpumask_lock);
+			spin_unlock_irqrestore(&up_cpumask_lock, flags);
 			schedule();
 
 			if (kthread_should_stop())
 				break;
 
-			spin_lock(&up_cpumask_lock);
+			spin_lock_irqsave(&up_cpumask_lock, flags);
 		}
 
 		set_current_state(TASK_RUNNING);
@@ -461,7 +570,7 @@ static int cpufreq_interactive_up_task(void *data)
 
 		tmp_mask = up_cpumask;
 		cpumask_clear(&up_cpumask);
-		spin_unlock(&up_cpumask_lock);
+		spin_unlock_irqrestore(&up_cpumask_lock, flags);
 
 		for_each_cpu(cpu, &tmp_mask) {
 			pcpu = &per_cpu(cpuinfo, cpu);
@@ -516,7 +625,7 @@ static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 static ssize_t store_go_maxspeed_load(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &go_maxspeed_load);
+	return strict_strtoul(buf, 0, &go_maxspeed_load) ? -EINVAL : count;
 }
 
 static struct global_attr go_maxspeed_load_attr = __ATTR(go_maxspeed_load, 0644,
@@ -531,15 +640,93 @@ static ssize_t show_min_sample_time(struct kobject *kobj,
 static ssize_t store_min_sample_time(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &min_sample_time);
+	return strict_strtoul(buf, 0, &min_sample_time) ? -EINVAL : count;
 }
 
 static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 		show_min_sample_time, store_min_sample_time);
 
+static ssize_t show_go_maxspeed_runnable(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", go_maxspeed_runnable);
+}
+
+static ssize_t store_go_maxspeed_runnable(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	return strict_strtoul(buf, 0, &go_maxspeed_runnable) ? -EINVAL : count;
+}
+
+static struct global_attr go_maxspeed_runnable_attr =
+	__ATTR(go_maxspeed_runnable, 0644,
+		show_go_maxspeed_runnable, store_go_maxspeed_runnable);
+
+static ssize_t show_boost_freq(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boost_freq);
+}
+
+static ssize_t store_boost_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	return strict_strtoul(buf, 0, &boost_freq) ? -EINVAL : count;
+}
+
+static struct global_attr boost_freq_attr = __ATTR(boost_freq, 0644,
+		show_boost_freq, store_boost_freq);
+
+static ssize_t show_boostpulse_duration(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boostpulse_duration);
+}
+
+static ssize_t store_boostpulse_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	return strict_strtoul(buf, 0, &boostpulse_duration) ? -EINVAL : count;
+}
+
+static struct global_attr boostpulse_duration_attr =
+	__ATTR(boostpulse_duration, 0644,
+		show_boostpulse_duration, store_boostpulse_duration);
+
+static ssize_t show_input_boost(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost);
+}
+
+static ssize_t store_input_boost(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	return strict_strtoul(buf, 0, &input_boost) ? -EINVAL : count;
+}
+
+static struct global_attr input_boost_attr = __ATTR(input_boost, 0644,
+		show_input_boost, store_input_boost);
+
+/* Boost hint from user space, e.g. on an app launch. */
+static ssize_t store_boostpulse(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	cpufreq_interactive_boost();
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
 static struct attribute *interactive_attributes[] = {
 	&go_maxspeed_load_attr.attr,
 	&min_sample_time_attr.attr,
+	&go_maxspeed_runnable_attr.attr,
+	&boost_freq_attr.attr,
+	&boostpulse_duration_attr.attr,
+	&input_boost_attr.attr,
+	&boostpulse_attr.attr,
 	NULL,
 };
 
@@ -548,6 +735,82 @@ static struct attribute_group interactive_attr_group = {
 	.name = "interactive",
 };
 
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+		unsigned int type, unsigned int code, int value)
+{
+	if (input_boost && type != EV_SYN)
+		cpufreq_interactive_boost();
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+/* Touchscreens and keys; not sensors, which report all the time. */
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] = BIT_MASK(ABS_X) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static int input_registered;
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		unsigned int event)
 {
@@ -579,6 +842,12 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (rc)
 			return rc;
 
+		/* Boosting is only an optimization; carry on without it. */
+		input_registered = !input_register_handler(
+					&cpufreq_interactive_input_handler);
+		if (!input_registered)
+			pr_warning("cpufreq_interactive: no input boost\n");
+
 		pm_idle_old = pm_idle;
 		pm_idle = cpufreq_interactive_idle;
 		break;
@@ -591,6 +860,9 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
+		if (input_registered)
+			input_unregister_handler(
+				&cpufreq_interactive_input_handler);
 
 		pm_idle = pm_idle_old;
 		del_timer(&pcpu->cpu_timer);
@@ -616,6 +888,9 @@ static int __init cpufreq_interactive_init(void)
 
 	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	go_maxspeed_runnable = DEFAULT_GO_MAXSPEED_RUNNABLE;
+	boostpulse_duration = DEFAULT_BOOSTPULSE_DURATION;
+	input_boost = 1;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -1191,6 +1191,7 @@ static irqreturn_t mxt224_irq_thread(int irq, void *ptr)
 				data->fingers[id].w = msg[5];
 				data->finger_mask |= 1U << id;
 				s5pv310_cpufreq_lock_free(DVFS_LOCK_ID_TSP);
+				s5pv310_hotplug_lock_free(DVFS_LOCK_ID_TSP);
 				touch_is_pressed_arr[msg[0]-2] = 0;
 				lock_status = 0;
 				touch_state = 1;
@@ -1201,6 +1202,7 @@ static irqreturn_t mxt224_irq_thread(int irq, void *ptr)
 
 				if (lock_status == 0) {
 					s5pv310_cpufreq_lock(DVFS_LOCK_ID_TSP, CPU_L3);
+					s5pv310_hotplug_lock(DVFS_LOCK_ID_TSP, 2);
 					lock_status = 1;
 				}
 				if (msg[1] & PRESS_MSG_MASK)
@@ -13,6 +13,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/errno.h>
+#include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/i2c.h>
 #include <linux/mutex.h>
@@ -48,6 +49,15 @@
 
 #include "fimc.h"
 
+/*
+ * With CMA_MIGRATE the free space of the region is lent to the page
+ * allocator, so only hold on to it while the device is open.
+ */
+#if defined(CONFIG_S5P_MEM_CMA) && defined(CONFIG_CMA_MIGRATE) && \
+	!defined(CONFIG_VIDEO_FIMC_UMP_VCM_CMA)
+#define FIMC_CMA_ON_DEMAND
+#endif
+
 char buf[32];
 struct fimc_global *fimc_dev;
 void __iomem			*qos_regs0 , *qos_regs1;
@@ -754,8 +764,12 @@ struct fimc_control *fimc_register_controller(struct platform_device *pdev)
 		return NULL;
 	}
 	ctrl->mem.size = mem_info.total_size;
+#ifdef FIMC_CMA_ON_DEMAND
+	ctrl->mem.base = 0;
+#else
 	ctrl->mem.base = (dma_addr_t)cma_alloc
 		(ctrl->dev, ctrl->cma_name, (size_t)ctrl->mem.size, 0);
+#endif
 	printk(KERN_INFO "ctrl->mem.size = 0x%x\n", ctrl->mem.size);
 	printk(KERN_INFO "ctrl->mem.base = 0x%x\n", ctrl->mem.base);
 #else
@@ -1232,6 +1246,16 @@ static int fimc_open(struct file *filp)
 	}
 
 	if (in_use == 1) {
+#ifdef FIMC_CMA_ON_DEMAND
+		ctrl->mem.base = (dma_addr_t)cma_alloc
+			(ctrl->dev, ctrl->cma_name, (size_t)ctrl->mem.size, 0);
+		if (IS_ERR_VALUE(ctrl->mem.base)) {
+			fimc_err("%s: cma_alloc failed\n", __func__);
+			ret = (int)ctrl->mem.base;
+			ctrl->mem.base = 0;
+			goto cma_err;
+		}
+#endif
 #if (!defined(CONFIG_S5PV310_DEV_PD) || !defined(CONFIG_PM_RUNTIME))
 		if (pdata->clk_on)
 			pdata->clk_on(to_platform_device(ctrl->dev),
@@ -1360,6 +1384,10 @@ static int fimc_open(struct file *filp)
 
 	return 0;
 
+#ifdef FIMC_CMA_ON_DEMAND
+cma_err:
+	kfree(prv_data);
+#endif
 kzalloc_err:
 	atomic_dec(&ctrl->in_use);
 
@@ -1565,6 +1593,14 @@ static int fimc_release(struct file *filp)
 	flush_workqueue(ctrl->fimc_irq_wq);
 #endif
 
+#ifdef FIMC_CMA_ON_DEMAND
+	if (atomic_read(&ctrl->in_use) == 0 && ctrl->mem.base) {
+		cma_free(ctrl->mem.base);
+		ctrl->mem.base = 0;
+		ctrl->mem.curr = 0;
+	}
+#endif
+
 	/*
 	 * Close window for FIMC if window is enabled.
 	 */
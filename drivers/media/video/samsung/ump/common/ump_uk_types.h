@@ -45,6 +45,7 @@ typedef enum
 	_UMP_IOC_MAP_MEM,    /* not used in Linux */
 	_UMP_IOC_UNMAP_MEM,  /* not used in Linux */
 	_UMP_IOC_MSYNC,
+	_UMP_IOC_DMABUF_IMPORT,
 }_ump_uk_functions;
 
 typedef enum
@@ -134,6 +135,17 @@ typedef struct _ump_uk_msync_s
 	u32 is_cached;        /**< [out] caching of CPU mappings */
 } _ump_uk_msync_s;
 
+/**
+ * DMABUF_IMPORT ([in] int fd, [out] u32 secure_id, [out] u32 size)
+ */
+typedef struct _ump_uk_dmabuf_s
+{
+	void *ctx;            /**< [in,out] user-kernel context (trashed on output) */
+	int fd;               /**< [in] shared DMA buffer file descriptor */
+	u32 secure_id;        /**< [out] secure id of the new UMP memory */
+	u32 size;             /**< [out] size of the buffer */
+} _ump_uk_dmabuf_s;
+
 #ifdef __cplusplus
 }
 #endif
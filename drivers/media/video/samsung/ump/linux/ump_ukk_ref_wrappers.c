@@ -21,6 +21,11 @@
 #include "ump_ukk.h"
 #include "ump_kernel_common.h"
 
+#ifdef CONFIG_DMA_SHARED_BUFFER
+#include <linux/dma-buf.h>
+#include "ump_kernel_interface_ref_drv.h"
+#endif
+
 /*
  * IOCTL operation; Allocate UMP memory
  */
@@ -74,3 +79,140 @@ int ump_allocate_wrapper(u32 __user * argument, struct ump_session_data  * sessi
 
 	return 0; /* success */
 }
+
+#ifdef CONFIG_DMA_SHARED_BUFFER
+/*
+ * Release function of UMP memory created from a shared DMA buffer.
+ * The device mapping made at import time is held for the lifetime of
+ * the UMP memory since the GPU may access it at any time.
+ */
+static void ump_dmabuf_release(void * ctx, ump_dd_mem * descriptor)
+{
+	struct dma_buf_attachment *attach = ctx;
+	struct dma_buf *buf = attach->dmabuf;
+
+	dma_buf_unmap_attachment(attach);
+	dma_buf_detach(buf, attach);
+	dma_buf_put(buf);
+
+	_mali_osk_free(descriptor->block_array);
+	descriptor->block_array = NULL;
+}
+
+/*
+ * IOCTL operation; Create UMP memory from a shared DMA buffer
+ */
+int ump_dmabuf_import_wrapper(u32 __user * argument, struct ump_session_data  * session_data)
+{
+	_ump_uk_dmabuf_s user_interaction;
+	ump_session_memory_list_element * session_memory_element;
+	ump_dd_physical_block * blocks;
+	ump_dd_handle handle;
+	ump_dd_mem * mem;
+	struct dma_buf_attachment *attach;
+	struct dma_buf *buf;
+	struct sg_table *sgt;
+	struct scatterlist *sg;
+	unsigned int i;
+	int ret;
+
+	/* Sanity check input parameters */
+	if (NULL == argument || NULL == session_data)
+	{
+		MSG_ERR(("NULL parameter in ump_ioctl_dmabuf_import()\n"));
+		return -ENOTTY;
+	}
+
+	if (0 != copy_from_user(&user_interaction, argument, sizeof(user_interaction)))
+	{
+		MSG_ERR(("copy_from_user() in ump_ioctl_dmabuf_import()\n"));
+		return -EFAULT;
+	}
+
+	buf = dma_buf_get(user_interaction.fd);
+	if (IS_ERR(buf))
+	{
+		DBG_MSG(1, ("Invalid dma-buf fd %d in ump_ioctl_dmabuf_import()\n", user_interaction.fd));
+		return PTR_ERR(buf);
+	}
+
+	attach = dma_buf_attach(buf, NULL);
+	if (IS_ERR(attach))
+	{
+		ret = PTR_ERR(attach);
+		goto err_put;
+	}
+
+	sgt = dma_buf_map_attachment(attach, DMA_BIDIRECTIONAL);
+	if (IS_ERR(sgt))
+	{
+		ret = PTR_ERR(sgt);
+		goto err_detach;
+	}
+
+	session_memory_element = _mali_osk_calloc(1, sizeof(ump_session_memory_list_element));
+	blocks = _mali_osk_malloc(sizeof(*blocks) * sgt->nents);
+	if (NULL == session_memory_element || NULL == blocks)
+	{
+		DBG_MSG(1, ("Failed to allocate memory in ump_ioctl_dmabuf_import()\n"));
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	for_each_sg(sgt->sgl, sg, sgt->nents, i)
+	{
+		blocks[i].addr = sg_dma_address(sg);
+		blocks[i].size = sg_dma_len(sg);
+	}
+
+	/* Validates alignment and copies the blocks */
+	handle = ump_dd_handle_create_from_phys_blocks(blocks, sgt->nents);
+	if (UMP_DD_HANDLE_INVALID == handle)
+	{
+		ret = -EINVAL;
+		goto err_free;
+	}
+	_mali_osk_free(blocks);
+
+	mem = (ump_dd_mem *)handle;
+	mem->ctx = attach;
+	mem->release_func = ump_dmabuf_release;
+
+	session_memory_element->mem = mem;
+	_mali_osk_lock_wait(session_data->lock, _MALI_OSK_LOCKMODE_RW);
+	_mali_osk_list_add(&(session_memory_element->list), &(session_data->list_head_session_memory_list));
+	_mali_osk_lock_signal(session_data->lock, _MALI_OSK_LOCKMODE_RW);
+
+	user_interaction.ctx = NULL;
+	user_interaction.secure_id = mem->secure_id;
+	user_interaction.size = mem->size_bytes;
+
+	if (0 != copy_to_user(argument, &user_interaction, sizeof(user_interaction)))
+	{
+		/* Drops the session reference and with it the dma-buf */
+		_ump_uk_release_s release_args;
+
+		MSG_ERR(("copy_to_user() failed in ump_ioctl_dmabuf_import()\n"));
+
+		release_args.ctx = (void *) session_data;
+		release_args.secure_id = user_interaction.secure_id;
+		_ump_ukk_release( &release_args );
+
+		return -EFAULT;
+	}
+
+	DBG_MSG(3, ("UMP memory imported from dma-buf. ID: %u, size: %lu\n", mem->secure_id, mem->size_bytes));
+
+	return 0; /* success */
+
+err_free:
+	_mali_osk_free(blocks);
+	_mali_osk_free(session_memory_element);
+	dma_buf_unmap_attachment(attach);
+err_detach:
+	dma_buf_detach(buf, attach);
+err_put:
+	dma_buf_put(buf);
+	return ret;
+}
+#endif
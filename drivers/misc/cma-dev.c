@@ -26,6 +26,8 @@
 #include <linux/types.h>       /* Just to be safe ;) */
 #include <linux/uaccess.h>     /* __copy_{to,from}_user */
 #include <linux/miscdevice.h>  /* misc_register() and company */
+#include <linux/file.h>        /* fput() */
+#include <linux/dma-buf.h>     /* dma_buf_export_contig() */
 
 #include <linux/cma.h>
 
@@ -76,6 +78,47 @@ static int  cma_file_release(struct inode *inode, struct file *file)
 }
 
 
+#ifdef CONFIG_DMA_SHARED_BUFFER
+
+static void cma_file_export_release(void *priv)
+{
+	fput(priv);
+}
+
+static long cma_file_export(struct file *file)
+{
+	struct dma_buf *buf;
+	int fd;
+
+	if (!file->private_data)
+		return -EBADFD;
+
+	/* The dma-buf keeps the file, and so the chunk, alive. */
+	get_file(file);
+	buf = dma_buf_export_contig(cma_dev, cma_file_start(file),
+				    cma_file_size(file),
+				    cma_file_export_release, file, "cma");
+	if (IS_ERR(buf)) {
+		fput(file);
+		return PTR_ERR(buf);
+	}
+
+	fd = dma_buf_fd(buf, O_CLOEXEC);
+	if (fd < 0)
+		dma_buf_put(buf);
+	return fd;
+}
+
+#else
+
+static long cma_file_export(struct file *file)
+{
+	return -ENOTTY;
+}
+
+#endif
+
+
 static long cma_file_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 {
 	struct cma_alloc_request req;
@@ -84,6 +127,9 @@ static long cma_file_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 
 	dev_dbg(cma_dev, "%s(%p)\n", __func__, (void *)file);
 
+	if (cmd == IOCTL_CMA_EXPORT)
+		return cma_file_export(file);
+
 	if (cmd != IOCTL_CMA_ALLOC)
 		return -ENOTTY;
 
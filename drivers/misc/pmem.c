@@ -21,6 +21,7 @@
 #include <linux/list.h>
 #include <linux/debugfs.h>
 #include <linux/android_pmem.h>
+#include <linux/dma-buf.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
 #include <asm/io.h>
@@ -1088,6 +1089,39 @@ static void pmem_get_size(struct pmem_region *region, struct file *file)
 	DLOG("offset %lx len %lx\n", region->offset, region->len);
 }
 
+#ifdef CONFIG_DMA_SHARED_BUFFER
+static void pmem_export_release(void *priv)
+{
+	fput(priv);
+}
+
+static int pmem_export(struct file *file)
+{
+	struct pmem_data *data = (struct pmem_data *)file->private_data;
+	int id = get_id(file);
+	struct dma_buf *buf;
+	int fd;
+
+	if (!has_allocation(file))
+		return -EINVAL;
+
+	/* the dma-buf holds the file and with it the allocation */
+	get_file(file);
+	buf = dma_buf_export_contig(pmem[id].dev.this_device,
+				    pmem_start_addr(id, data),
+				    pmem_len(id, data), pmem_export_release,
+				    file, pmem[id].dev.name);
+	if (IS_ERR(buf)) {
+		fput(file);
+		return PTR_ERR(buf);
+	}
+
+	fd = dma_buf_fd(buf, O_CLOEXEC);
+	if (fd < 0)
+		dma_buf_put(buf);
+	return fd;
+}
+#endif
 
 static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
@@ -1178,6 +1212,11 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			flush_pmem_file(file, region.offset, region.len);
 			break;
 		}
+#ifdef CONFIG_DMA_SHARED_BUFFER
+	case PMEM_EXPORT:
+		DLOG("export\n");
+		return pmem_export(file);
+#endif
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
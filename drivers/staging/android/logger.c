@@ -25,6 +25,10 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
+#include <linux/log2.h>
 #include "logger.h"
 /* for DB file corruption debugging
 #include "extendop.h"
@@ -33,12 +37,43 @@
 #include <asm/ioctls.h>
 #include <mach/sec_debug.h>
 
+/*
+ * Size of each per-cpu staging buffer. Must hold at least one maximum-sized
+ * entry; anything that does not fit is written straight into the log.
+ */
+#define LOGGER_STAGE_SIZE	(16*1024)
+
+/* uncompressed size of an archived block, see "The archive" below */
+#define LOGGER_BLOCK_SIZE	(16*1024)
+
+/*
+ * struct logger_stage - per-cpu staging buffer for writers
+ *
+ * Writers append complete entries here under 'mutex', which is only ever
+ * contended by writers running on the same cpu, and never touch the shared
+ * ring. Entries are padded to 4 bytes so the merge step can read the headers
+ * in place. 'snap' and 'pos' belong to the merge step and are protected by
+ * log->mutex.
+ */
+struct logger_stage {
+	struct mutex		mutex;	/* protects buf and len */
+	unsigned char		*buf;	/* staged entries */
+	size_t			len;	/* bytes staged */
+	size_t			snap;	/* bytes being merged */
+	size_t			pos;	/* merge cursor */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
  * mutex 'mutex'.
+ *
+ * Writers normally go through the per-cpu 'stage' buffers and bump 'staged';
+ * whoever holds 'mutex' next merges the staged entries into the ring in
+ * timestamp order. Take and drop 'mutex' with logger_lock()/logger_unlock()
+ * so that staged entries are never left behind.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
@@ -49,6 +84,17 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_stage __percpu *stage; /* per-cpu writer buffers */
+	atomic_t		staged;	/* entries waiting to be merged */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	size_t			archive_size; /* compressed budget, 0 = off */
+	size_t			archive_used; /* compressed bytes archived */
+	size_t			archive_raw; /* uncompressed bytes archived */
+	struct list_head	chunks;	/* archived blocks, oldest first */
+	unsigned long		next_seq; /* block number of 'pending' */
+	unsigned char		*pending; /* block being filled */
+	size_t			pending_len; /* bytes in 'pending' */
+#endif
 };
 
 /*
@@ -61,11 +107,22 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	int			archived; /* reading the archive, not r_off */
+	unsigned long		a_seq;	/* archived block being read */
+	size_t			a_off;	/* offset into that block */
+	unsigned char		*abuf;	/* uncompressed copy of a block */
+	unsigned long		abuf_seq; /* which block is in abuf */
+	int			abuf_valid;
+#endif
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+static void logger_lock(struct logger_log *);
+static void logger_unlock(struct logger_log *);
+
 #ifdef BOOTPARAM_FILEIO
 
 int modify_bootparam()
@@ -182,6 +239,416 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	return count;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+
+/*
+ * The archive
+ *
+ * When the writer laps the oldest entries in the ring, they are not thrown
+ * away but appended to 'pending', a LOGGER_BLOCK_SIZE block. Full blocks are
+ * LZO-compressed into a logger_chunk and kept on log->chunks until the
+ * compressed size of the archive exceeds log->archive_size, at which point the
+ * oldest chunks are dropped. Blocks are numbered; 'pending' is always block
+ * log->next_seq.
+ *
+ * New readers start at the oldest archived entry, and readers that are lapped
+ * by the writer are moved into the archive rather than skipped forward. A
+ * reader in the archive walks the blocks in order, then the pending block, and
+ * then switches to log->head in the ring, which is exactly where the archived
+ * entries left off.
+ */
+
+/*
+ * struct logger_chunk - one archived block
+ *
+ * 'comp_len' is zero if the block did not compress and is stored as is.
+ */
+struct logger_chunk {
+	struct list_head	list;	/* entry in log->chunks */
+	unsigned long		seq;	/* block number */
+	size_t			raw_len; /* uncompressed size */
+	size_t			comp_len; /* compressed size, or zero */
+	unsigned char		data[0];
+};
+
+/* compression scratch space, shared by all logs */
+static DEFINE_MUTEX(logger_lzo_mutex);
+static void *logger_lzo_wrkmem;
+static unsigned char *logger_lzo_buf;
+
+/*
+ * ring_copy - copy 'len' bytes starting at 'off' out of the ring buffer
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void ring_copy(struct logger_log *log, size_t off, void *dst,
+		      size_t len)
+{
+	size_t n = min(len, log->size - off);
+
+	memcpy(dst, log->buffer + off, n);
+	if (len != n)
+		memcpy(dst + n, log->buffer, len - n);
+}
+
+/*
+ * block_entry_len - length of the entry at 'off' in an archived block
+ */
+static inline __u32 block_entry_len(const unsigned char *block, size_t off)
+{
+	__u16 val;
+
+	memcpy(&val, block + off, 2);
+	return sizeof(struct logger_entry) + val;
+}
+
+/*
+ * archive_trim - drop the oldest chunks until the archive fits its budget
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void archive_trim(struct logger_log *log)
+{
+	struct logger_chunk *chunk;
+
+	while (log->archive_used > log->archive_size &&
+	       !list_empty(&log->chunks)) {
+		chunk = list_first_entry(&log->chunks, struct logger_chunk,
+					 list);
+		list_del(&chunk->list);
+		log->archive_used -= chunk->comp_len ?: chunk->raw_len;
+		log->archive_raw -= chunk->raw_len;
+		kfree(chunk);
+	}
+}
+
+/*
+ * archive_flush - compress the pending block onto the chunk list
+ *
+ * If memory is short the block is dropped; readers skip the missing block
+ * number like any other trimmed one.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void archive_flush(struct logger_log *log)
+{
+	struct logger_chunk *chunk;
+	size_t comp_len = 0;
+	const unsigned char *src = log->pending;
+	size_t len = log->pending_len;
+
+	if (!len)
+		return;
+
+	mutex_lock(&logger_lzo_mutex);
+	if (!lzo1x_1_compress(log->pending, log->pending_len, logger_lzo_buf,
+			      &comp_len, logger_lzo_wrkmem) &&
+	    comp_len < log->pending_len) {
+		src = logger_lzo_buf;
+		len = comp_len;
+	} else
+		comp_len = 0;
+
+	chunk = kmalloc(sizeof(*chunk) + len, GFP_KERNEL);
+	if (chunk) {
+		chunk->seq = log->next_seq;
+		chunk->raw_len = log->pending_len;
+		chunk->comp_len = comp_len;
+		memcpy(chunk->data, src, len);
+		list_add_tail(&chunk->list, &log->chunks);
+		log->archive_used += len;
+		log->archive_raw += chunk->raw_len;
+	}
+	mutex_unlock(&logger_lzo_mutex);
+
+	log->next_seq++;
+	log->pending_len = 0;
+	archive_trim(log);
+}
+
+/*
+ * archive_entries - move the entries in [from, to) of the ring into the
+ * archive, taking any reader parked on one of them along
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void archive_entries(struct logger_log *log, size_t from, size_t to)
+{
+	struct logger_reader *reader;
+	size_t off = from;
+
+	while (off != to) {
+		size_t len = get_entry_len(log, off);
+
+		if (log->pending_len + len > LOGGER_BLOCK_SIZE)
+			archive_flush(log);
+
+		list_for_each_entry(reader, &log->readers, list) {
+			if (reader->archived || reader->r_off != off)
+				continue;
+			reader->archived = 1;
+			reader->a_seq = log->next_seq;
+			reader->a_off = log->pending_len;
+		}
+
+		ring_copy(log, off, log->pending + log->pending_len, len);
+		log->pending_len += len;
+		off = logger_offset(off + len);
+	}
+}
+
+/*
+ * archive_reset - throw the whole archive away, for LOGGER_FLUSH_LOG
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void archive_reset(struct logger_log *log)
+{
+	struct logger_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &log->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	log->archive_used = 0;
+	log->archive_raw = 0;
+	log->pending_len = 0;
+	/* invalidate every reader's cached block */
+	log->next_seq++;
+}
+
+/*
+ * reader_sync - settle an archived reader on something it can read
+ *
+ * Skips past trimmed or fully read blocks and moves the reader back to the
+ * ring once it has read everything archived. Returns the chunk the reader is
+ * in, or NULL if it is reading the pending block or the ring.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static struct logger_chunk *reader_sync(struct logger_log *log,
+					struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+
+	while (reader->archived) {
+		if (reader->a_seq == log->next_seq) {
+			if (reader->a_off < log->pending_len)
+				return NULL;
+			reader->archived = 0;
+			reader->r_off = log->head;
+			return NULL;
+		}
+
+		list_for_each_entry(chunk, &log->chunks, list)
+			if (chunk->seq >= reader->a_seq)
+				break;
+
+		if (&chunk->list == &log->chunks) {
+			reader->a_seq = log->next_seq;
+			reader->a_off = 0;
+			continue;
+		}
+		if (chunk->seq != reader->a_seq) {
+			reader->a_seq = chunk->seq;
+			reader->a_off = 0;
+		}
+		if (reader->a_off < chunk->raw_len)
+			return chunk;
+
+		reader->a_seq++;
+		reader->a_off = 0;
+	}
+
+	return NULL;
+}
+
+/*
+ * reader_block - return the uncompressed block an archived reader is in
+ *
+ * Caller needs to hold log->mutex and to have called reader_sync().
+ */
+static unsigned char *reader_block(struct logger_log *log,
+				   struct logger_reader *reader,
+				   struct logger_chunk *chunk)
+{
+	size_t len = LOGGER_BLOCK_SIZE;
+
+	if (!chunk)
+		return log->pending;
+
+	if (reader->abuf_seq == chunk->seq && reader->abuf_valid)
+		return reader->abuf;
+
+	if (!reader->abuf) {
+		reader->abuf = kmalloc(LOGGER_BLOCK_SIZE, GFP_KERNEL);
+		if (!reader->abuf)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	reader->abuf_valid = 0;
+	if (!chunk->comp_len)
+		memcpy(reader->abuf, chunk->data, chunk->raw_len);
+	else if (lzo1x_decompress_safe(chunk->data, chunk->comp_len,
+				       reader->abuf, &len) != LZO_E_OK ||
+		 len != chunk->raw_len)
+		return ERR_PTR(-EIO);
+
+	reader->abuf_seq = chunk->seq;
+	reader->abuf_valid = 1;
+
+	return reader->abuf;
+}
+
+/*
+ * reader_empty - is there nothing for 'reader' to read?
+ *
+ * Caller needs to hold log->mutex.
+ */
+static int reader_empty(struct logger_log *log, struct logger_reader *reader)
+{
+	reader_sync(log, reader);
+	return !reader->archived && log->w_off == reader->r_off;
+}
+
+/*
+ * reader_archive_len - number of archived bytes left for 'reader'
+ *
+ * Caller needs to hold log->mutex.
+ */
+static size_t reader_archive_len(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	struct logger_chunk *chunk = reader_sync(log, reader);
+	size_t ret;
+
+	if (!reader->archived)
+		return 0;
+	if (!chunk)
+		return log->pending_len - reader->a_off;
+
+	ret = chunk->raw_len - reader->a_off + log->pending_len;
+	list_for_each_entry_continue(chunk, &log->chunks, list)
+		ret += chunk->raw_len;
+
+	return ret;
+}
+
+/*
+ * reader_archive_entry_len - length of the next archived entry for 'reader',
+ * zero if it is reading the ring
+ *
+ * Caller needs to hold log->mutex.
+ */
+static ssize_t reader_archive_entry_len(struct logger_log *log,
+					struct logger_reader *reader)
+{
+	struct logger_chunk *chunk = reader_sync(log, reader);
+	unsigned char *block;
+
+	if (!reader->archived)
+		return 0;
+
+	block = reader_block(log, reader, chunk);
+	if (IS_ERR(block))
+		return PTR_ERR(block);
+
+	return block_entry_len(block, reader->a_off);
+}
+
+/*
+ * read_archive_to_user - read the next archived entry into 'buf'
+ *
+ * Caller needs to hold log->mutex and to have checked reader->archived
+ * after reader_sync().
+ */
+static ssize_t read_archive_to_user(struct logger_log *log,
+				    struct logger_reader *reader,
+				    char __user *buf, size_t count)
+{
+	struct logger_chunk *chunk = reader_sync(log, reader);
+	unsigned char *block;
+	size_t len;
+
+	block = reader_block(log, reader, chunk);
+	if (IS_ERR(block))
+		return PTR_ERR(block);
+
+	len = block_entry_len(block, reader->a_off);
+	if (count < len)
+		return -EINVAL;
+
+	if (copy_to_user(buf, block + reader->a_off, len))
+		return -EFAULT;
+
+	reader->a_off += len;
+
+	return len;
+}
+
+/*
+ * reader_init_archive - start a new reader at the oldest archived entry
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void reader_init_archive(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	reader->abuf = NULL;
+	reader->abuf_valid = 0;
+	reader->a_off = 0;
+	if (!list_empty(&log->chunks)) {
+		reader->archived = 1;
+		reader->a_seq = list_first_entry(&log->chunks,
+						 struct logger_chunk,
+						 list)->seq;
+	} else {
+		reader->archived = log->pending_len != 0;
+		reader->a_seq = log->next_seq;
+	}
+}
+
+static int __init init_log_archive(struct logger_log *log)
+{
+	if (!log->archive_size)
+		return 0;
+
+	if (!logger_lzo_wrkmem) {
+		logger_lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+		logger_lzo_buf = kmalloc(lzo1x_worst_compress(LOGGER_BLOCK_SIZE),
+					 GFP_KERNEL);
+		if (!logger_lzo_wrkmem || !logger_lzo_buf) {
+			vfree(logger_lzo_wrkmem);
+			kfree(logger_lzo_buf);
+			logger_lzo_wrkmem = NULL;
+			logger_lzo_buf = NULL;
+			goto fail;
+		}
+	}
+
+	log->pending = kmalloc(LOGGER_BLOCK_SIZE, GFP_KERNEL);
+	if (!log->pending)
+		goto fail;
+
+	return 0;
+
+fail:
+	printk(KERN_WARNING "logger: no archive for log '%s'\n",
+	       log->misc.name);
+	log->archive_size = 0;
+	return -ENOMEM;
+}
+
+#else
+
+static inline int reader_empty(struct logger_log *log,
+			       struct logger_reader *reader)
+{
+	return log->w_off == reader->r_off;
+}
+
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
+
 /*
  * logger_read - our log's read() method
  *
@@ -206,9 +673,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		logger_lock(log);
+		ret = reader_empty(log, reader);
+		logger_unlock(log);
 		if (!ret)
 			break;
 
@@ -229,14 +696,21 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	logger_lock(log);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(reader_empty(log, reader))) {
+		logger_unlock(log);
 		goto start;
 	}
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	if (reader->archived) {
+		ret = read_archive_to_user(log, reader, buf, count);
+		goto out;
+	}
+#endif
+
 	/* get the size of the next entry */
 	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
@@ -248,7 +722,7 @@ start:
 	ret = do_read_log_to_user(log, reader, buf, ret);
 
 out:
-	mutex_unlock(&log->mutex);
+	logger_unlock(log);
 
 	return ret;
 }
@@ -293,7 +767,9 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * fix_up_readers - walk the list of all readers and "fix up" any who were
  * lapped by the writer; also do the same for the default "start head".
  * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * entry after the new write head. If the log has an archive, the entries
+ * about to be overwritten, and any readers sitting on them, move into the
+ * archive instead.
  *
  * The caller needs to hold log->mutex.
  */
@@ -303,12 +779,25 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (clock_interval(old, new, log->head)) {
+		size_t next = get_next_entry(log, log->head, len);
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		/* every lapped reader is parked in [head, next) */
+		if (log->archive_size)
+			archive_entries(log, log->head, next);
+#endif
+		log->head = next;
+	}
 
-	list_for_each_entry(reader, &log->readers, list)
+	list_for_each_entry(reader, &log->readers, list) {
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		if (reader->archived)
+			continue;
+#endif
 		if (clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+	}
 }
 
 /*
@@ -330,6 +819,37 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
+/*
+ * logger_print_kmsg - echo a "!@" tagged log string to the kernel log
+ *
+ * 'tmp' holds the first 'n' of the string's 'count' bytes, NUL terminated.
+ */
+static void logger_print_kmsg(const char *tmp, size_t n, size_t count)
+{
+#ifdef BOOTPARAM_FILEIO
+	int matching = 0;
+	char *log_ch = STOP_LOG;
+	int i;
+
+	/* if log string is special, set a flag */
+	for (i = 0; i < n && i < STOP_LOG_LEN + 1; i++)
+		if (matching == i && tmp[i] == *(log_ch + i))
+			matching++;
+#endif
+
+	printk("%s\n", tmp);
+#ifdef BOOTPARAM_FILEIO
+	if (matching == STOP_LOG_LEN + 1) // + 1 for NULL
+	{
+		printk("got an only-kernel-boot log!!\n");
+		if (modify_bootparam() < 0)
+			printk("modifying file error - boot param\n");
+		BUG(); /* to prevent writing /data partition */
+	}
+	printk("count : %d, matching : %d\n", count, matching);
+#endif
+}
+
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
  * the log 'log'
@@ -342,10 +862,6 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
-#ifdef BOOTPARAM_FILEIO
-	int matching = 0;
-	char *log_ch = STOP_LOG;
-#endif
 
 	len = min(count, log->size - log->w_off);
 	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
@@ -362,27 +878,10 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 			char tmp[256];
 			int i;
 			for (i = 0; i < min(count, sizeof(tmp) - 1); i++)
-			{
 				tmp[i] =
 				    log->buffer[logger_offset(log->w_off + i)];
-#ifdef BOOTPARAM_FILEIO
-				/* if log string is special, set a flag */
-				if (matching == i && i < STOP_LOG_LEN + 1 && tmp[i] == *(log_ch + i))
-					matching++;
-#endif
-			}
 			tmp[i] = '\0';
-			printk("%s\n", tmp);
-#ifdef BOOTPARAM_FILEIO
-			if (matching == STOP_LOG_LEN + 1) // + 1 for NULL
-			{
-				printk("got an only-kernel-boot log!!\n");
-				if (modify_bootparam() < 0)
-					printk("modifying file error - boot param\n");
-				BUG(); /* to prevent writing /data partition */
-			}
-			printk("count : %d, matching : %d\n", count, matching);
-#endif
+			logger_print_kmsg(tmp, i, count);
 		}
 	}
 	log->w_off = logger_offset(log->w_off + count);
@@ -391,32 +890,130 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
 }
 
 /*
- * logger_aio_write - our write method, implementing support for write(),
- * writev(), and aio_write(). Writes are our fast path, and we try to optimize
- * them above all else.
+ * entry_before - does entry 'a' carry an earlier timestamp than entry 'b'?
  */
-ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
-			 unsigned long nr_segs, loff_t ppos)
+static inline int entry_before(const struct logger_entry *a,
+			       const struct logger_entry *b)
 {
-	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
-	struct timespec now;
-	ssize_t ret = 0;
+	if (a->sec != b->sec)
+		return a->sec < b->sec;
+	return a->nsec < b->nsec;
+}
 
-	now = current_kernel_time();
+/*
+ * logger_merge - move every staged entry into the ring buffer, oldest first
+ *
+ * Each cpu's staging buffer is already in timestamp order, so this is a
+ * simple k-way merge. Only the entries present when we start are merged;
+ * writers keep appending behind them while we run and are picked up by the
+ * next merge.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_merge(struct logger_log *log)
+{
+	struct logger_stage *stage, *best;
+	struct logger_entry *entry, *best_entry;
+	int merged = 0;
+	int cpu;
+
+	if (!log->stage)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		mutex_lock(&stage->mutex);
+		stage->snap = stage->len;
+		mutex_unlock(&stage->mutex);
+		stage->pos = 0;
+	}
 
-	header.pid = current->tgid;
-	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
-	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	while (1) {
+		best = NULL;
+		best_entry = NULL;
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stage, cpu);
+			if (stage->pos == stage->snap)
+				continue;
+			entry = (struct logger_entry *)(stage->buf + stage->pos);
+			if (!best || entry_before(entry, best_entry)) {
+				best = stage;
+				best_entry = entry;
+			}
+		}
+		if (!best)
+			break;
 
-	/* null writes succeed, return zero */
-	if (unlikely(!header.len))
-		return 0;
+		fix_up_readers(log, sizeof(struct logger_entry) +
+			       best_entry->len);
+		do_write_log(log, best_entry,
+			     sizeof(struct logger_entry) + best_entry->len);
+		best->pos += ALIGN(sizeof(struct logger_entry) +
+				   best_entry->len, 4);
+		merged = 1;
+	}
 
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		if (!stage->snap)
+			continue;
+		mutex_lock(&stage->mutex);
+		memmove(stage->buf, stage->buf + stage->snap,
+			stage->len - stage->snap);
+		stage->len -= stage->snap;
+		mutex_unlock(&stage->mutex);
+		stage->snap = 0;
+	}
+
+	/* wake up any blocked readers */
+	if (merged)
+		wake_up_interruptible(&log->wq);
+}
+
+/*
+ * logger_publish - merge staged entries unless someone else holds the log
+ *
+ * Writers never block on log->mutex. If the trylock fails, the current holder
+ * will see 'staged' once it drops the mutex in logger_unlock() and do the
+ * merge for us.
+ */
+static void logger_publish(struct logger_log *log)
+{
+	while (atomic_read(&log->staged) && mutex_trylock(&log->mutex)) {
+		if (atomic_xchg(&log->staged, 0))
+			logger_merge(log);
+		mutex_unlock(&log->mutex);
+		smp_mb();
+	}
+}
+
+static void logger_lock(struct logger_log *log)
+{
 	mutex_lock(&log->mutex);
+	if (atomic_xchg(&log->staged, 0))
+		logger_merge(log);
+}
+
+static void logger_unlock(struct logger_log *log)
+{
+	mutex_unlock(&log->mutex);
+	/* pairs with the barrier after atomic_inc() in logger_stage_write() */
+	smp_mb();
+	logger_publish(log);
+}
+
+/*
+ * logger_write_direct - write one entry straight into the ring buffer
+ *
+ * The caller needs to hold log->mutex.
+ */
+static ssize_t logger_write_direct(struct logger_log *log,
+				   struct logger_entry *header,
+				   const struct iovec *iov,
+				   unsigned long nr_segs)
+{
+	size_t orig = log->w_off;
+	ssize_t ret = 0;
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -424,22 +1021,21 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	 * because if we partially fail, we can end up with clobbered log
 	 * entries that encroach on readable buffer.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	fix_up_readers(log, sizeof(struct logger_entry) + header->len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, header, sizeof(struct logger_entry));
 
 	while (nr_segs-- > 0) {
 		size_t len;
 		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		len = min_t(size_t, iov->iov_len, header->len - ret);
 
 		/* write out this segment's payload */
 		nr = do_write_log_from_user(log, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
 			log->w_off = orig;
-			mutex_unlock(&log->mutex);
 			return nr;
 		}
 
@@ -447,14 +1043,135 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
 	return ret;
 }
 
+/*
+ * logger_stage_write - append one entry to this cpu's staging buffer
+ *
+ * Returns the payload length on success, negative error code on failure, or
+ * -ENOSPC if the staging buffer is full and the caller has to write the
+ * entry directly.
+ */
+static ssize_t logger_stage_write(struct logger_log *log,
+				  struct logger_entry *header,
+				  const struct iovec *iov,
+				  unsigned long nr_segs)
+{
+	struct logger_stage *stage;
+	size_t entry_len = ALIGN(sizeof(struct logger_entry) + header->len, 4);
+	struct timespec now;
+	size_t off;
+	ssize_t ret = 0;
+
+	/* being migrated after this only costs us some cache locality */
+	stage = per_cpu_ptr(log->stage, raw_smp_processor_id());
+
+	mutex_lock(&stage->mutex);
+
+	if (stage->len + entry_len > LOGGER_STAGE_SIZE) {
+		mutex_unlock(&stage->mutex);
+		return -ENOSPC;
+	}
+
+	/* stamp under the lock so each staging buffer stays time ordered */
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+
+	off = stage->len;
+	memcpy(stage->buf + off, header, sizeof(struct logger_entry));
+	off += sizeof(struct logger_entry);
+
+	while (nr_segs-- > 0) {
+		size_t len;
+
+		/* figure out how much of this vector we can keep */
+		len = min_t(size_t, iov->iov_len, header->len - ret);
+
+		if (len && copy_from_user(stage->buf + off, iov->iov_base,
+					  len)) {
+			mutex_unlock(&stage->mutex);
+			return -EFAULT;
+		}
+
+		/* print as kernel log if the log string starts with "!@" */
+		if (len >= 2 && stage->buf[off] == '!' &&
+		    stage->buf[off + 1] == '@') {
+			char tmp[256];
+			size_t n = min(len, sizeof(tmp) - 1);
+
+			memcpy(tmp, stage->buf + off, n);
+			tmp[n] = '\0';
+			logger_print_kmsg(tmp, n, len);
+		}
+
+		off += len;
+		iov++;
+		ret += len;
+	}
+
+	stage->len += entry_len;
+	mutex_unlock(&stage->mutex);
+
+	atomic_inc(&log->staged);
+	/* pairs with the barrier after mutex_unlock() in logger_unlock() */
+	smp_mb__after_atomic_inc();
+
+	return ret;
+}
+
+/*
+ * logger_aio_write - our write method, implementing support for write(),
+ * writev(), and aio_write(). Writes are our fast path, and we try to optimize
+ * them above all else.
+ *
+ * Entries are staged per cpu and merged into the ring by whoever can take
+ * log->mutex without waiting, so concurrent writers do not serialize on it.
+ */
+ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
+			 unsigned long nr_segs, loff_t ppos)
+{
+	struct logger_log *log = file_get_log(iocb->ki_filp);
+	struct logger_entry header;
+	struct timespec now;
+	ssize_t ret;
+
+	header.pid = current->tgid;
+	header.tid = current->pid;
+	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
+
+	/* null writes succeed, return zero */
+	if (unlikely(!header.len))
+		return 0;
+
+	if (likely(log->stage)) {
+		ret = logger_stage_write(log, &header, iov, nr_segs);
+		if (likely(ret != -ENOSPC)) {
+			if (ret >= 0)
+				logger_publish(log);
+			return ret;
+		}
+	}
+
+	/*
+	 * No staging buffers or ours is full: merge what is staged and write
+	 * this entry after it.
+	 */
+	logger_lock(log);
+	now = current_kernel_time();
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	ret = logger_write_direct(log, &header, iov, nr_segs);
+	logger_unlock(log);
+
+	return ret;
+}
+
 static struct logger_log *get_log_from_minor(int);
 
 /*
@@ -485,10 +1202,13 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
 
-		mutex_lock(&log->mutex);
+		logger_lock(log);
 		reader->r_off = log->head;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		reader_init_archive(log, reader);
+#endif
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		logger_unlock(log);
 
 		file->private_data = reader;
 	} else
@@ -509,9 +1229,12 @@ static int logger_release(struct inode *inode, struct file *file)
 		struct logger_log *log;
 		unsigned long start = jiffies;
 		log = get_log_from_minor(MINOR(inode->i_rdev));
-		mutex_lock(&log->mutex);
+		logger_lock(log);
 		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
+		logger_unlock(log);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		kfree(reader->abuf);
+#endif
 		kfree(reader);
 		pr_info("%s: took %d msec\n", __func__, jiffies_to_msecs(jiffies - start));
 	}
@@ -542,10 +1265,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	logger_lock(log);
+	if (!reader_empty(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	logger_unlock(log);
 
 	return ret;
 }
@@ -556,7 +1279,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	logger_lock(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -568,6 +1291,20 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		if (reader->archived) {
+			ret = reader_archive_len(log, reader);
+			if (reader->archived) {
+				/* plus the whole ring */
+				if (log->w_off >= log->head)
+					ret += log->w_off - log->head;
+				else
+					ret += (log->size - log->head) +
+						log->w_off;
+				break;
+			}
+		}
+#endif
 		if (log->w_off >= reader->r_off)
 			ret = log->w_off - reader->r_off;
 		else
@@ -579,6 +1316,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		ret = reader_archive_entry_len(log, reader);
+		if (ret)
+			break;
+#endif
 		if (log->w_off != reader->r_off)
 			ret = get_entry_len(log, reader->r_off);
 		else
@@ -589,6 +1331,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		archive_reset(log);
+		list_for_each_entry(reader, &log->readers, list)
+			reader->archived = 0;
+#endif
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
@@ -596,7 +1343,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	logger_unlock(log);
 
 	return ret;
 }
@@ -613,14 +1360,51 @@ static const struct file_operations logger_fops = {
 };
 
 /*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * logger_set_size/logger_get_size - size parameters, in bytes, accepting the
+ * usual K/M/G suffixes
  */
-#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static int logger_set_size(const char *val, struct kernel_param *kp)
+{
+	char *end;
+	unsigned long long size;
+
+	size = memparse(val, &end);
+	if (*end && *end != '\n')
+		return -EINVAL;
+
+	*(size_t *)kp->arg = size;
+	return 0;
+}
+
+static int logger_get_size(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "%zu", *(size_t *)kp->arg);
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+#define LOGGER_ARCHIVE_INIT(VAR, ARCHIVE) \
+	.archive_size = ARCHIVE, \
+	.chunks = LIST_HEAD_INIT(VAR .chunks),
+#define LOGGER_ARCHIVE_PARAM(VAR) \
+module_param_call(VAR ## _archive, logger_set_size, logger_get_size, \
+		  &VAR .archive_size, S_IRUGO);
+#else
+#define LOGGER_ARCHIVE_INIT(VAR, ARCHIVE)
+#define LOGGER_ARCHIVE_PARAM(VAR)
+#endif
+
+/*
+ * Defines a log structure with name 'NAME', a ring buffer of 'SIZE' bytes
+ * and, with CONFIG_ANDROID_LOGGER_COMPRESS, an archive of up to 'ARCHIVE'
+ * compressed bytes.
+ *
+ * Both can be overridden on the kernel command line, as logger.VAR_size=
+ * and logger.VAR_archive=. The ring size is rounded up to a power of two of
+ * at least twice LOGGER_ENTRY_MAX_LEN when the log is created; it must stay
+ * below LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ */
+#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE, ARCHIVE) \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -633,12 +1417,25 @@ static struct logger_log VAR = { \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
-};
-
-DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 512*1024)
-DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024)
-DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 256*1024)
-DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 256*1024)
+	.staged = ATOMIC_INIT(0), \
+	LOGGER_ARCHIVE_INIT(VAR, ARCHIVE) \
+}; \
+module_param_call(VAR ## _size, logger_set_size, logger_get_size, \
+		  &VAR .size, S_IRUGO); \
+LOGGER_ARCHIVE_PARAM(VAR)
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/* the same memory as the plain logs, most of it holding compressed history */
+DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 64*1024, 448*1024)
+DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 64*1024, 192*1024)
+DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 64*1024, 192*1024)
+DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 64*1024, 192*1024)
+#else
+DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 512*1024, 0)
+DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024, 0)
+DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 256*1024, 0)
+DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 256*1024, 0)
+#endif
 
 static struct logger_log *get_log_from_minor(int minor)
 {
@@ -653,10 +1450,64 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * init_log_stages - allocate the per-cpu staging buffers for 'log'
+ *
+ * On failure the log keeps working, with every write going straight into
+ * the ring buffer under log->mutex.
+ */
+static void __init init_log_stages(struct logger_log *log)
+{
+	struct logger_stage *stage;
+	int cpu;
+
+	log->stage = alloc_percpu(struct logger_stage);
+	if (!log->stage)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		mutex_init(&stage->mutex);
+		stage->buf = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!stage->buf)
+			goto fail_free;
+	}
+
+	return;
+
+fail_free:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stage, cpu)->buf);
+	free_percpu(log->stage);
+	log->stage = NULL;
+fail:
+	printk(KERN_WARNING "logger: no per-cpu buffers for log '%s'\n",
+	       log->misc.name);
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/*
+	 * kmalloc rather than vmalloc: the ring has to be physically
+	 * contiguous for the GetLog dump tool.
+	 */
+	log->size = roundup_pow_of_two(max_t(size_t, log->size,
+					     2 * LOGGER_ENTRY_MAX_LEN));
+	log->buffer = kzalloc(log->size, GFP_KERNEL);
+	if (!log->buffer) {
+		printk(KERN_ERR "logger: failed to allocate %luK for log "
+		       "'%s'!\n", (unsigned long) log->size >> 10,
+		       log->misc.name);
+		return -ENOMEM;
+	}
+
+	init_log_stages(log);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	init_log_archive(log);
+#endif
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -666,6 +1517,12 @@ static int __init init_log(struct logger_log *log)
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	if (log->archive_size)
+		printk(KERN_INFO "logger: up to %luK compressed history for "
+		       "'%s'\n", (unsigned long) log->archive_size >> 10,
+		       log->misc.name);
+#endif
 
 	return 0;
 }
@@ -690,8 +1547,8 @@ static int __init logger_init(void)
 	if (unlikely(ret))
 		goto out;
 
-	sec_getlog_supply_loggerinfo(_buf_log_main, _buf_log_radio,
-				     _buf_log_events, _buf_log_system);
+	sec_getlog_supply_loggerinfo(log_main.buffer, log_radio.buffer,
+				     log_events.buffer, log_system.buffer);
 out:
 	return ret;
 }
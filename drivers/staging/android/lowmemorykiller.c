@@ -16,6 +16,19 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in one list per oom_adj value, updated on fork, exec,
+ * exit and oom_adj writes, so picking a victim only looks at the processes
+ * in the highest populated oom_adj bucket instead of walking every task.
+ *
+ * Before anything is killed, /dev/memory_pressure reports graded pressure
+ * levels (see lowmemorykiller.h) computed from the same minfree thresholds
+ * and from how efficiently page reclaim is working, so that user-space can
+ * drop caches first. Readers see LOW while free memory is within
+ * /sys/module/lowmemorykiller/parameters/notify_margin percent above the
+ * largest minfree, of MEDIUM below it and of CRITICAL below any smaller one.
+ * If fewer than notify_efficiency percent of the pages scanned by reclaim
+ * were freed, the level is raised by one.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +48,16 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/vmstat.h>
+#include <linux/swap.h>
+#include "lowmemorykiller.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +78,95 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * lowmem_buckets - thread group leaders by oom_adj, OOM_DISABLE first
+ *
+ * Protected by lowmem_bucket_lock. Until lowmem_init has run the buckets are
+ * not set up and the hooks below do nothing; lowmem_init then adds every
+ * process that already exists.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct list_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+static int lowmem_buckets_ready;
+
+static inline struct list_head *lowmem_bucket(int oom_adj)
+{
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+/* Caller must hold lowmem_bucket_lock. */
+static void __lowmem_task_add(struct task_struct *p)
+{
+	if (list_empty(&p->lowmem_node))
+		list_add_tail(&p->lowmem_node,
+			      lowmem_bucket(p->signal->oom_adj));
+}
+
+/*
+ * lowmem_task_add - 'p' has just become a thread group leader
+ */
+void lowmem_task_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_bucket_lock);
+	if (lowmem_buckets_ready)
+		__lowmem_task_add(p);
+	spin_unlock(&lowmem_bucket_lock);
+}
+
+/*
+ * lowmem_task_del - 'p' is being released
+ *
+ * Only a task's own fork or exec adds it, and neither can race with its
+ * release, so an empty node can be checked without the lock.
+ */
+void lowmem_task_del(struct task_struct *p)
+{
+	if (list_empty(&p->lowmem_node))
+		return;
+
+	spin_lock(&lowmem_bucket_lock);
+	list_del_init(&p->lowmem_node);
+	spin_unlock(&lowmem_bucket_lock);
+}
+
+/*
+ * lowmem_task_adj_changed - the oom_adj of the thread group of 'p' changed
+ */
+void lowmem_task_adj_changed(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	rcu_read_lock();
+	spin_lock(&lowmem_bucket_lock);
+	leader = p->group_leader;
+	if (!list_empty(&leader->lowmem_node))
+		list_move_tail(&leader->lowmem_node,
+			       lowmem_bucket(leader->signal->oom_adj));
+	spin_unlock(&lowmem_bucket_lock);
+	rcu_read_unlock();
+}
+
+static int lowmem_notify_margin = 25;
+static int lowmem_notify_efficiency = 25;
+
+/* Current pressure level; bumping lowmem_pressure_seq wakes the readers */
+static int lowmem_pressure;
+static unsigned int lowmem_pressure_seq;
+static int lowmem_reclaim_struggling;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_pressure_work, lowmem_pressure_fn);
+
+/* How often the pressure level is re-evaluated while memory is tight */
+#define LOWMEM_PRESSURE_INTERVAL	(HZ / 2)
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -79,6 +191,121 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+static inline int lowmem_array_size(void)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	return array_size;
+}
+
+/*
+ * lowmem_free_level - pressure level for the given amount of free memory,
+ * using the same test as the killer
+ */
+static int lowmem_free_level(int other_free, int other_file)
+{
+	int array_size = lowmem_array_size();
+	size_t margin;
+	int i;
+
+	if (!array_size)
+		return LOWMEM_PRESSURE_NONE;
+
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i])
+			break;
+	}
+	if (i < array_size - 1)
+		return LOWMEM_PRESSURE_CRITICAL;
+	if (i == array_size - 1)
+		return LOWMEM_PRESSURE_MEDIUM;
+
+	margin = lowmem_minfree[array_size - 1];
+	margin += margin * lowmem_notify_margin / 100;
+	if (other_free < margin && other_file < margin)
+		return LOWMEM_PRESSURE_LOW;
+
+	return LOWMEM_PRESSURE_NONE;
+}
+
+static void lowmem_update_pressure(int other_free, int other_file)
+{
+	int level = lowmem_free_level(other_free, other_file);
+
+	if (lowmem_reclaim_struggling && level < LOWMEM_PRESSURE_CRITICAL)
+		level++;
+
+	spin_lock(&lowmem_pressure_lock);
+	if (level != lowmem_pressure) {
+		lowmem_print(3, "memory pressure %d -> %d\n",
+			     lowmem_pressure, level);
+		lowmem_pressure = level;
+		lowmem_pressure_seq++;
+		wake_up_interruptible(&lowmem_pressure_wait);
+	}
+	spin_unlock(&lowmem_pressure_lock);
+
+	/* keep re-evaluating while there is pressure, so it can drop again */
+	if (level != LOWMEM_PRESSURE_NONE)
+		schedule_delayed_work(&lowmem_pressure_work,
+				      LOWMEM_PRESSURE_INTERVAL);
+}
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/*
+ * lowmem_sample_reclaim - is reclaim freeing too few of the pages it scans?
+ *
+ * Looks at the scan and steal counters since the previous sample. Called
+ * from the pressure work only, as gathering the counters may sleep.
+ */
+static int lowmem_sample_reclaim(void)
+{
+	static unsigned long last_scanned, last_stolen;
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	unsigned long scanned = 0, stolen = 0;
+	unsigned long d_scanned, d_stolen;
+	int i;
+
+	all_vm_events(events);
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		stolen += events[PGSTEAL_NORMAL - ZONE_NORMAL + i];
+		scanned += events[PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL + i] +
+			events[PGSCAN_DIRECT_NORMAL - ZONE_NORMAL + i];
+	}
+
+	d_scanned = scanned - last_scanned;
+	d_stolen = stolen - last_stolen;
+	last_scanned = scanned;
+	last_stolen = stolen;
+
+	/* too little scanning to say anything */
+	if (d_scanned < SWAP_CLUSTER_MAX * 4)
+		return 0;
+
+	return d_stolen * 100 < d_scanned * lowmem_notify_efficiency;
+}
+#else
+static inline int lowmem_sample_reclaim(void)
+{
+	return 0;
+}
+#endif
+
+static void lowmem_pressure_fn(struct work_struct *work)
+{
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES) -
+		global_page_state(NR_SHMEM);
+
+	lowmem_reclaim_struggling = lowmem_sample_reclaim();
+	lowmem_update_pressure(other_free, other_file);
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -89,11 +316,14 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int array_size = lowmem_array_size();
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 		global_page_state(NR_SHMEM);
 
+	/* we are in reclaim: tell user-space before killing anything */
+	lowmem_update_pressure(other_free, other_file);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -105,10 +335,6 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
@@ -135,57 +361,138 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	}
 	selected_oom_adj = min_adj;
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	/*
+	 * Walk the buckets from the highest oom_adj down and stop at the first
+	 * one holding a killable process; within it, pick the largest.
+	 */
+	spin_lock(&lowmem_bucket_lock);
+	for (i = OOM_ADJUST_MAX; i >= min_adj && !selected; i--) {
+		list_for_each_entry(p, lowmem_bucket(i), lowmem_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = i;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, i, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock(&lowmem_bucket_lock);
+
 	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		/*
+		 * The bucket lock is dropped, so the task may have gone
+		 * through __exit_signal() since it was picked; send_sig()
+		 * takes its sighand lock and fails if it is gone.  SIGKILL
+		 * can be neither blocked nor ignored, so there is nothing
+		 * to force.
+		 */
+		if (!send_sig(SIGKILL, selected, 0)) {
+			lowmem_print(1, "send sigkill to %d (%s), adj %d, "
+				     "size %d\n", selected->pid,
+				     selected->comm, selected_oom_adj,
+				     selected_tasksize);
+			lowmem_deathpending = selected;
+			lowmem_deathpending_timeout = jiffies + HZ;
+			rem -= selected_tasksize;
+		} else {
+			lowmem_print(2, "%d (%s) exited before the kill\n",
+				     selected->pid, selected->comm);
+		}
+		put_task_struct(selected);
 	} else
 		rem = -1;
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
+/*
+ * /dev/memory_pressure - each open file remembers the last level it read in
+ * file->private_data, as a pressure sequence number.
+ */
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	/* make the first read return straight away */
+	spin_lock(&lowmem_pressure_lock);
+	file->private_data = (void *)(unsigned long)(lowmem_pressure_seq - 1);
+	spin_unlock(&lowmem_pressure_lock);
+
+	return nonseekable_open(inode, file);
+}
+
+static inline int lowmem_pressure_changed(struct file *file)
+{
+	return (unsigned int)(unsigned long)file->private_data !=
+		ACCESS_ONCE(lowmem_pressure_seq);
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	int level;
+	int ret;
+
+	if (count < sizeof(level))
+		return -EINVAL;
+
+	if (!lowmem_pressure_changed(file)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+					       lowmem_pressure_changed(file));
+		if (ret)
+			return ret;
+	}
+
+	spin_lock(&lowmem_pressure_lock);
+	level = lowmem_pressure;
+	file->private_data = (void *)(unsigned long)lowmem_pressure_seq;
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (copy_to_user(buf, &level, sizeof(level)))
+		return -EFAULT;
+
+	return sizeof(level);
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_pressure_wait, wait);
+
+	if (lowmem_pressure_changed(file))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "memory_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -193,13 +500,37 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+
+	/*
+	 * Holding tasklist_lock keeps new processes from being missed: a
+	 * fork either is on the task list already or will add itself once
+	 * lowmem_buckets_ready is set.
+	 */
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_bucket_lock);
+	lowmem_buckets_ready = 1;
+	for_each_process(p)
+		__lowmem_task_add(p);
+	spin_unlock(&lowmem_bucket_lock);
+	read_unlock(&tasklist_lock);
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "memory_pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_pressure_misc);
+	cancel_delayed_work_sync(&lowmem_pressure_work);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -210,6 +541,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_margin, lowmem_notify_margin, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(notify_efficiency, lowmem_notify_efficiency, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_level, lowmem_pressure, int, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,29 @@
+/* drivers/staging/android/lowmemorykiller.h
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_LOWMEMORYKILLER_H
+#define _LINUX_LOWMEMORYKILLER_H
+
+/*
+ * Memory pressure levels reported by /dev/memory_pressure. Each read()
+ * returns the current level as an int; after the first read, read() blocks
+ * and poll() stays quiet until the level changes.
+ */
+#define LOWMEM_PRESSURE_NONE		0
+#define LOWMEM_PRESSURE_LOW		1	/* nearing the kill thresholds */
+#define LOWMEM_PRESSURE_MEDIUM		2	/* cached processes being killed */
+#define LOWMEM_PRESSURE_CRITICAL	3	/* visible processes at risk */
+
+#endif /* _LINUX_LOWMEMORYKILLER_H */
@@ -21,10 +21,13 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -35,6 +38,7 @@
 /* Globals */
 static int ramzswap_major;
 static struct ramzswap *devices;
+static struct workqueue_struct *rzs_wb_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
@@ -115,6 +119,13 @@ static void setup_swap_header(struct ramzswap *rzs, union swap_header *s)
 	memcpy(s->magic.magic, "SWAPSPACE2", 10);
 }
 
+static void ramzswap_set_default_compressor(struct ramzswap *rzs)
+{
+	memset(rzs->compressor, 0, sizeof(rzs->compressor));
+	strlcpy(rzs->compressor[0], default_compressor, RZS_COMP_NAME_LEN);
+	rzs->alt_threshold = default_alt_threshold;
+}
+
 static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 			struct ramzswap_ioctl_stats *s)
 {
@@ -123,11 +134,12 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #if defined(CONFIG_RAMZSWAP_STATS)
 	{
 	struct ramzswap_stats *rs = &rzs->stats;
+	struct zs_pool_stats zs;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
 
-	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
-			+ (rs->pages_expand << PAGE_SHIFT);
+	zs_get_stats(rzs->mem_pool, &zs);
+	mem_used = zs.total_size + (rs->pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
 
@@ -158,13 +170,152 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
-static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
+static void ramzswap_ioctl_get_stats_ext(struct ramzswap *rzs,
+			struct ramzswap_ioctl_stats_ext *s)
+{
+#if defined(CONFIG_RAMZSWAP_STATS)
+	struct ramzswap_stats *rs = &rzs->stats;
+	struct zs_pool_stats zs;
+
+	zs_get_stats(rzs->mem_pool, &zs);
+
+	s->pages_alt_comp = rs->pages_alt;
+	s->dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+	s->pages_dedup = rs->pages_dedup;
+	s->dedup_saved_size = rs->dedup_saved;
+	s->pages_wb = rs->pages_wb;
+	s->wb_writes = rzs_stat64_read(rzs, &rs->wb_writes);
+	s->wb_reads = rzs_stat64_read(rzs, &rs->wb_reads);
+	s->mem_frag_size = zs.total_size - zs.obj_size;
+	s->pages_compacted = zs.pages_compacted;
+	s->objs_moved = zs.objs_moved;
+#endif /* CONFIG_RAMZSWAP_STATS */
+}
+
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+static struct kmem_cache *rzs_dedup_cache;
+
+static u32 rzs_dedup_hash(const void *src, unsigned int clen, int comp)
+{
+	return jhash(src, clen, comp);
+}
+
+static struct hlist_head *rzs_dedup_bucket(struct ramzswap *rzs, u32 hash)
+{
+	return &rzs->dedup_hash[hash_32(hash, rzs->dedup_bits)];
+}
+
+/*
+ * Look for a stored object with the given compressed contents and,
+ * if found, take a reference to it. Called with rzs->table_lock held.
+ */
+static struct rzs_dedup *rzs_dedup_get(struct ramzswap *rzs, u32 hash,
+			const void *src, unsigned int clen, int comp)
+{
+	int match;
+	unsigned char *cmem;
+	struct rzs_dedup *d;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(d, pos, rzs_dedup_bucket(rzs, hash), node) {
+		if (d->hash != hash || d->clen != clen || d->comp != comp)
+			continue;
+
+		cmem = zs_map_object(rzs->mem_pool, d->handle, ZS_MM_RO);
+		match = !memcmp(cmem + sizeof(struct zobj_header), src, clen);
+		zs_unmap_object(rzs->mem_pool, d->handle);
+
+		if (match) {
+			d->refcount++;
+			return d;
+		}
+	}
+
+	return NULL;
+}
+
+/* Called with rzs->table_lock held */
+static void rzs_dedup_insert(struct ramzswap *rzs, struct rzs_dedup *d,
+			unsigned long handle, u32 hash,
+			unsigned int clen, int comp)
+{
+	d->handle = handle;
+	d->clen = clen;
+	d->hash = hash;
+	d->comp = comp;
+	d->refcount = 1;
+	hlist_add_head(&d->node, rzs_dedup_bucket(rzs, hash));
+}
+
+/*
+ * Drop a reference to the object. Returns the number of references
+ * left; the caller frees the object when it is zero. Objects stored
+ * while no rzs_dedup could be allocated are not indexed and have a
+ * single reference. Called with rzs->table_lock held.
+ */
+static u32 rzs_dedup_put(struct ramzswap *rzs, unsigned long handle)
 {
-	u32 clen;
-	void *obj;
+	u32 hash, refcount;
+	struct rzs_dedup *d;
+	struct hlist_node *pos;
+	struct zobj_header *zheader;
+
+	zheader = zs_map_object(rzs->mem_pool, handle, ZS_MM_RO);
+	hash = zheader->hash;
+	zs_unmap_object(rzs->mem_pool, handle);
+
+	hlist_for_each_entry(d, pos, rzs_dedup_bucket(rzs, hash), node) {
+		if (d->handle != handle)
+			continue;
+
+		refcount = --d->refcount;
+		if (!refcount) {
+			hlist_del(&d->node);
+			kmem_cache_free(rzs_dedup_cache, d);
+		}
+		return refcount;
+	}
+
+	return 0;
+}
+
+static struct rzs_dedup *rzs_dedup_alloc(void)
+{
+	return kmem_cache_alloc(rzs_dedup_cache, GFP_NOIO);
+}
+
+static void rzs_dedup_free(struct rzs_dedup *d)
+{
+	if (d)
+		kmem_cache_free(rzs_dedup_cache, d);
+}
+#else
+#define rzs_dedup_hash(src, clen, comp)		0
+#define rzs_dedup_get(rzs, hash, src, clen, comp)	NULL
+#define rzs_dedup_insert(rzs, d, handle, hash, clen, comp)
+#define rzs_dedup_put(rzs, handle)		0
+#define rzs_dedup_alloc()			NULL
+#define rzs_dedup_free(d)
+#endif /* CONFIG_RAMZSWAP_DEDUP */
+
+/* Called with rzs->table_lock held */
+static void __ramzswap_free_page(struct ramzswap *rzs, size_t index)
+{
+	u32 clen, refs;
 
 	struct page *page = rzs->table[index].page;
-	u32 offset = rzs->table[index].offset;
+	unsigned long handle = rzs->table[index].handle;
+
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+	rzs_clear_flag(rzs, index, RZS_WB_BUSY);
+
+	if (unlikely(rzs_test_flag(rzs, index, RZS_WB))) {
+		clear_bit(rzs->table[index].bslot, rzs->wb_bitmap);
+		rzs_clear_flag(rzs, index, RZS_WB);
+		rzs_stat_dec(&rzs->stats.pages_wb);
+		rzs->table[index].bslot = 0;
+		return;
+	}
 
 	if (unlikely(!page)) {
 		/*
@@ -179,27 +330,71 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 	}
 
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
+		list_del_init(&page->lru);
+		set_page_private(page, 0);
 		__free_page(page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
 		rzs_stat_dec(&rzs->stats.pages_expand);
+		rzs->stats.compr_size -= PAGE_SIZE;
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	clen = rzs->table[index].size;
+	refs = rzs_dedup_put(rzs, handle);
+
+	if (refs) {
+		/* Object is still used by other swap slots */
+		rzs->stats.dedup_saved -= clen;
+		rzs_stat_dec(&rzs->stats.pages_dedup);
+	} else {
+		zs_free(rzs->mem_pool, handle);
+		rzs->stats.compr_size -= clen;
+
+		if (++rzs->nr_frees >= compact_frees && rzs->init_done) {
+			rzs->nr_frees = 0;
+			queue_work(rzs_wb_wq, &rzs->compact_work);
+		}
+	}
 
-	xv_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
+	if (rzs_test_flag(rzs, index, RZS_ALT_COMP)) {
+		rzs_clear_flag(rzs, index, RZS_ALT_COMP);
+		rzs_stat_dec(&rzs->stats.pages_alt);
+	}
 
 out:
-	rzs->stats.compr_size -= clen;
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
-	rzs->table[index].page = NULL;
-	rzs->table[index].offset = 0;
+	rzs->table[index].handle = 0;
+	rzs->table[index].size = 0;
+}
+
+static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
+{
+	spin_lock(&rzs->table_lock);
+	__ramzswap_free_page(rzs, index);
+	spin_unlock(&rzs->table_lock);
+}
+
+/*
+ * Pick the compression stream of the local CPU. We may be migrated
+ * after this, in which case two writers can end up on one stream;
+ * the stream mutex keeps that correct, and it is rare enough not to
+ * matter for throughput.
+ */
+static struct rzs_stream *rzs_get_stream(struct ramzswap *rzs)
+{
+	struct rzs_stream *stream;
+
+	stream = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	mutex_lock(&stream->lock);
+	return stream;
+}
+
+static void rzs_put_stream(struct rzs_stream *stream)
+{
+	mutex_unlock(&stream->lock);
 }
 
 static int handle_zero_page(struct bio *bio)
@@ -212,9 +407,6 @@ static int handle_zero_page(struct bio *bio)
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
 	return 0;
 }
 
@@ -228,17 +420,13 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(rzs->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
-
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
 	return 0;
 }
 
@@ -256,76 +444,152 @@ static int handle_ramzswap_fault(struct ramzswap *rzs, struct bio *bio)
 		bio->bi_io_vec[0].bv_offset);
 
 	/* Do nothing. Just return success */
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
 	return 0;
 }
 
-static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
+/*
+ * Fill the bio page from the RAM copy of the page. Returns 0 on
+ * success; the caller completes the bio.
+ */
+static int __ramzswap_read(struct ramzswap *rzs, struct bio *bio, u32 index)
 {
-	int ret;
-	u32 index;
-	size_t clen;
+	int ret, comp;
+	unsigned int clen;
+	struct rzs_stream *stream;
 	struct page *page;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem;
 
-	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
-
 	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	if (rzs_test_flag(rzs, index, RZS_ZERO))
 		return handle_zero_page(bio);
 
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!rzs->table[index].handle)
 		return handle_ramzswap_fault(rzs, bio);
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
 		return handle_uncompressed_page(rzs, bio);
 
+	comp = rzs_test_flag(rzs, index, RZS_ALT_COMP) ? 1 : 0;
+	stream = rzs_get_stream(rzs);
+
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = zs_map_object(rzs->mem_pool, rzs->table[index].handle,
+				ZS_MM_RO);
 
-	ret = lzo1x_decompress_safe(
-		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
+	ret = crypto_comp_decompress(stream->tfm[comp],
+		cmem + sizeof(*zheader), rzs->table[index].size,
 		user_mem, &clen);
 
+	zs_unmap_object(rzs->mem_pool, rzs->table[index].handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	rzs_put_stream(stream);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret || clen != PAGE_SIZE)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
-		goto out;
+		return -EIO;
 	}
 
 	flush_dcache_page(page);
+	return 0;
+}
+
+static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
+{
+	int ret;
+	u32 index;
+
+	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	spin_lock(&rzs->table_lock);
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+
+	/*
+	 * Page was written back. Remap the bio and have the block
+	 * layer resubmit it to the backing device.
+	 */
+	if (unlikely(rzs_test_flag(rzs, index, RZS_WB))) {
+		bio->bi_bdev = rzs->backing_bdev;
+		bio->bi_sector = rzs->table[index].bslot <<
+					SECTORS_PER_PAGE_SHIFT;
+		spin_unlock(&rzs->table_lock);
+		rzs_stat64_inc(rzs, &rzs->stats.wb_reads);
+		return 1;
+	}
+
+	/* Keep writeback from freeing the RAM copy under us */
+	rzs_set_flag(rzs, index, RZS_READING);
+	spin_unlock(&rzs->table_lock);
+
+	ret = __ramzswap_read(rzs, bio, index);
+
+	spin_lock(&rzs->table_lock);
+	rzs_clear_flag(rzs, index, RZS_READING);
+	spin_unlock(&rzs->table_lock);
+
+	if (unlikely(ret)) {
+		bio_io_error(bio);
+		return 0;
+	}
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
+}
 
-out:
-	bio_io_error(bio);
-	return 0;
+/*
+ * If an identical compressed object is already stored, point the
+ * table entry at it instead of storing another copy.
+ */
+static int ramzswap_write_dup(struct ramzswap *rzs, u32 index, u32 hash,
+			const void *src, unsigned int clen, int comp)
+{
+	struct rzs_dedup *d;
+
+	spin_lock(&rzs->table_lock);
+	d = rzs_dedup_get(rzs, hash, src, clen, comp);
+	if (!d) {
+		spin_unlock(&rzs->table_lock);
+		return 0;
+	}
+
+	rzs->table[index].handle = d->handle;
+	rzs->table[index].size = clen;
+	if (comp) {
+		rzs_set_flag(rzs, index, RZS_ALT_COMP);
+		rzs_stat_inc(&rzs->stats.pages_alt);
+	}
+	rzs->stats.dedup_saved += clen;
+	rzs_stat_inc(&rzs->stats.pages_dedup);
+	rzs_stat_inc(&rzs->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		rzs_stat_inc(&rzs->stats.good_compress);
+	spin_unlock(&rzs->table_lock);
+
+	rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+	return 1;
 }
 
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
-	int ret;
-	u32 offset, index;
-	size_t clen;
+	int ret, comp = 0, uncompressed = 0;
+	u32 index, hash = 0;
+	unsigned int clen, alt_clen;
+	unsigned long handle = 0;
 	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	struct rzs_dedup *dedup = NULL;
+	struct rzs_stream *stream;
+	struct page *page, *page_store = NULL;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,29 +597,46 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
+	stream = rzs_get_stream(rzs);
+	src = stream->buffer[0];
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
+		rzs_put_stream(stream);
+		spin_lock(&rzs->table_lock);
 		rzs_stat_inc(&rzs->stats.pages_zero);
 		rzs_set_flag(rzs, index, RZS_ZERO);
+		spin_unlock(&rzs->table_lock);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(stream->tfm[0], user_mem, PAGE_SIZE,
+				src, &clen);
+
+	/*
+	 * Give the secondary compressor a go at pages the primary one
+	 * did poorly on, and keep whichever result is smaller.
+	 */
+	if (!ret && stream->tfm[1] && clen > rzs->alt_threshold) {
+		alt_clen = 2 * PAGE_SIZE;
+		if (!crypto_comp_compress(stream->tfm[1], user_mem, PAGE_SIZE,
+				stream->buffer[1], &alt_clen) &&
+				alt_clen < clen) {
+			clen = alt_clen;
+			src = stream->buffer[1];
+			comp = 1;
+		}
+	}
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_put_stream(stream);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
@@ -367,63 +648,92 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		rzs_put_stream(stream);
+
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
-			mutex_unlock(&rzs->lock);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 			goto out;
 		}
 
-		offset = 0;
-		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
-		rzs_stat_inc(&rzs->stats.pages_expand);
-		rzs->table[index].page = page_store;
+		uncompressed = 1;
 		src = kmap_atomic(page, KM_USER0);
 		goto memstore;
 	}
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
-		mutex_unlock(&rzs->lock);
+	hash = rzs_dedup_hash(src, clen, comp);
+	if (ramzswap_write_dup(rzs, index, hash, src, clen, comp)) {
+		rzs_put_stream(stream);
+		goto done;
+	}
+
+	/* Failing this only means the object cannot be shared later */
+	dedup = rzs_dedup_alloc();
+
+	handle = zs_malloc(rzs->mem_pool, clen + sizeof(*zheader),
+				GFP_NOIO | __GFP_HIGHMEM);
+	if (!handle) {
+		rzs_put_stream(stream);
+		rzs_dedup_free(dedup);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
 memstore:
-	rzs->table[index].offset = offset;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
-
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
+	if (unlikely(uncompressed)) {
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+	} else {
+		cmem = zs_map_object(rzs->mem_pool, handle, ZS_MM_WO);
 		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+		zheader->hash = hash;
 #endif
+		memcpy(cmem + sizeof(*zheader), src, clen);
+		zs_unmap_object(rzs->mem_pool, handle);
+		rzs_put_stream(stream);
+	}
 
-	memcpy(cmem, src, clen);
-
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
-
-	/* Update stats */
+	/* Publish the new object and update stats */
+	spin_lock(&rzs->table_lock);
+	if (unlikely(uncompressed)) {
+		rzs->table[index].page = page_store;
+		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
+		rzs_stat_inc(&rzs->stats.pages_expand);
+		INIT_LIST_HEAD(&page_store->lru);
+		if (rzs->backing_bdev) {
+			set_page_private(page_store, index);
+			list_add_tail(&page_store->lru, &rzs->wb_list);
+		}
+	} else {
+		rzs->table[index].handle = handle;
+		rzs->table[index].size = clen;
+		if (dedup)
+			rzs_dedup_insert(rzs, dedup, handle, hash,
+					clen, comp);
+		if (comp) {
+			rzs_set_flag(rzs, index, RZS_ALT_COMP);
+			rzs_stat_inc(&rzs->stats.pages_alt);
+		}
+	}
 	rzs->stats.compr_size += clen;
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
+	spin_unlock(&rzs->table_lock);
 
-	mutex_unlock(&rzs->lock);
+	/* Incompressible pages are moved out as soon as possible */
+	if (unlikely(uncompressed) && rzs->backing_bdev)
+		queue_work(rzs_wb_wq, &rzs->wb_work);
 
+done:
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return 0;
@@ -433,6 +743,279 @@ out:
 	return 0;
 }
 
+static void ramzswap_wb_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int ramzswap_wb_write_page(struct ramzswap *rzs, struct page *page,
+			unsigned long slot)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = slot << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_io_vec[0].bv_page = page;
+	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
+	bio->bi_io_vec[0].bv_offset = 0;
+	bio->bi_vcnt = 1;
+	bio->bi_idx = 0;
+	bio->bi_size = PAGE_SIZE;
+	bio->bi_end_io = ramzswap_wb_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+	return ret;
+}
+
+/*
+ * Write back page at index if it is incompressible or, for idle scans,
+ * was not read since the previous scan. Returns -ENOSPC once the
+ * backing device is full.
+ *
+ * The RAM copy stays valid while the write is in flight. It is only
+ * dropped afterwards if the slot was neither freed (which clears
+ * RZS_WB_BUSY) nor is being read.
+ */
+static int ramzswap_writeback_page(struct ramzswap *rzs, size_t index,
+			int idle)
+{
+	int ret, comp = 0, uncompressed;
+	unsigned int clen = 0, len;
+	unsigned long slot;
+	struct rzs_stream *stream;
+	unsigned char *cmem, *dst;
+
+	spin_lock(&rzs->table_lock);
+	if (!rzs->table[index].handle ||
+			rzs_test_flag(rzs, index, RZS_WB) ||
+			rzs_test_flag(rzs, index, RZS_WB_BUSY) ||
+			rzs_test_flag(rzs, index, RZS_READING))
+		goto out_unlock;
+
+	uncompressed = rzs_test_flag(rzs, index, RZS_UNCOMPRESSED);
+	if (!uncompressed) {
+		if (!idle)
+			goto out_unlock;
+		if (!rzs_test_flag(rzs, index, RZS_IDLE)) {
+			rzs_set_flag(rzs, index, RZS_IDLE);
+			goto out_unlock;
+		}
+	}
+
+	slot = find_first_zero_bit(rzs->wb_bitmap, rzs->wb_pages);
+	if (slot >= rzs->wb_pages) {
+		spin_unlock(&rzs->table_lock);
+		return -ENOSPC;
+	}
+	set_bit(slot, rzs->wb_bitmap);
+	rzs_set_flag(rzs, index, RZS_WB_BUSY);
+
+	if (uncompressed) {
+		cmem = kmap_atomic(rzs->table[index].page, KM_USER0);
+		dst = kmap_atomic(rzs->wb_page, KM_USER1);
+		memcpy(dst, cmem, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(cmem, KM_USER0);
+	} else {
+		comp = rzs_test_flag(rzs, index, RZS_ALT_COMP) ? 1 : 0;
+		clen = rzs->table[index].size;
+		cmem = zs_map_object(rzs->mem_pool, rzs->table[index].handle,
+					ZS_MM_RO);
+		memcpy(rzs->wb_buffer, cmem + sizeof(struct zobj_header),
+			clen);
+		zs_unmap_object(rzs->mem_pool, rzs->table[index].handle);
+	}
+	spin_unlock(&rzs->table_lock);
+
+	if (!uncompressed) {
+		stream = rzs_get_stream(rzs);
+		dst = kmap_atomic(rzs->wb_page, KM_USER0);
+		len = PAGE_SIZE;
+		ret = crypto_comp_decompress(stream->tfm[comp],
+				rzs->wb_buffer, clen, dst, &len);
+		kunmap_atomic(dst, KM_USER0);
+		rzs_put_stream(stream);
+		if (ret || len != PAGE_SIZE) {
+			ret = -EIO;
+			goto out_abort;
+		}
+	}
+
+	ret = ramzswap_wb_write_page(rzs, rzs->wb_page, slot);
+	if (ret)
+		goto out_abort;
+
+	spin_lock(&rzs->table_lock);
+	if (!rzs_test_flag(rzs, index, RZS_WB_BUSY) ||
+			rzs_test_flag(rzs, index, RZS_READING)) {
+		rzs_clear_flag(rzs, index, RZS_WB_BUSY);
+		clear_bit(slot, rzs->wb_bitmap);
+		goto out_unlock;
+	}
+	__ramzswap_free_page(rzs, index);
+	rzs->table[index].bslot = slot;
+	rzs_set_flag(rzs, index, RZS_WB);
+	rzs_stat_inc(&rzs->stats.pages_wb);
+	spin_unlock(&rzs->table_lock);
+
+	rzs_stat64_inc(rzs, &rzs->stats.wb_writes);
+	return 0;
+
+out_abort:
+	pr_debug("Writeback of page %zu failed: err=%d\n", index, ret);
+	spin_lock(&rzs->table_lock);
+	rzs_clear_flag(rzs, index, RZS_WB_BUSY);
+	clear_bit(slot, rzs->wb_bitmap);
+out_unlock:
+	spin_unlock(&rzs->table_lock);
+	return 0;
+}
+
+/* Full table scan, for the idle writeback */
+static void ramzswap_writeback_idle(struct ramzswap *rzs)
+{
+	size_t index;
+
+	/* Page 0 is the swap header; leave it in RAM */
+	for (index = 1; index < rzs->disksize >> PAGE_SHIFT; index++) {
+		if (!rzs->init_done)
+			break;
+		if (ramzswap_writeback_page(rzs, index, 1) == -ENOSPC)
+			break;
+		cond_resched();
+	}
+}
+
+/*
+ * Write back the incompressible pages queued on wb_list.  A page that
+ * cannot be written right now (being read, or the backing device is
+ * full) stays in RAM and is left to the idle scan.
+ */
+static void ramzswap_wb_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap, wb_work);
+	struct page *page;
+	size_t index;
+
+	while (rzs->init_done) {
+		spin_lock(&rzs->table_lock);
+		if (list_empty(&rzs->wb_list)) {
+			spin_unlock(&rzs->table_lock);
+			break;
+		}
+		page = list_first_entry(&rzs->wb_list, struct page, lru);
+		list_del_init(&page->lru);
+		index = page_private(page);
+		spin_unlock(&rzs->table_lock);
+
+		if (ramzswap_writeback_page(rzs, index, 0) == -ENOSPC)
+			break;
+		cond_resched();
+	}
+}
+
+static void ramzswap_wb_idle_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+					wb_idle_work.work);
+
+	ramzswap_writeback_idle(rzs);
+
+	if (rzs->init_done)
+		queue_delayed_work(rzs_wb_wq, &rzs->wb_idle_work,
+					rzs->wb_idle_age * HZ);
+}
+
+static void ramzswap_compact_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+					compact_work);
+	struct zs_pool_stats zs;
+
+	zs_get_stats(rzs->mem_pool, &zs);
+	if ((zs.total_size - zs.obj_size) * 100 >
+			zs.total_size * compact_frag_perc)
+		zs_compact(rzs->mem_pool);
+}
+
+static int ramzswap_setup_backing(struct ramzswap *rzs)
+{
+	int ret;
+	struct inode *inode;
+	struct file *file;
+
+	file = filp_open(rzs->backing_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file)) {
+		pr_err("Error opening backing device %s\n", rzs->backing_name);
+		return PTR_ERR(file);
+	}
+
+	inode = file->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		pr_err("%s is not a block device\n", rzs->backing_name);
+		ret = -EINVAL;
+		goto out_close;
+	}
+
+	ret = bd_claim(I_BDEV(inode), ramzswap_setup_backing);
+	if (ret) {
+		pr_err("Backing device %s is busy\n", rzs->backing_name);
+		goto out_close;
+	}
+
+	rzs->backing_file = file;
+	rzs->backing_bdev = I_BDEV(inode);
+	rzs->wb_pages = i_size_read(inode) >> PAGE_SHIFT;
+
+	rzs->wb_bitmap = vmalloc(BITS_TO_LONGS(rzs->wb_pages) *
+					sizeof(long));
+	rzs->wb_page = alloc_page(GFP_KERNEL);
+	rzs->wb_buffer = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!rzs->wb_bitmap || !rzs->wb_page || !rzs->wb_buffer) {
+		pr_err("Error allocating writeback buffers\n");
+		return -ENOMEM;
+	}
+	bitmap_zero(rzs->wb_bitmap, rzs->wb_pages);
+
+	pr_info("Using %s as backing device, %lu pages\n",
+		rzs->backing_name, rzs->wb_pages);
+	return 0;
+
+out_close:
+	filp_close(file, NULL);
+	return ret;
+}
+
+static void ramzswap_release_backing(struct ramzswap *rzs)
+{
+	vfree(rzs->wb_bitmap);
+	rzs->wb_bitmap = NULL;
+	if (rzs->wb_page)
+		__free_page(rzs->wb_page);
+	rzs->wb_page = NULL;
+	kfree(rzs->wb_buffer);
+	rzs->wb_buffer = NULL;
+
+	if (rzs->backing_bdev) {
+		bd_release(rzs->backing_bdev);
+		filp_close(rzs->backing_file, NULL);
+	}
+	rzs->backing_bdev = NULL;
+	rzs->backing_file = NULL;
+	rzs->wb_pages = 0;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -484,6 +1067,68 @@ static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+static void ramzswap_free_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	if (!rzs->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+		int i;
+
+		for (i = 0; i < RZS_NR_COMP; i++) {
+			if (!IS_ERR_OR_NULL(stream->tfm[i]))
+				crypto_free_comp(stream->tfm[i]);
+			free_pages((unsigned long)stream->buffer[i], 1);
+		}
+	}
+
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
+
+static int ramzswap_alloc_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	rzs->streams = alloc_percpu(struct rzs_stream);
+	if (!rzs->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_stream *stream = per_cpu_ptr(rzs->streams, cpu);
+
+		int i;
+
+		mutex_init(&stream->lock);
+		for (i = 0; i < RZS_NR_COMP; i++) {
+			if (!rzs->compressor[i][0])
+				continue;
+
+			stream->tfm[i] = crypto_alloc_comp(rzs->compressor[i],
+							0, 0);
+			if (IS_ERR(stream->tfm[i])) {
+				pr_err("Error allocating %s compressor!\n",
+					rzs->compressor[i]);
+				return PTR_ERR(stream->tfm[i]);
+			}
+
+			/* Some compressors may expand the data */
+			stream->buffer[i] = (void *)__get_free_pages(
+							__GFP_ZERO, 1);
+			if (!stream->buffer[i]) {
+				pr_err("Error allocating compressor "
+					"buffer space\n");
+				return -ENOMEM;
+			}
+		}
+	}
+
+	return 0;
+}
+
 static void reset_device(struct ramzswap *rzs)
 {
 	size_t index;
@@ -491,40 +1136,43 @@ static void reset_device(struct ramzswap *rzs)
 	/* Do not accept any new I/O request */
 	rzs->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
-
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	/* Stop writeback before tearing down what it uses */
+	cancel_delayed_work_sync(&rzs->wb_idle_work);
+	cancel_work_sync(&rzs->wb_work);
+	cancel_work_sync(&rzs->compact_work);
 
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
-
-		if (!page)
-			continue;
+	/* Free various per-device buffers */
+	ramzswap_free_streams(rzs);
 
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
-	}
+	/*
+	 * Free all pages that are still in this ramzswap device. This
+	 * goes through the refcounts so that shared objects are freed
+	 * exactly once.
+	 */
+	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++)
+		ramzswap_free_page(rzs, index);
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
-	xv_destroy_pool(rzs->mem_pool);
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	vfree(rzs->dedup_hash);
+	rzs->dedup_hash = NULL;
+#endif
+
+	ramzswap_release_backing(rzs);
+	rzs->backing_name[0] = '\0';
+	rzs->wb_idle_age = 0;
+
+	if (rzs->mem_pool)
+		zs_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
 	/* Reset stats */
 	memset(&rzs->stats, 0, sizeof(rzs->stats));
 
 	rzs->disksize = 0;
+	ramzswap_set_default_compressor(rzs);
 }
 
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
@@ -541,19 +1189,9 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = ramzswap_alloc_streams(rzs);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = rzs->disksize >> PAGE_SHIFT;
 	rzs->table = vmalloc(num_pages * sizeof(*rzs->table));
@@ -572,6 +1210,8 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 		ret = -ENOMEM;
 		goto fail;
 	}
+	/* Never queued for writeback, but freed like any other page */
+	INIT_LIST_HEAD(&page->lru);
 	rzs->table[0].page = page;
 	rzs_set_flag(rzs, 0, RZS_UNCOMPRESSED);
 
@@ -584,15 +1224,51 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	/* ramzswap devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->disk->queue);
 
-	rzs->mem_pool = xv_create_pool();
+	/*
+	 * Reads are served before make_request returns, so swap readahead
+	 * would only decompress pages nobody asked for. Not so for pages
+	 * written back to a backing device.
+	 */
+	if (rzs->backing_name[0])
+		rzs->queue->backing_dev_info.capabilities &=
+						~BDI_CAP_SYNCHRONOUS_IO;
+	else
+		rzs->queue->backing_dev_info.capabilities |=
+						BDI_CAP_SYNCHRONOUS_IO;
+
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	/* About one hash bucket per four swap slots */
+	rzs->dedup_bits = max_t(int, ilog2(num_pages) - 2, 8);
+	rzs->dedup_hash = vmalloc(sizeof(struct hlist_head) <<
+					rzs->dedup_bits);
+	if (!rzs->dedup_hash) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->dedup_hash, 0,
+		sizeof(struct hlist_head) << rzs->dedup_bits);
+#endif
+
+	rzs->mem_pool = zs_create_pool();
 	if (!rzs->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (rzs->backing_name[0]) {
+		ret = ramzswap_setup_backing(rzs);
+		if (ret)
+			goto fail;
+	}
+
 	rzs->init_done = 1;
 
+	if (rzs->backing_bdev && rzs->wb_idle_age)
+		queue_delayed_work(rzs_wb_wq, &rzs->wb_idle_work,
+					rzs->wb_idle_age * HZ);
+
 	pr_debug("Initialization done!\n");
 	return 0;
 
@@ -603,6 +1279,35 @@ fail:
 	return ret;
 }
 
+static int ramzswap_ioctl_set_compressor(struct ramzswap *rzs,
+			struct ramzswap_ioctl_compressor *c)
+{
+	if (c->slot >= RZS_NR_COMP)
+		return -EINVAL;
+
+	c->name[RZS_COMP_NAME_LEN - 1] = '\0';
+
+	/* The primary compressor cannot be cleared */
+	if (!c->name[0]) {
+		if (!c->slot)
+			return -EINVAL;
+		rzs->compressor[c->slot][0] = '\0';
+		return 0;
+	}
+
+	if (!crypto_has_comp(c->name, 0, 0)) {
+		pr_info("Compressor %s not available\n", c->name);
+		return -ENOENT;
+	}
+
+	strlcpy(rzs->compressor[c->slot], c->name, RZS_COMP_NAME_LEN);
+	if (c->slot && c->threshold)
+		rzs->alt_threshold = min_t(u32, c->threshold, PAGE_SIZE);
+
+	pr_info("Compressor %u set to %s\n", c->slot, c->name);
+	return 0;
+}
+
 static int ramzswap_ioctl_reset_device(struct ramzswap *rzs)
 {
 	if (rzs->init_done)
@@ -655,6 +1360,65 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case RZSIO_GET_STATS_EXT:
+	{
+		struct ramzswap_ioctl_stats_ext stats;
+
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		memset(&stats, 0, sizeof(stats));
+		ramzswap_ioctl_get_stats_ext(rzs, &stats);
+		if (copy_to_user((void *)arg, &stats, sizeof(stats))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		break;
+	}
+	case RZSIO_SET_COMPRESSOR:
+	{
+		struct ramzswap_ioctl_compressor comp;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&comp, (void *)arg, sizeof(comp))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		ret = ramzswap_ioctl_set_compressor(rzs, &comp);
+		break;
+	}
+	case RZSIO_SET_BACKING_DEV:
+	{
+		struct ramzswap_ioctl_backing backing;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&backing, (void *)arg, sizeof(backing))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		backing.name[RZS_BACKING_NAME_LEN - 1] = '\0';
+		strlcpy(rzs->backing_name, backing.name, RZS_BACKING_NAME_LEN);
+		rzs->wb_idle_age = backing.idle_age;
+		pr_info("Backing device set to %s, idle age %us\n",
+			rzs->backing_name, rzs->wb_idle_age);
+		break;
+	}
+	case RZSIO_COMPACT:
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		pr_debug("Compaction freed %lu pages\n",
+			zs_compact(rzs->mem_pool));
+		break;
+
 	case RZSIO_INIT:
 		ret = ramzswap_ioctl_init_device(rzs);
 		break;
@@ -703,8 +1467,13 @@ static int create_device(struct ramzswap *rzs, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&rzs->lock);
+	spin_lock_init(&rzs->table_lock);
 	spin_lock_init(&rzs->stat64_lock);
+	ramzswap_set_default_compressor(rzs);
+	INIT_LIST_HEAD(&rzs->wb_list);
+	INIT_WORK(&rzs->wb_work, ramzswap_wb_work);
+	INIT_DELAYED_WORK(&rzs->wb_idle_work, ramzswap_wb_idle_work);
+	INIT_WORK(&rzs->compact_work, ramzswap_compact_work);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -770,11 +1539,25 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	rzs_dedup_cache = KMEM_CACHE(rzs_dedup, 0);
+	if (!rzs_dedup_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+#endif
+
+	rzs_wb_wq = create_singlethread_workqueue("ramzswap_wb");
+	if (!rzs_wb_wq) {
+		ret = -ENOMEM;
+		goto free_cache;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_wq;
 	}
 
 	if (!num_devices) {
@@ -803,6 +1586,12 @@ free_devices:
 		destroy_device(&devices[--dev_id]);
 unregister:
 	unregister_blkdev(ramzswap_major, "ramzswap");
+destroy_wq:
+	destroy_workqueue(rzs_wb_wq);
+free_cache:
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	kmem_cache_destroy(rzs_dedup_cache);
+#endif
 out:
 	return ret;
 }
@@ -823,6 +1612,10 @@ static void __exit ramzswap_exit(void)
 	unregister_blkdev(ramzswap_major, "ramzswap");
 
 	kfree(devices);
+	destroy_workqueue(rzs_wb_wq);
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	kmem_cache_destroy(rzs_dedup_cache);
+#endif
 	pr_debug("Cleanup done!\n");
 }
 
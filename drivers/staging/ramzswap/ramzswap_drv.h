@@ -17,9 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_ioctl.h"
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -30,12 +33,12 @@ static const unsigned max_num_devices = 32;
 /*
  * Stored at beginning of each compressed object.
  *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * With CONFIG_RAMZSWAP_DEDUP it holds the content hash used to find
+ * the object's dedup entry on free; otherwise it is empty.
  */
 struct zobj_header {
-#if 0
-	u32 table_idx;
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	u32 hash;	/* content hash, locates the rzs_dedup entry */
 #endif
 };
 
@@ -44,6 +47,15 @@ struct zobj_header {
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default primary compressor; no secondary compressor by default */
+static const char default_compressor[] = "lzo";
+
+/*
+ * Pages that compress to size greater than this with the primary
+ * compressor are retried with the secondary one, if it is set.
+ */
+static const unsigned default_alt_threshold = PAGE_SIZE / 2;
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -52,9 +64,16 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   PAGE_SIZE - sizeof(unsigned long) - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * Every this many frees, compact the memory pool if more than
+ * compact_frag_perc of it is allocated but unused.
  */
+static const unsigned compact_frees = 1024;
+static const unsigned compact_frag_perc = 25;
 
 /*-- End of configurable params */
 
@@ -63,6 +82,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 
+/* Compressor slots: primary and secondary */
+#define RZS_NR_COMP		2
+
 /* Flags for ramzswap pages (table[page_no].flags) */
 enum rzs_pageflags {
 	/* Page is stored uncompressed */
@@ -71,6 +93,21 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is compressed with the secondary compressor */
+	RZS_ALT_COMP,
+
+	/* Page lives on the backing device, at table[].bslot */
+	RZS_WB,
+
+	/* Page is being written to the backing device */
+	RZS_WB_BUSY,
+
+	/* Page is being read; writeback must not free it */
+	RZS_READING,
+
+	/* Page was not read since the last idle scan */
+	RZS_IDLE,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
@@ -81,8 +118,12 @@ enum rzs_pageflags {
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		struct page *page;	/* RZS_UNCOMPRESSED page */
+		unsigned long handle;	/* zsmalloc object */
+		unsigned long bslot;	/* backing device page (RZS_WB) */
+	};
+	u16 size;	/* compressed size */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -91,6 +132,8 @@ struct ramzswap_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
 				 * needed to enforce memlimit */
+	size_t dedup_saved;	/* compressed bytes not stored thanks
+				 * to deduplication */
 	/* more stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
 	u64 num_reads;		/* failed + successful */
@@ -103,26 +146,87 @@ struct ramzswap_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_alt;		/* no. of pages using secondary compressor */
+	u64 dedup_hits;		/* no. of writes matching a stored object */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 wb_writes;		/* pages written to the backing device */
+	u64 wb_reads;		/* pages read back from it */
 #endif
 };
 
+/*
+ * Every compressed object is indexed by a hash of its compressed
+ * contents so that identical pages written to different swap slots
+ * can share one object. refcount is the number of table entries
+ * pointing to the object.
+ */
+struct rzs_dedup {
+	struct hlist_node node;
+	unsigned long handle;
+	u16 clen;
+	u32 hash;
+	u32 refcount;
+	u8 comp;
+};
+
+/*
+ * Compression context. There is one per possible CPU so that
+ * reclaimers running on different cores can compress in parallel.
+ * The mutex is needed since the writer may sleep in zs_malloc()
+ * and get migrated while it still uses the buffer. Readers use it
+ * too as crypto compression transforms keep per-call state.
+ */
+struct rzs_stream {
+	struct mutex lock;
+	struct crypto_comp *tfm[RZS_NR_COMP];
+	void *buffer[RZS_NR_COMP];
+};
+
 struct ramzswap {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;	/* has its own locks */
+	struct rzs_stream __percpu *streams;
 	struct table *table;
+	spinlock_t table_lock;	/* protect table entries and 32-bit stats */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	char compressor[RZS_NR_COMP][RZS_COMP_NAME_LEN];
+	u32 alt_threshold;
+#if defined(CONFIG_RAMZSWAP_DEDUP)
+	struct hlist_head *dedup_hash;	/* protected by table_lock */
+	unsigned int dedup_bits;
+#endif
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
 	/*
 	 * This is limit on amount of *uncompressed* worth of data
-	 * we can hold. When backing swap device is provided, it is
-	 * set equal to device size.
+	 * we can hold.
 	 */
 	size_t disksize;	/* bytes */
 
+	/*
+	 * Optional backing device. Slots in use are tracked in
+	 * wb_bitmap under table_lock; the work items run on a single
+	 * threaded workqueue and share wb_page and wb_buffer.
+	 * Incompressible pages waiting for wb_work are on wb_list,
+	 * through page->lru with their index in page->private, also
+	 * under table_lock.
+	 */
+	char backing_name[RZS_BACKING_NAME_LEN];
+	struct file *backing_file;
+	struct block_device *backing_bdev;
+	unsigned long *wb_bitmap;
+	unsigned long wb_pages;		/* backing device size in pages */
+	unsigned int wb_idle_age;	/* seconds, 0 = no idle writeback */
+	struct page *wb_page;
+	void *wb_buffer;
+	struct list_head wb_list;
+	struct work_struct wb_work;
+	struct delayed_work wb_idle_work;
+
+	unsigned int nr_frees;		/* since last compaction check */
+	struct work_struct compact_work;
+
 	struct ramzswap_stats stats;
 };
 
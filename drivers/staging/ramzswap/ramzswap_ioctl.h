@@ -15,6 +15,9 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_COMP_NAME_LEN	16
+#define RZS_BACKING_NAME_LEN	64
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -34,9 +37,54 @@ struct ramzswap_ioctl_stats {
 	u64 mem_used_total;
 } __attribute__ ((packed, aligned(4)));
 
+/*
+ * Counters added after struct ramzswap_ioctl_stats, which is left
+ * unchanged so RZSIO_GET_STATS keeps its number for existing tools.
+ */
+struct ramzswap_ioctl_stats_ext {
+	u32 pages_alt_comp;	/* no. of pages stored using the
+				 * secondary compressor */
+	u64 dedup_hits;		/* no. of writes matching a stored object */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u64 dedup_saved_size;	/* compressed bytes saved by dedup */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 wb_writes;		/* pages written to the backing device */
+	u64 wb_reads;		/* pages read back from it */
+	u64 mem_frag_size;	/* allocated but unused pool memory */
+	u64 pages_compacted;	/* pool pages freed by compaction */
+	u64 objs_moved;		/* objects moved by compaction */
+} __attribute__ ((packed, aligned(4)));
+
+/*
+ * Slot 0 is the primary compressor used for all pages. Slot 1 is an
+ * optional, usually denser but slower, compressor which is tried on
+ * pages that the primary one could not compress below threshold bytes.
+ * Name is any compression algorithm known to the crypto API, e.g.
+ * "lzo" or "deflate". An empty name clears the slot.
+ */
+struct ramzswap_ioctl_compressor {
+	char name[RZS_COMP_NAME_LEN];
+	u32 slot;
+	u32 threshold;		/* bytes, slot 1 only */
+} __attribute__ ((packed, aligned(4)));
+
+/*
+ * Block device, e.g. an eMMC partition or a loop device, to which
+ * incompressible pages and pages not read for idle_age seconds are
+ * written back. idle_age of 0 only writes back incompressible pages.
+ */
+struct ramzswap_ioctl_backing {
+	char name[RZS_BACKING_NAME_LEN];
+	u32 idle_age;
+} __attribute__ ((packed, aligned(4)));
+
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, struct ramzswap_ioctl_compressor)
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 5, struct ramzswap_ioctl_backing)
+#define RZSIO_COMPACT		_IO('z', 6)
+#define RZSIO_GET_STATS_EXT	_IOR('z', 7, struct ramzswap_ioctl_stats_ext)
 
 #endif
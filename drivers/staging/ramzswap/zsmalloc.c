@@ -0,0 +1,624 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped in size classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class packs its objects back to back into zspages of a few pages,
+ * the number chosen so that little of the zspage is left over. Objects
+ * may straddle a page boundary; such objects are copied through a per-cpu
+ * buffer when mapped. Users get an opaque handle rather than a location,
+ * which lets zs_compact() move objects out of sparsely used zspages and
+ * give those pages back.
+ *
+ * Locking: each size class has its own spinlock. zs_map_object() takes
+ * it and zs_unmap_object() drops it, so a mapped object cannot move and
+ * the user must not sleep in between. zs_malloc() and zs_free() must not
+ * be called with KM_USER0 mapped, nor zs_map_object() with KM_USER1.
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Handles of all pools come from one cache */
+static DEFINE_MUTEX(zs_cache_lock);
+static struct kmem_cache *zs_handle_cache;
+static int zs_cache_users;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage which wastes the smallest
+ * fraction of the zspage for objects of the given size.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, max_usedpc = 0, max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static void obj_location(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx, struct page **page,
+			unsigned long *offset)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+static unsigned long read_obj_header(struct size_class *class,
+			struct zspage *zspage, unsigned int obj_idx)
+{
+	struct page *page;
+	unsigned long offset, val;
+	void *addr;
+
+	obj_location(class, zspage, obj_idx, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	val = *(unsigned long *)(addr + offset);
+	kunmap_atomic(addr, KM_USER0);
+
+	return val;
+}
+
+static void write_obj_header(struct size_class *class,
+			struct zspage *zspage, unsigned int obj_idx,
+			unsigned long val)
+{
+	struct page *page;
+	unsigned long offset;
+	void *addr;
+
+	obj_location(class, zspage, obj_idx, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(addr + offset) = val;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/*
+ * Copy an object, from byte start on, between a zspage and the same
+ * place in buf. The object spans at most two pages.
+ */
+static void copy_obj(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx, char *buf, unsigned int start,
+			int to_obj)
+{
+	struct page *page;
+	unsigned long offset, off;
+	unsigned int done = start, len;
+	void *addr;
+
+	off = (unsigned long)obj_idx * class->size;
+	while (done < class->size) {
+		page = zspage->pages[(off + done) >> PAGE_SHIFT];
+		offset = (off + done) & ~PAGE_MASK;
+		len = min_t(unsigned int, class->size - done,
+				PAGE_SIZE - offset);
+
+		addr = kmap_atomic(page, KM_USER1);
+		if (to_obj)
+			memcpy(addr + offset, buf + done, len);
+		else
+			memcpy(buf + done, addr + offset, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		done += len;
+	}
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * ZS_ALMOST_EMPTY_FRAC <= class->objs_per_zspage)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/* Move zspage to the list matching its use. Called with class->lock */
+static void fix_fullness_group(struct size_class *class,
+			struct zspage *zspage)
+{
+	enum fullness_group fg = get_fullness_group(class, zspage);
+
+	if (fg == zspage->fullness)
+		return;
+
+	list_move(&zspage->list, &class->fullness_list[fg]);
+	zspage->fullness = fg;
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	unsigned int obj_idx;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			while (i--)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+	}
+
+	/* Link all objects into the free list */
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage; obj_idx++) {
+		unsigned long next = obj_idx + 1;
+
+		if (next == class->objs_per_zspage)
+			next = ZS_OBJ_END;
+		write_obj_header(class, zspage, obj_idx,
+				next << OBJ_FREE_SHIFT);
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->freeobj = 0;
+	zspage->inuse = 0;
+	zspage->fullness = ZS_ALMOST_EMPTY;
+
+	return zspage;
+}
+
+/* Take a free object off zspage for handle h. Called with class->lock */
+static unsigned int obj_malloc(struct size_class *class,
+			struct zspage *zspage, struct zs_handle *h)
+{
+	unsigned int obj_idx = zspage->freeobj;
+
+	zspage->freeobj = read_obj_header(class, zspage, obj_idx) >>
+				OBJ_FREE_SHIFT;
+	write_obj_header(class, zspage, obj_idx,
+			(unsigned long)h | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+
+	h->zspage = zspage;
+	h->obj_idx = obj_idx;
+	h->class_idx = class->index;
+
+	return obj_idx;
+}
+
+/* Called with class->lock */
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx)
+{
+	write_obj_header(class, zspage, obj_idx,
+			(unsigned long)zspage->freeobj << OBJ_FREE_SHIFT);
+	zspage->freeobj = obj_idx;
+	zspage->inuse--;
+}
+
+static struct zspage *find_partial_zspage(struct size_class *class)
+{
+	struct list_head *list;
+
+	list = &class->fullness_list[ZS_ALMOST_FULL];
+	if (list_empty(list))
+		list = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (list_empty(list))
+		return NULL;
+
+	return list_first_entry(list, struct zspage, list);
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: flags for allocating pages and metadata
+ *
+ * Returns handle to the object, or 0 on failure. The object must be
+ * mapped with zs_map_object() to get at its contents.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	struct zs_handle *h;
+
+	size += ZS_HEADER_SIZE;
+	if (unlikely(size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	h = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (!h)
+		return 0;
+
+	spin_lock(&class->lock);
+	zspage = find_partial_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, h);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list,
+			&class->fullness_list[zspage->fullness]);
+		class->zspages++;
+	}
+
+	obj_malloc(class, zspage, h);
+	fix_fullness_group(class, zspage);
+	class->objs_inuse++;
+	spin_unlock(&class->lock);
+
+	return (unsigned long)h;
+}
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!h))
+		return;
+
+	class = &pool->size_class[h->class_idx];
+
+	spin_lock(&class->lock);
+	zspage = h->zspage;
+	obj_free(class, zspage, h->obj_idx);
+	class->objs_inuse--;
+
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		class->zspages--;
+	} else {
+		fix_fullness_group(class, zspage);
+		zspage = NULL;
+	}
+	spin_unlock(&class->lock);
+
+	if (zspage)
+		free_zspage(class, zspage);
+	kmem_cache_free(zs_handle_cache, h);
+}
+
+/**
+ * zs_map_object - Get a pointer to the contents of an object.
+ * @pool: pool the object belongs to
+ * @handle: handle returned by zs_malloc()
+ * @mm: how the object will be accessed
+ *
+ * Must be paired with zs_unmap_object(), without sleeping in between.
+ * Only one object can be mapped at a time on each CPU.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zs_map_area *area;
+	struct page *page;
+	unsigned long offset;
+
+	class = &pool->size_class[h->class_idx];
+	spin_lock(&class->lock);
+
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+	area->mm = mm;
+
+	obj_location(class, h->zspage, h->obj_idx, &page, &offset);
+	if (offset + class->size <= PAGE_SIZE) {
+		area->spanned = 0;
+		area->vaddr = kmap_atomic(page, KM_USER1);
+		return area->vaddr + offset + ZS_HEADER_SIZE;
+	}
+
+	area->spanned = 1;
+	if (mm != ZS_MM_WO)
+		copy_obj(class, h->zspage, h->obj_idx, area->buf,
+			ZS_HEADER_SIZE, 0);
+	return area->buf + ZS_HEADER_SIZE;
+}
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zs_map_area *area;
+
+	class = &pool->size_class[h->class_idx];
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+
+	if (!area->spanned)
+		kunmap_atomic(area->vaddr, KM_USER1);
+	else if (area->mm != ZS_MM_RO)
+		copy_obj(class, h->zspage, h->obj_idx, area->buf,
+			ZS_HEADER_SIZE, 1);
+
+	spin_unlock(&class->lock);
+}
+
+/*
+ * Move all objects it can from src into dst. Returns 1 if src was
+ * emptied. Called with class->lock, which keeps the per-cpu buffer
+ * ours: no object can be mapped on this CPU meanwhile.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src, struct zspage *dst)
+{
+	unsigned int obj_idx, dst_idx;
+	unsigned long header;
+	struct zs_handle *h;
+	char *buf;
+
+	buf = per_cpu_ptr(pool->map_area, smp_processor_id())->buf;
+
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage; obj_idx++) {
+		if (!src->inuse || dst->inuse == class->objs_per_zspage)
+			break;
+
+		header = read_obj_header(class, src, obj_idx);
+		if (!(header & OBJ_ALLOCATED_TAG))
+			continue;
+		h = (struct zs_handle *)(header & ~OBJ_ALLOCATED_TAG);
+
+		copy_obj(class, src, obj_idx, buf, 0, 0);
+		dst_idx = obj_malloc(class, dst, h);
+		copy_obj(class, dst, dst_idx, buf, 0, 1);
+		obj_free(class, src, obj_idx);
+		class->objs_moved++;
+	}
+
+	fix_fullness_group(class, dst);
+	if (src->inuse) {
+		fix_fullness_group(class, src);
+		return 0;
+	}
+
+	list_del(&src->list);
+	class->zspages--;
+	class->pages_compacted += class->pages_per_zspage;
+	return 1;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+			struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct list_head *empty, *full;
+	struct zspage *src, *dst;
+
+	empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+	full = &class->fullness_list[ZS_ALMOST_FULL];
+
+	spin_lock(&class->lock);
+	while (!list_empty(empty)) {
+		src = list_first_entry(empty, struct zspage, list);
+
+		/* Fill the fullest zspages first */
+		if (!list_empty(full))
+			dst = list_first_entry(full, struct zspage, list);
+		else if (!list_is_singular(empty))
+			dst = list_entry(empty->prev, struct zspage, list);
+		else
+			break;
+
+		if (!migrate_zspage(pool, class, src, dst))
+			continue;
+
+		spin_unlock(&class->lock);
+		free_zspage(class, src);
+		freed += class->pages_per_zspage;
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Move objects out of sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += compact_class(pool, &pool->size_class[i]);
+
+	return freed;
+}
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	int i;
+	u64 npages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		npages += class->zspages * class->pages_per_zspage;
+		spin_unlock(&class->lock);
+	}
+
+	return npages << PAGE_SHIFT;
+}
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->total_size += (class->zspages *
+				class->pages_per_zspage) << PAGE_SHIFT;
+		stats->obj_size += class->objs_inuse * class->size;
+		stats->pages_compacted += class->pages_compacted;
+		stats->objs_moved += class->objs_moved;
+		spin_unlock(&class->lock);
+	}
+}
+
+static void free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	if (!pool->map_area)
+		return;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+/*
+ * Create a memory pool. Sets up size classes, per-cpu mapping
+ * buffers and other per-pool metadata.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	mutex_lock(&zs_cache_lock);
+	if (!zs_cache_users) {
+		zs_handle_cache = KMEM_CACHE(zs_handle, 0);
+		if (!zs_handle_cache) {
+			mutex_unlock(&zs_cache_lock);
+			return NULL;
+		}
+	}
+	zs_cache_users++;
+	mutex_unlock(&zs_cache_lock);
+
+	pool = vmalloc(sizeof(*pool));
+	if (!pool)
+		goto out_cache;
+	memset(pool, 0, sizeof(*pool));
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		int fg;
+
+		spin_lock_init(&class->lock);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto out_pool;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto out_pool;
+	}
+
+	return pool;
+
+out_pool:
+	free_map_areas(pool);
+	vfree(pool);
+out_cache:
+	mutex_lock(&zs_cache_lock);
+	if (!--zs_cache_users)
+		kmem_cache_destroy(zs_handle_cache);
+	mutex_unlock(&zs_cache_lock);
+	return NULL;
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		struct zspage *zspage, *tmp;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty zspage of class %d\n",
+					class->size);
+				free_zspage(class, zspage);
+			}
+		}
+	}
+
+	free_map_areas(pool);
+	vfree(pool);
+
+	mutex_lock(&zs_cache_lock);
+	if (!--zs_cache_users)
+		kmem_cache_destroy(zs_handle_cache);
+	mutex_unlock(&zs_cache_lock);
+}
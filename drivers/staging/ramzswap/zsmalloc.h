@@ -0,0 +1,51 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+struct zs_pool;
+
+/*
+ * How a mapped object is going to be accessed. Objects spanning two
+ * pages are copied through a bounce buffer; the mode saves copying
+ * in the direction that is not needed.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,
+	ZS_MM_RO,
+	ZS_MM_WO,
+};
+
+struct zs_pool_stats {
+	u64 total_size;		/* bytes of pages backing the pool */
+	u64 obj_size;		/* bytes of allocated size class slots */
+	u64 pages_compacted;	/* pages freed by compaction */
+	u64 objs_moved;		/* objects moved by compaction */
+};
+
+struct zs_pool *zs_create_pool(void);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
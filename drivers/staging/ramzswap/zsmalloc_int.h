@@ -0,0 +1,104 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/* Largest number of pages making up one zspage */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Size classes are separated by this many bytes. Must be a multiple
+ * of ZS_HEADER_SIZE so that object headers never cross a page.
+ */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/* zspages with at most 1/ZS_ALMOST_EMPTY_FRAC in use are compacted */
+#define ZS_ALMOST_EMPTY_FRAC	2
+
+/* End of user params */
+
+/*
+ * Every object starts with a header word. For allocated objects it
+ * points back to the handle, which is what lets compaction move it;
+ * for free objects it holds the index of the next free object.
+ */
+#define ZS_HEADER_SIZE		sizeof(unsigned long)
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_FREE_SHIFT		1
+#define ZS_OBJ_END		0xffff
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE pages holding
+ * objects of one size class back to back, so objects may span a page
+ * boundary. Empty zspages are freed right away.
+ */
+struct zspage {
+	struct list_head list;
+	u16 inuse;
+	u16 freeobj;
+	u8 fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+/* What zs_malloc() hands out; stays put while the object moves */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 obj_idx;
+	u16 class_idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	u32 size;		/* object size, header included */
+	u16 index;
+	u16 pages_per_zspage;
+	u16 objs_per_zspage;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+
+	/* stats, under lock */
+	u64 zspages;
+	u64 objs_inuse;
+	u64 pages_compacted;
+	u64 objs_moved;
+};
+
+/* Per-cpu state of a mapped object */
+struct zs_map_area {
+	char *buf;		/* bounce buffer for spanning objects */
+	void *vaddr;		/* kmap_atomic address otherwise */
+	int spanned;
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct zs_map_area __percpu *map_area;
+};
+
+#endif
@@ -55,6 +55,7 @@
 #include <linux/fsnotify.h>
 #include <linux/fs_struct.h>
 #include <linux/pipe_fs_i.h>
+#include <linux/oom.h>
 
 #include <asm/uaccess.h>
 #include <asm/mmu_context.h>
@@ -900,6 +901,8 @@ static int de_thread(struct task_struct *tsk)
 		leader->exit_state = EXIT_DEAD;
 		write_unlock_irq(&tasklist_lock);
 
+		/* we take over the old leader's place in the oom_adj lists */
+		lowmem_task_add(tsk);
 		release_task(leader);
 	}
 
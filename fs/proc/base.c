@@ -1049,6 +1049,7 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	task->signal->oom_adj = oom_adjust;
 
 	unlock_task_sighand(task, &flags);
+	lowmem_task_adj_changed(task);
 	put_task_struct(task);
 
 	return count;
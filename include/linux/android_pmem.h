@@ -34,6 +34,11 @@
  */
 #define PMEM_GET_TOTAL_SIZE	_IOW(PMEM_IOCTL_MAGIC, 7, unsigned int)
 #define PMEM_CACHE_FLUSH	_IOW(PMEM_IOCTL_MAGIC, 8, unsigned int)
+/* Wraps the allocation into a shared DMA buffer (see linux/dma-buf.h)
+ * and returns its file descriptor. The allocation is kept until both
+ * files are closed.
+ */
+#define PMEM_EXPORT		_IO(PMEM_IOCTL_MAGIC, 9)
 
 struct android_pmem_platform_data
 {
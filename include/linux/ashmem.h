@@ -32,6 +32,18 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+struct ashmem_pin_batch {
+	__u64 pins;	/* user pointer to an array of struct ashmem_pin */
+	__u32 count;	/* number of entries in 'pins' */
+	__u32 __pad;
+};
+
+struct ashmem_purge_stats {
+	__u32 purge_count;	/* unpinned ranges reclaimed */
+	__u32 purged_pages;	/* pages reclaimed while unpinned */
+	__u32 pin_purged;	/* pins that found their pages purged */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +56,8 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_PIN_BATCH	_IOW(__ASHMEMIOC, 11, struct ashmem_pin_batch)
+#define ASHMEM_UNPIN_BATCH	_IOW(__ASHMEMIOC, 12, struct ashmem_pin_batch)
+#define ASHMEM_GET_PURGE_STATS	_IOR(__ASHMEMIOC, 13, struct ashmem_purge_stats)
 
 #endif	/* _LINUX_ASHMEM_H */
@@ -48,6 +48,13 @@ struct cma_alloc_request {
 
 #define IOCTL_CMA_ALLOC    _IOWR('p', 0, struct cma_alloc_request)
 
+/*
+ * Wraps the chunk allocated on the file into a shared DMA buffer and
+ * returns its file descriptor (see <linux/dma-buf.h>).  The chunk
+ * stays allocated until both files are closed.
+ */
+#define IOCTL_CMA_EXPORT   _IO('p', 1)
+
 
 /***************************** Kernel level API *****************************/
 
@@ -55,6 +62,7 @@ struct cma_alloc_request {
 
 #include <linux/rbtree.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #if defined CONFIG_CMA_SYSFS
 #  include <linux/kobject.h>
 #endif
@@ -215,6 +223,9 @@ struct cma_allocator;
  * @private_data:	Allocator's private data.
  * @users:	Number of chunks allocated in this region.
  * @list:	Entry in list of regions.  Private.
+ * @mutex:	Serialises allocations and freeing in this region and
+ *		protects @free_space, @users and the statistics.
+ *		Private.
  * @used:	Whether region was already used, ie. there was at least
  *		one allocation request for.  Private.
  * @registered:	Whether this region has been registered.  Read only.
@@ -223,6 +234,16 @@ struct cma_allocator;
  *		this region is converted from early to normal.  Early.
  *		Private.
  * @free_alloc_name:	Whether @alloc_name was kmalloced().  Private.
+ * @movable:	Whether free space of the region may be lent to movable
+ *		page allocations.  Early.
+ * @lent_start:	First pfn lent to the page allocator.  Private.
+ * @lent_end:	One past the last pfn lent to the page allocator.
+ *		Private.
+ * @latency:	Histogram of allocation times, bucket n counting
+ *		allocations that took less than 2^n microseconds.
+ *		Private.
+ * @latency_max:	Longest allocation time in microseconds.  Private.
+ * @failures:	Number of failed allocation attempts.  Private.
  *
  * Regions come in two types: an early region and normal region.  The
  * former can be reserved or not-reserved.  Fields marked as "early"
@@ -253,16 +274,29 @@ struct cma_region {
 
 	unsigned users;
 	struct list_head list;
+	struct mutex mutex;
 
 #if defined CONFIG_CMA_SYSFS
 	struct kobject kobj;
 #endif
 
+#if defined CONFIG_CMA_MIGRATE
+	unsigned long lent_start, lent_end;
+#endif
+
+#if defined CONFIG_CMA_SYSFS
+#  define CMA_LATENCY_BUCKETS 20
+	unsigned long latency[CMA_LATENCY_BUCKETS];
+	unsigned long latency_max;
+	unsigned long failures;
+#endif
+
 	unsigned used:1;
 	unsigned registered:1;
 	unsigned reserved:1;
 	unsigned copy_name:1;
 	unsigned free_alloc_name:1;
+	unsigned movable:1;
 };
 
 
@@ -354,12 +388,16 @@ struct cma_chunk {
  *		two (thus non-zero) and callback does not need to check it.
  *		May also assume that it is the only call that uses given
  *		region (ie. access to the region is synchronised with
- *		a mutex).  This has to allocate the chunk object (it may be
- *		contained in a bigger structure with allocator-specific data.
+ *		the region's mutex).  This has to allocate the chunk
+ *		object (it may be contained in a bigger structure with
+ *		allocator-specific data.
  *		Required.
  * @free:	Frees allocated chunk.  May also assume that it is the only
  *		call that uses given region.  This has to free() the chunk
  *		object as well.  Required.
+ * @holes:	Reports the number of free holes in the region and the
+ *		size of the largest one.  Called with the region's mutex
+ *		held.  Optional.
  * @list:	Entry in list of allocators.  Private.
  */
 struct cma_allocator {
@@ -370,6 +408,8 @@ struct cma_allocator {
 	struct cma_chunk *(*alloc)(struct cma_region *reg, size_t size,
 				   dma_addr_t alignment);
 	void (*free)(struct cma_chunk *chunk);
+	void (*holes)(struct cma_region *reg, size_t *largest,
+		      unsigned *count);
 
 	struct list_head list;
 };
@@ -477,6 +517,18 @@ int __init cma_early_region_reserve(struct cma_region *reg);
  */
 void __init cma_early_regions_reserve(int (*reserve)(struct cma_region *reg));
 
+/**
+ * cma_arch_flush_range() - cleans and invalidates caches for a range.
+ * @start:	Bus address of the range.
+ * @size:	Size of the range in bytes.
+ *
+ * Called when memory that was lent to the page allocator is taken
+ * back for a chunk, so that dirty lines left behind by its previous
+ * users do not end up on top of data written by a device.  The
+ * default implementation does nothing.
+ */
+void cma_arch_flush_range(dma_addr_t start, size_t size);
+
 #else
 
 #define cma_set_defaults(regions, map)     ((int)0)
@@ -0,0 +1,192 @@
+#ifndef __LINUX_DMA_BUF_H
+#define __LINUX_DMA_BUF_H
+
+/*
+ * Shared DMA buffers
+ *
+ * A dma-buf is a file descriptor wrapping a buffer that one driver
+ * (the exporter) allocated, so that other drivers (importers) can
+ * use it for DMA without copying it or passing physical addresses
+ * through user space.  See Documentation/dma-buf-sharing.txt.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+
+/**
+ * Argument of DMA_BUF_IOCTL_SYNC.
+ * @flags:	DMA_BUF_SYNC_START or DMA_BUF_SYNC_END, or-ed with the
+ *		access (DMA_BUF_SYNC_READ and/or DMA_BUF_SYNC_WRITE)
+ *		the process is going to do or has done through its
+ *		mapping of the buffer.
+ */
+struct dma_buf_sync {
+	__u64 flags;
+};
+
+#define DMA_BUF_SYNC_READ	(1 << 0)
+#define DMA_BUF_SYNC_WRITE	(2 << 0)
+#define DMA_BUF_SYNC_RW		(DMA_BUF_SYNC_READ | DMA_BUF_SYNC_WRITE)
+#define DMA_BUF_SYNC_START	(0 << 2)
+#define DMA_BUF_SYNC_END	(1 << 2)
+#define DMA_BUF_SYNC_VALID_FLAGS_MASK \
+	(DMA_BUF_SYNC_RW | DMA_BUF_SYNC_END)
+
+#define DMA_BUF_IOCTL_SYNC	_IOW('b', 0, struct dma_buf_sync)
+
+
+#ifdef __KERNEL__
+
+#include <linux/err.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+
+struct device;
+struct file;
+struct vm_area_struct;
+struct dma_buf;
+
+/**
+ * Exporter callbacks.
+ * @release:	called when the last reference to the buffer goes away;
+ *		the exporter frees the backing store and the sg_table it
+ *		passed to dma_buf_export().  Mandatory.
+ * @mmap:	maps the buffer into user space.  Optional; by default
+ *		the pages of the sg_table are mapped with the page
+ *		protection of the vma.
+ */
+struct dma_buf_ops {
+	void (*release)(struct dma_buf *buf);
+	int (*mmap)(struct dma_buf *buf, struct vm_area_struct *vma);
+};
+
+/**
+ * Who last touched the buffer.  Cache maintenance is done only when
+ * the buffer changes hands between the CPU and the devices, and only
+ * in the direction that is actually needed: devices handing a buffer
+ * to one another (camera to codec to display) never cause any.
+ */
+enum dma_buf_owner {
+	DMA_BUF_OWNER_CPU,
+	DMA_BUF_OWNER_DEVICE,
+};
+
+/**
+ * A shared buffer.
+ * @size:	size of the buffer in bytes.
+ * @sgt:	pages backing the buffer; owned by the exporter.
+ * @dev:	exporter's device, used for cache maintenance.
+ * @ops:	exporter callbacks.
+ * @priv:	exporter's private data.
+ * @name:	exporter's name, for debugging.
+ * @file:	file the buffer is wrapped into.
+ * @lock:	protects the fields below.
+ * @attachments: list of dma_buf_attachment.
+ * @owner:	who last had access to the buffer.
+ * @cpu_dirty:	CPU caches may hold data the devices have not seen.
+ * @dev_dirty:	devices may have written data the CPU caches hide.
+ * @cpu_users:	number of begin_cpu_access() without end_cpu_access().
+ * @syncs_for_device: number of times caches were cleaned for devices.
+ * @syncs_for_cpu: number of times caches were invalidated for the CPU.
+ */
+struct dma_buf {
+	size_t size;
+	struct sg_table *sgt;
+	struct device *dev;
+	const struct dma_buf_ops *ops;
+	void *priv;
+	const char *name;
+	struct file *file;
+
+	struct mutex lock;
+	struct list_head attachments;
+	enum dma_buf_owner owner;
+	unsigned cpu_dirty:1;
+	unsigned dev_dirty:1;
+	unsigned cpu_users;
+	unsigned long syncs_for_device;
+	unsigned long syncs_for_cpu;
+};
+
+/**
+ * An importer's use of a buffer.
+ * @dmabuf:	the buffer.
+ * @dev:	importing device.
+ * @node:	entry in dmabuf->attachments.
+ * @sgt:	the buffer as seen by @dev; valid while mapped.
+ * @dir:	direction of the current mapping.
+ * @mapped:	number of dma_buf_map_attachment() not yet unmapped.
+ * @priv:	importer's private data.
+ */
+struct dma_buf_attachment {
+	struct dma_buf *dmabuf;
+	struct device *dev;
+	struct list_head node;
+	struct sg_table sgt;
+	enum dma_data_direction dir;
+	unsigned mapped;
+	void *priv;
+};
+
+
+#ifdef CONFIG_DMA_SHARED_BUFFER
+
+/* Exporter API */
+struct dma_buf *dma_buf_export(struct device *dev, struct sg_table *sgt,
+			       size_t size, const struct dma_buf_ops *ops,
+			       void *priv, const char *name);
+struct dma_buf *dma_buf_export_contig(struct device *dev, dma_addr_t start,
+				      size_t size, void (*release)(void *priv),
+				      void *priv, const char *name);
+int dma_buf_fd(struct dma_buf *dmabuf, int flags);
+
+/* Importer API */
+struct dma_buf *dma_buf_get(int fd);
+void dma_buf_put(struct dma_buf *dmabuf);
+
+struct dma_buf_attachment *dma_buf_attach(struct dma_buf *dmabuf,
+					  struct device *dev);
+void dma_buf_detach(struct dma_buf *dmabuf,
+		    struct dma_buf_attachment *attach);
+struct sg_table *dma_buf_map_attachment(struct dma_buf_attachment *attach,
+					enum dma_data_direction dir);
+void dma_buf_unmap_attachment(struct dma_buf_attachment *attach);
+
+int dma_buf_begin_cpu_access(struct dma_buf *dmabuf,
+			     enum dma_data_direction dir);
+void dma_buf_end_cpu_access(struct dma_buf *dmabuf,
+			    enum dma_data_direction dir);
+
+/**
+ * dma_buf_phys() - returns physical address of a contiguous buffer.
+ * @dmabuf:	the buffer.
+ *
+ * For importers which can only deal with physically contiguous
+ * memory.  Returns zero if the buffer is scattered.  The importer
+ * must still map an attachment around its DMA so that caches are
+ * maintained.
+ */
+static inline dma_addr_t dma_buf_phys(struct dma_buf *dmabuf)
+{
+	return dmabuf->sgt->nents == 1 ? sg_phys(dmabuf->sgt->sgl) : 0;
+}
+
+#else
+
+static inline struct dma_buf *dma_buf_get(int fd)
+{
+	return ERR_PTR(-ENOSYS);
+}
+
+static inline void dma_buf_put(struct dma_buf *dmabuf)
+{
+}
+
+#endif
+
+#endif /* __KERNEL__ */
+
+#endif /* __LINUX_DMA_BUF_H */
@@ -40,8 +40,22 @@
 #define MIGRATE_MOVABLE       2
 #define MIGRATE_PCPTYPES      3 /* the number of types on the pcp lists */
 #define MIGRATE_RESERVE       3
+#ifdef CONFIG_CMA_MIGRATE
+/*
+ * Free pages of CMA regions are kept on their own list.  Only movable
+ * allocations may fall back to it and pageblocks of this type are
+ * never taken over by another type, so the region can always be
+ * emptied again by migrating the pages away.
+ */
+#define MIGRATE_CMA           4
+#define MIGRATE_ISOLATE       5 /* can't allocate from here */
+#define MIGRATE_TYPES         6
+#define is_migrate_cma(migratetype) unlikely((migratetype) == MIGRATE_CMA)
+#else
 #define MIGRATE_ISOLATE       4 /* can't allocate from here */
 #define MIGRATE_TYPES         5
+#define is_migrate_cma(migratetype) false
+#endif
 
 #define for_each_migratetype_order(order, type) \
 	for (order = 0; order < MAX_ORDER; order++) \
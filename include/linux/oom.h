@@ -14,6 +14,7 @@
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -43,5 +44,22 @@ static inline void oom_killer_enable(void)
 {
 	oom_killer_disabled = false;
 }
+
+/*
+ * The Android lowmemorykiller keeps every thread group leader in a list per
+ * oom_adj value. These hooks keep those lists in step with fork, exec, exit
+ * and writes to /proc/<pid>/oom_adj. They take a spinlock of their own and
+ * must not be called with tasklist_lock or a sighand lock held.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_add(struct task_struct *p);
+extern void lowmem_task_del(struct task_struct *p);
+extern void lowmem_task_adj_changed(struct task_struct *p);
+#else
+static inline void lowmem_task_add(struct task_struct *p) { }
+static inline void lowmem_task_del(struct task_struct *p) { }
+static inline void lowmem_task_adj_changed(struct task_struct *p) { }
+#endif
+
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
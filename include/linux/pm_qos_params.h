@@ -10,15 +10,22 @@
 #define PM_QOS_CPU_DMA_LATENCY 1
 #define PM_QOS_NETWORK_LATENCY 2
 #define PM_QOS_NETWORK_THROUGHPUT 3
+#define PM_QOS_CPU_FREQ_MIN 4
+#define PM_QOS_CPU_FREQ_MAX 5
+#define PM_QOS_BUS_THROUGHPUT 6
 
-#define PM_QOS_NUM_CLASSES 4
+#define PM_QOS_NUM_CLASSES 7
 #define PM_QOS_DEFAULT_VALUE -1
 
 struct pm_qos_request_list;
 
 struct pm_qos_request_list *pm_qos_add_request(int pm_qos_class, s32 value);
+struct pm_qos_request_list *pm_qos_add_named_request(int pm_qos_class,
+		s32 value, const char *name);
 void pm_qos_update_request(struct pm_qos_request_list *pm_qos_req,
 		s32 new_value);
+void pm_qos_update_request_timeout(struct pm_qos_request_list *pm_qos_req,
+		s32 new_value, unsigned long timeout_us);
 void pm_qos_remove_request(struct pm_qos_request_list *pm_qos_req);
 
 int pm_qos_request(int pm_qos_class);
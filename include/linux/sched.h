@@ -141,6 +141,8 @@ extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
+extern unsigned long cpu_runnable_load(int cpu);
+extern u64 sched_nr_running_sum(int cpu, u64 *clock);
 
 
 extern void calc_global_load(unsigned long ticks);
@@ -1220,6 +1222,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_node;	/* lowmemorykiller oom_adj bucket */
+#endif
 	struct plist_node pushable_tasks;
 
 	struct mm_struct *mm, *active_mm;
@@ -50,6 +50,7 @@
 #include <linux/perf_event.h>
 #include <trace/events/sched.h>
 #include <linux/hw_breakpoint.h>
+#include <linux/oom.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -212,6 +213,7 @@ repeat:
 	}
 
 	write_unlock_irq(&tasklist_lock);
+	lowmem_task_del(p);
 	release_thread(p);
 	call_rcu(&p->rcu, delayed_put_task_struct);
 
@@ -13,9 +13,16 @@
  * latency: usec
  * timeout: usec <-- currently not used.
  * throughput: kbs (kilo byte / sec)
+ * frequency: kHz
  *
  * There are lists of pm_qos_objects each one wrapping requests, notifiers
  *
+ * Requests are kept sorted by value in a plist, so the target value of a
+ * class is the first or the last request and is found in constant time
+ * however many requests there are.  A request may be given a timeout after
+ * which it falls back to the default value, and a name which is shown,
+ * together with its value, in debugfs under pm_qos/.
+ *
  * User mode requests on a QOS parameter register themselves to the
  * subsystem by opening the device node /dev/... and writing there request to
  * the node.  As long as the process holds a file handle open to the node the
@@ -40,6 +47,10 @@
 #include <linux/string.h>
 #include <linux/platform_device.h>
 #include <linux/init.h>
+#include <linux/plist.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <linux/uaccess.h>
 
@@ -49,58 +60,93 @@
  * held, taken with _irqsave.  One lock to rule them all
  */
 struct pm_qos_request_list {
-	struct list_head list;
-	union {
-		s32 value;
-		s32 usec;
-		s32 kbps;
-	};
+	struct plist_node list;		/* value is list.prio */
 	int pm_qos_class;
+	const char *name;
+	unsigned long caller;		/* shown when there is no name */
+	pid_t pid;			/* user space request, or 0 */
+	struct delayed_work work;	/* timeout */
 };
 
-static s32 max_compare(s32 v1, s32 v2);
-static s32 min_compare(s32 v1, s32 v2);
+enum pm_qos_type {
+	PM_QOS_MAX,		/* return the largest value */
+	PM_QOS_MIN,		/* return the smallest value */
+};
 
 struct pm_qos_object {
-	struct pm_qos_request_list requests;
+	struct plist_head requests;
 	struct blocking_notifier_head *notifiers;
 	struct miscdevice pm_qos_power_miscdev;
 	char *name;
 	s32 default_value;
 	atomic_t target_value;
-	s32 (*comparitor)(s32, s32);
+	enum pm_qos_type type;
 };
 
+static DEFINE_SPINLOCK(pm_qos_lock);
+
 static struct pm_qos_object null_pm_qos;
 static BLOCKING_NOTIFIER_HEAD(cpu_dma_lat_notifier);
 static struct pm_qos_object cpu_dma_pm_qos = {
-	.requests = {LIST_HEAD_INIT(cpu_dma_pm_qos.requests.list)},
+	.requests = PLIST_HEAD_INIT(cpu_dma_pm_qos.requests, pm_qos_lock),
 	.notifiers = &cpu_dma_lat_notifier,
 	.name = "cpu_dma_latency",
 	.default_value = 2000 * USEC_PER_SEC,
 	.target_value = ATOMIC_INIT(2000 * USEC_PER_SEC),
-	.comparitor = min_compare
+	.type = PM_QOS_MIN,
 };
 
 static BLOCKING_NOTIFIER_HEAD(network_lat_notifier);
 static struct pm_qos_object network_lat_pm_qos = {
-	.requests = {LIST_HEAD_INIT(network_lat_pm_qos.requests.list)},
+	.requests = PLIST_HEAD_INIT(network_lat_pm_qos.requests, pm_qos_lock),
 	.notifiers = &network_lat_notifier,
 	.name = "network_latency",
 	.default_value = 2000 * USEC_PER_SEC,
 	.target_value = ATOMIC_INIT(2000 * USEC_PER_SEC),
-	.comparitor = min_compare
+	.type = PM_QOS_MIN,
 };
 
 
 static BLOCKING_NOTIFIER_HEAD(network_throughput_notifier);
 static struct pm_qos_object network_throughput_pm_qos = {
-	.requests = {LIST_HEAD_INIT(network_throughput_pm_qos.requests.list)},
+	.requests = PLIST_HEAD_INIT(network_throughput_pm_qos.requests,
+				    pm_qos_lock),
 	.notifiers = &network_throughput_notifier,
 	.name = "network_throughput",
 	.default_value = 0,
 	.target_value = ATOMIC_INIT(0),
-	.comparitor = max_compare
+	.type = PM_QOS_MAX,
+};
+
+static BLOCKING_NOTIFIER_HEAD(cpu_freq_min_notifier);
+static struct pm_qos_object cpu_freq_min_pm_qos = {
+	.requests = PLIST_HEAD_INIT(cpu_freq_min_pm_qos.requests, pm_qos_lock),
+	.notifiers = &cpu_freq_min_notifier,
+	.name = "cpu_freq_min",
+	.default_value = 0,
+	.target_value = ATOMIC_INIT(0),
+	.type = PM_QOS_MAX,
+};
+
+static BLOCKING_NOTIFIER_HEAD(cpu_freq_max_notifier);
+static struct pm_qos_object cpu_freq_max_pm_qos = {
+	.requests = PLIST_HEAD_INIT(cpu_freq_max_pm_qos.requests, pm_qos_lock),
+	.notifiers = &cpu_freq_max_notifier,
+	.name = "cpu_freq_max",
+	.default_value = INT_MAX,
+	.target_value = ATOMIC_INIT(INT_MAX),
+	.type = PM_QOS_MIN,
+};
+
+static BLOCKING_NOTIFIER_HEAD(bus_throughput_notifier);
+static struct pm_qos_object bus_throughput_pm_qos = {
+	.requests = PLIST_HEAD_INIT(bus_throughput_pm_qos.requests,
+				    pm_qos_lock),
+	.notifiers = &bus_throughput_notifier,
+	.name = "bus_throughput",
+	.default_value = 0,
+	.target_value = ATOMIC_INIT(0),
+	.type = PM_QOS_MAX,
 };
 
 
@@ -108,11 +154,12 @@ static struct pm_qos_object *pm_qos_array[] = {
 	&null_pm_qos,
 	&cpu_dma_pm_qos,
 	&network_lat_pm_qos,
-	&network_throughput_pm_qos
+	&network_throughput_pm_qos,
+	&cpu_freq_min_pm_qos,
+	&cpu_freq_max_pm_qos,
+	&bus_throughput_pm_qos,
 };
 
-static DEFINE_SPINLOCK(pm_qos_lock);
-
 static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
 		size_t count, loff_t *f_pos);
 static int pm_qos_power_open(struct inode *inode, struct file *filp);
@@ -125,45 +172,104 @@ static const struct file_operations pm_qos_power_fops = {
 };
 
 /* static helper functions */
-static s32 max_compare(s32 v1, s32 v2)
-{
-	return max(v1, v2);
-}
 
-static s32 min_compare(s32 v1, s32 v2)
+/* must be called with pm_qos_lock held */
+static s32 pm_qos_get_value(struct pm_qos_object *o)
 {
-	return min(v1, v2);
+	if (plist_head_empty(&o->requests))
+		return o->default_value;
+
+	switch (o->type) {
+	case PM_QOS_MIN:
+		return plist_first(&o->requests)->prio;
+	case PM_QOS_MAX:
+		return plist_last(&o->requests)->prio;
+	default:
+		BUG();
+	}
 }
 
+/*
+ * Adds @req to, removes it from or moves it within the requests of its
+ * class, then updates the target value.  plist keeps the requests
+ * sorted, so a request changing its value is taken out and put back.
+ */
+enum pm_qos_req_action {
+	PM_QOS_ADD_REQ,
+	PM_QOS_UPDATE_REQ,
+	PM_QOS_REMOVE_REQ,
+};
 
-static void update_target(int pm_qos_class)
+static void update_target(struct pm_qos_request_list *req,
+			  enum pm_qos_req_action action, s32 value)
 {
+	int pm_qos_class = req->pm_qos_class;
+	struct pm_qos_object *o = pm_qos_array[pm_qos_class];
 	s32 extreme_value;
-	struct pm_qos_request_list *node;
 	unsigned long flags;
 	int call_notifier = 0;
 
+	if (value == PM_QOS_DEFAULT_VALUE)
+		value = o->default_value;
+
 	spin_lock_irqsave(&pm_qos_lock, flags);
-	extreme_value = pm_qos_array[pm_qos_class]->default_value;
-	list_for_each_entry(node,
-			&pm_qos_array[pm_qos_class]->requests.list, list) {
-		extreme_value = pm_qos_array[pm_qos_class]->comparitor(
-				extreme_value, node->value);
+	switch (action) {
+	case PM_QOS_UPDATE_REQ:
+		if (value == req->list.prio)
+			goto out;
+		plist_del(&req->list, &o->requests);
+		/* fall through */
+	case PM_QOS_ADD_REQ:
+		plist_node_init(&req->list, value);
+		plist_add(&req->list, &o->requests);
+		break;
+	case PM_QOS_REMOVE_REQ:
+		plist_del(&req->list, &o->requests);
+		break;
 	}
-	if (atomic_read(&pm_qos_array[pm_qos_class]->target_value) !=
-			extreme_value) {
+
+	extreme_value = pm_qos_get_value(o);
+	if (atomic_read(&o->target_value) != extreme_value) {
 		call_notifier = 1;
-		atomic_set(&pm_qos_array[pm_qos_class]->target_value,
-				extreme_value);
-		pr_debug(KERN_ERR "new target for qos %d is %d\n", pm_qos_class,
-			atomic_read(&pm_qos_array[pm_qos_class]->target_value));
+		atomic_set(&o->target_value, extreme_value);
+		pr_debug("new target for qos %d is %d\n", pm_qos_class,
+			 extreme_value);
 	}
+out:
 	spin_unlock_irqrestore(&pm_qos_lock, flags);
 
 	if (call_notifier)
-		blocking_notifier_call_chain(
-				pm_qos_array[pm_qos_class]->notifiers,
-					(unsigned long) extreme_value, NULL);
+		blocking_notifier_call_chain(o->notifiers,
+					     (unsigned long) extreme_value, NULL);
+}
+
+static void pm_qos_work_fn(struct work_struct *work)
+{
+	struct pm_qos_request_list *req = container_of(to_delayed_work(work),
+					struct pm_qos_request_list, work);
+
+	update_target(req, PM_QOS_UPDATE_REQ, PM_QOS_DEFAULT_VALUE);
+}
+
+static struct pm_qos_request_list *__pm_qos_add_request(int pm_qos_class,
+		s32 value, const char *name, unsigned long caller)
+{
+	struct pm_qos_request_list *dep;
+
+	if (pm_qos_class <= PM_QOS_RESERVED ||
+	    pm_qos_class >= PM_QOS_NUM_CLASSES)
+		return NULL;
+
+	dep = kzalloc(sizeof(struct pm_qos_request_list), GFP_KERNEL);
+	if (dep) {
+		dep->pm_qos_class = pm_qos_class;
+		dep->name = name;
+		dep->caller = caller;
+		INIT_DELAYED_WORK(&dep->work, pm_qos_work_fn);
+		update_target(dep, PM_QOS_ADD_REQ, value);
+	}
+
+	return dep;
 }
 
 static int register_pm_qos_misc(struct pm_qos_object *qos)
@@ -213,63 +319,69 @@ EXPORT_SYMBOL_GPL(pm_qos_request);
  */
 struct pm_qos_request_list *pm_qos_add_request(int pm_qos_class, s32 value)
 {
-	struct pm_qos_request_list *dep;
-	unsigned long flags;
-
-	dep = kzalloc(sizeof(struct pm_qos_request_list), GFP_KERNEL);
-	if (dep) {
-		if (value == PM_QOS_DEFAULT_VALUE)
-			dep->value = pm_qos_array[pm_qos_class]->default_value;
-		else
-			dep->value = value;
-		dep->pm_qos_class = pm_qos_class;
-
-		spin_lock_irqsave(&pm_qos_lock, flags);
-		list_add(&dep->list,
-			&pm_qos_array[pm_qos_class]->requests.list);
-		spin_unlock_irqrestore(&pm_qos_lock, flags);
-		update_target(pm_qos_class);
-	}
-
-	return dep;
+	return __pm_qos_add_request(pm_qos_class, value, NULL, _RET_IP_);
 }
 EXPORT_SYMBOL_GPL(pm_qos_add_request);
 
+/**
+ * pm_qos_add_named_request - inserts new qos request with an owner name
+ * @pm_qos_class: identifies which list of qos request to us
+ * @value: defines the qos request
+ * @name: owner of the request, shown in debugfs; must stay valid
+ *
+ * Same as pm_qos_add_request().  Requests without a name are shown under
+ * the function which added them.
+ */
+struct pm_qos_request_list *pm_qos_add_named_request(int pm_qos_class,
+		s32 value, const char *name)
+{
+	return __pm_qos_add_request(pm_qos_class, value, name, _RET_IP_);
+}
+EXPORT_SYMBOL_GPL(pm_qos_add_named_request);
+
 /**
  * pm_qos_update_request - modifies an existing qos request
  * @pm_qos_req : handle to list element holding a pm_qos request to use
  * @value: defines the qos request
  *
  * Updates an existing qos request for the pm_qos_class of parameters along
- * with updating the target pm_qos_class value.
- *
- * Attempts are made to make this code callable on hot code paths.
+ * with updating the target pm_qos_class value, and cancels a timeout set
+ * by pm_qos_update_request_timeout(), waiting for it if it is already
+ * running so that it cannot overwrite @value.  Must not be called from
+ * atomic context.
  */
 void pm_qos_update_request(struct pm_qos_request_list *pm_qos_req,
 		s32 new_value)
 {
-	unsigned long flags;
-	int pending_update = 0;
-	s32 temp;
-
 	if (pm_qos_req) { /*guard against callers passing in null */
-		spin_lock_irqsave(&pm_qos_lock, flags);
-		if (new_value == PM_QOS_DEFAULT_VALUE)
-			temp = pm_qos_array[pm_qos_req->pm_qos_class]->default_value;
-		else
-			temp = new_value;
-
-		if (temp != pm_qos_req->value) {
-			pending_update = 1;
-			pm_qos_req->value = temp;
-		}
-		spin_unlock_irqrestore(&pm_qos_lock, flags);
-		if (pending_update)
-			update_target(pm_qos_req->pm_qos_class);
+		cancel_delayed_work_sync(&pm_qos_req->work);
+		update_target(pm_qos_req, PM_QOS_UPDATE_REQ, new_value);
 	}
 }
 EXPORT_SYMBOL_GPL(pm_qos_update_request);
 
+/**
+ * pm_qos_update_request_timeout - modifies a qos request for a while
+ * @pm_qos_req : handle to list element holding a pm_qos request to use
+ * @new_value: defines the qos request
+ * @timeout_us: how long the request lasts, in usecs
+ *
+ * Updates an existing qos request like pm_qos_update_request(), and sets
+ * it back to the default value of its class after @timeout_us unless it
+ * is updated again before then.  Must not be called from atomic context.
+ */
+void pm_qos_update_request_timeout(struct pm_qos_request_list *pm_qos_req,
+		s32 new_value, unsigned long timeout_us)
+{
+	if (pm_qos_req) {
+		cancel_delayed_work_sync(&pm_qos_req->work);
+		update_target(pm_qos_req, PM_QOS_UPDATE_REQ, new_value);
+		schedule_delayed_work(&pm_qos_req->work,
+				      usecs_to_jiffies(timeout_us));
+	}
+}
+EXPORT_SYMBOL_GPL(pm_qos_update_request_timeout);
+
 /**
  * pm_qos_remove_request - modifies an existing qos request
  * @pm_qos_req: handle to request list element
@@ -280,19 +392,13 @@ EXPORT_SYMBOL_GPL(pm_qos_update_request);
  */
 void pm_qos_remove_request(struct pm_qos_request_list *pm_qos_req)
 {
-	unsigned long flags;
-	int qos_class;
-
 	if (pm_qos_req == NULL)
 		return;
 		/* silent return to keep pcm code cleaner */
 
-	qos_class = pm_qos_req->pm_qos_class;
-	spin_lock_irqsave(&pm_qos_lock, flags);
-	list_del(&pm_qos_req->list);
+	cancel_delayed_work_sync(&pm_qos_req->work);
+	update_target(pm_qos_req, PM_QOS_REMOVE_REQ, PM_QOS_DEFAULT_VALUE);
 	kfree(pm_qos_req);
-	spin_unlock_irqrestore(&pm_qos_lock, flags);
-	update_target(qos_class);
 }
 EXPORT_SYMBOL_GPL(pm_qos_remove_request);
 
@@ -340,11 +446,16 @@ static int pm_qos_power_open(struct inode *inode, struct file *filp)
 
 	pm_qos_class = find_pm_qos_object_by_minor(iminor(inode));
 	if (pm_qos_class >= 0) {
-		filp->private_data = (void *) pm_qos_add_request(pm_qos_class,
-				PM_QOS_DEFAULT_VALUE);
+		struct pm_qos_request_list *req;
+
+		req = __pm_qos_add_request(pm_qos_class, PM_QOS_DEFAULT_VALUE,
+					   NULL, 0);
+		filp->private_data = (void *) req;
 
-		if (filp->private_data)
+		if (req) {
+			req->pid = task_tgid_vnr(current);
 			return 0;
+		}
 	}
 	return -EPERM;
 }
@@ -388,24 +499,84 @@ static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
 }
 
 
+#ifdef CONFIG_DEBUG_FS
+/* Target value, then one line per request: value and owner. */
+static int pm_qos_debug_show(struct seq_file *s, void *unused)
+{
+	struct pm_qos_object *o = s->private;
+	struct pm_qos_request_list *req;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	seq_printf(s, "target %d\n", pm_qos_get_value(o));
+	plist_for_each_entry(req, &o->requests, list) {
+		seq_printf(s, "%11d  ", req->list.prio);
+		if (req->name)
+			seq_printf(s, "%s", req->name);
+		else if (req->pid)
+			seq_printf(s, "pid %d", req->pid);
+		else
+			seq_printf(s, "%pS", (void *)req->caller);
+		if (delayed_work_pending(&req->work))
+			seq_printf(s, " (%u ms left)", jiffies_to_msecs(
+				   max_t(long, req->work.timer.expires - jiffies,
+					 0)));
+		seq_printf(s, "\n");
+	}
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+
+	return 0;
+}
+
+static int pm_qos_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pm_qos_debug_show, inode->i_private);
+}
+
+static const struct file_operations pm_qos_debug_fops = {
+	.open = pm_qos_debug_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void __init pm_qos_debug_init(void)
+{
+	struct dentry *dir;
+	int pm_qos_class;
+
+	dir = debugfs_create_dir("pm_qos", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	for (pm_qos_class = PM_QOS_RESERVED + 1;
+		pm_qos_class < PM_QOS_NUM_CLASSES; pm_qos_class++)
+		debugfs_create_file(pm_qos_array[pm_qos_class]->name, 0444,
+				    dir, pm_qos_array[pm_qos_class],
+				    &pm_qos_debug_fops);
+}
+#else
+static inline void pm_qos_debug_init(void)
+{
+}
+#endif
+
 static int __init pm_qos_power_init(void)
 {
 	int ret = 0;
+	int pm_qos_class;
 
-	ret = register_pm_qos_misc(&cpu_dma_pm_qos);
-	if (ret < 0) {
-		printk(KERN_ERR "pm_qos_param: cpu_dma_latency setup failed\n");
-		return ret;
-	}
-	ret = register_pm_qos_misc(&network_lat_pm_qos);
-	if (ret < 0) {
-		printk(KERN_ERR "pm_qos_param: network_latency setup failed\n");
-		return ret;
+	for (pm_qos_class = PM_QOS_RESERVED + 1;
+		pm_qos_class < PM_QOS_NUM_CLASSES; pm_qos_class++) {
+		ret = register_pm_qos_misc(pm_qos_array[pm_qos_class]);
+		if (ret < 0) {
+			printk(KERN_ERR "pm_qos_param: %s setup failed\n",
+			       pm_qos_array[pm_qos_class]->name);
+			return ret;
+		}
 	}
-	ret = register_pm_qos_misc(&network_throughput_pm_qos);
-	if (ret < 0)
-		printk(KERN_ERR
-			"pm_qos_param: network_throughput setup failed\n");
+
+	pm_qos_debug_init();
 
 	return ret;
 }
@@ -271,6 +271,7 @@ static ssize_t dvfslock_ctrl(const char *buf, size_t count)
 	if (gdDvfsctrl ==0) {
 		if (dvfsctrl_locked) {
 			s5pv310_cpufreq_lock_free(DVFS_LOCK_ID_APP);
+			s5pv310_hotplug_lock_free(DVFS_LOCK_ID_APP);
 			dvfsctrl_locked = 0;
 		}
 		return -EINVAL;
@@ -297,6 +298,7 @@ static ssize_t dvfslock_ctrl(const char *buf, size_t count)
 	printk(KERN_DEBUG "%s: level = %d, time =%d\n", __func__, dlevel, dtime_msec);
 
 	s5pv310_cpufreq_lock(DVFS_LOCK_ID_APP, dlevel);
+	s5pv310_hotplug_lock(DVFS_LOCK_ID_APP, 2);
 	dvfsctrl_locked = 1;
 
 	schedule_delayed_work(&dvfslock_ctrl_unlock_work, msecs_to_jiffies(dtime_msec));
@@ -308,6 +310,7 @@ static void do_dvfsunlock_timer(struct work_struct *work)
 {
 	dvfsctrl_locked = 0;
 	s5pv310_cpufreq_lock_free(DVFS_LOCK_ID_APP);
+	s5pv310_hotplug_lock_free(DVFS_LOCK_ID_APP);
 }
 
 static ssize_t dvfslock_ctrl_show(struct kobject *kobj,
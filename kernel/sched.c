@@ -471,6 +471,10 @@ struct rq {
 	unsigned long nr_load_updates;
 	u64 nr_switches;
 
+	/* nr_running integrated over rq->clock, see sched_nr_running_sum() */
+	u64 nr_running_sum;
+	u64 nr_running_stamp;
+
 	struct cfs_rq cfs;
 	struct rt_rq rt;
 
@@ -1951,13 +1955,29 @@ static void sched_irq_time_avg_update(struct rq *rq, u64 curr_irq_time) { }
 
 #include "sched_stats.h"
 
+/*
+ * Called with rq->clock up to date, before nr_running changes.  The
+ * clock of a CPU coming back online may lag the stamp; that interval
+ * is simply not accounted.
+ */
+static inline void account_nr_running(struct rq *rq)
+{
+	s64 delta = rq->clock - rq->nr_running_stamp;
+
+	if (delta > 0)
+		rq->nr_running_sum += rq->nr_running * delta;
+	rq->nr_running_stamp = rq->clock;
+}
+
 static void inc_nr_running(struct rq *rq)
 {
+	account_nr_running(rq);
 	rq->nr_running++;
 }
 
 static void dec_nr_running(struct rq *rq)
 {
+	account_nr_running(rq);
 	rq->nr_running--;
 }
 
@@ -3378,6 +3398,51 @@ static void update_cpu_load_active(struct rq *this_rq)
 	sched_avg_update(this_rq);
 }
 
+/*
+ * Runnable load of a CPU for frequency governors, in percent of one
+ * always runnable nice-0 task.  This is rq->cpu_load[1], which averages
+ * the weight of the runnable tasks over the last couple of ticks, decayed
+ * for ticks missed while idle.  Unlike idle time it keeps growing past
+ * 100 when tasks are queued behind the running one.
+ */
+unsigned long cpu_runnable_load(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long load = rq->cpu_load[1];
+	unsigned long missed = jiffies - rq->last_load_update_tick;
+
+	/* Same as the next update_cpu_load() would do before adding load */
+	if (missed > 1)
+		load = decay_load_missed(load, missed - 1, 1);
+	return load * 100 / NICE_0_LOAD;
+}
+EXPORT_SYMBOL_GPL(cpu_runnable_load);
+
+/*
+ * Run-queue depth of a CPU integrated over time, in task-nanoseconds,
+ * for CPU hotplug policies.  *clock is set to the rq clock the sum was
+ * taken at: the difference between two sums divided by the difference
+ * between their clocks is the average number of runnable tasks, the
+ * running one included, over that interval.  Unlike cpu_load[] this
+ * sees short bursts between two ticks.
+ */
+u64 sched_nr_running_sum(int cpu, u64 *clock)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+	u64 sum;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+	account_nr_running(rq);
+	sum = rq->nr_running_sum;
+	*clock = rq->nr_running_stamp;
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return sum;
+}
+EXPORT_SYMBOL_GPL(sched_nr_running_sum);
+
 #ifdef CONFIG_SMP
 
 /*
@@ -27,54 +27,70 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
-#include <linux/delay.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/* upper bound on the number of ranges in one ASHMEM_{PIN,UNPIN}_BATCH */
+#define ASHMEM_PIN_BATCH_MAX	1024
+
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned_tree;	/* unpinned ranges, by pgstart */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct ashmem_purge_stats stats; /* ASHMEM_GET_PURGE_STATS */
+	struct mutex mutex;		/* protects all of the above */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'; `lru' by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
+ *
+ * Each ashmem_area is protected by its own mutex. Ranges only enter or leave
+ * the LRU with their area's mutex held, so the shrinker can walk the LRU
+ * under this spinlock alone and trylock the area of the range it wants to
+ * purge, skipping areas that are busy rather than blocking their pin/unpin.
+ *
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Nothing copies to or from user space with asma->mutex held, so it nests
+ * inside mmap_sem (ashmem_mmap) without inverting against page faults.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -91,13 +107,6 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
   (((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
- (((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
-
-#define page_range_in_range(range, start, end) \
-  (page_in_range(range, start) || page_in_range(range, end) || \
-   page_range_subsumes_range(range, start, end))
-
 #define range_before_page(range, page) \
   ((range)->pgend < (page))
 
@@ -105,29 +114,89 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+/*
+ * The unpinned ranges of an area never overlap, so ordering the tree by
+ * pgstart also orders it by pgend, and every range overlapping [start, end]
+ * is found by looking up the first range ending at or after 'start' and
+ * walking forward while ranges begin at or before 'end'.
+ */
+
+/*
+ * range_first - return the lowest unpinned range of 'asma' that ends at or
+ * after page 'pgstart', or NULL.
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *n = asma->unpinned_tree.rb_node;
+	struct ashmem_range *range, *ret = NULL;
+
+	while (n) {
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range_before_page(range, pgstart))
+			n = n->rb_right;
+		else {
+			ret = range;
+			n = n->rb_left;
+		}
+	}
+
+	return ret;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
+}
+
+static void range_insert(struct ashmem_area *asma, struct ashmem_range *range)
+{
+	struct rb_node **p = &asma->unpinned_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct ashmem_range *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct ashmem_range, node);
+		if (range->pgstart < entry->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_tree);
 }
 
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
 	struct ashmem_range *range;
@@ -141,7 +210,7 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_insert(asma, range);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -151,7 +220,7 @@ static int range_alloc(struct ashmem_area *asma,
 
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned_tree);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -160,7 +229,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -170,8 +239,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,7 +259,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned_tree = RB_ROOT;
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -198,12 +271,12 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((n = rb_first(&asma->unpinned_tree)))
+		range_del(rb_entry(n, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -216,30 +289,33 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 			   size_t len, loff_t *pos)
 {
 	struct ashmem_area *asma = file->private_data;
+	struct file *vmfile;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
-		goto out;
-        }
-
-	if (!asma->file) {
-		ret = -EBADF;
-		goto out;
+		mutex_unlock(&asma->mutex);
+		return 0;
 	}
 
-	ret = asma->file->f_op->read(asma->file, buf, len, pos);
-	if (ret < 0) {
-		goto out;
+	vmfile = asma->file;
+	if (!vmfile) {
+		mutex_unlock(&asma->mutex);
+		return -EBADF;
 	}
+	get_file(vmfile);
 
-	/** Update backing file pos, since f_ops->read() doesn't */
-	asma->file->f_pos = *pos;
+	/* the backing file never changes once set, so read it unlocked */
+	mutex_unlock(&asma->mutex);
 
-out:
-	mutex_unlock(&ashmem_mutex);
+	ret = vmfile->f_op->read(vmfile, buf, len, pos);
+	if (ret >= 0)
+		/** Update backing file pos, since f_ops->read() doesn't */
+		vmfile->f_pos = *pos;
+
+	fput(vmfile);
 	return ret;
 }
 
@@ -248,7 +324,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -269,7 +345,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -284,19 +360,9 @@ calc_vm_may_flags(unsigned long prot)
 static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct ashmem_area *asma = file->private_data;
-	int ret = 0, count = 1000;
+	int ret = 0;
 
-	while (1) {
-		if (mutex_trylock(&ashmem_mutex)) {
-			/* pr_err("%s: ashmem_mutex obtained with %d!\n", __func__, count); */
-			break;
-		}
-		if (--count == 0) {
-			WARN(1, KERN_ERR "%s: FAILED to lock ashmem_mutex\n", __func__);
-			return -EBUSY;
-		}
-		msleep(1);
-	}
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -339,7 +405,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -357,10 +423,15 @@ out:
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
  * pages freed.
+ *
+ * Areas whose mutex is busy are skipped and their ranges rotated to the tail
+ * of the LRU, so reclaim never waits on a pin/unpin in progress (and cannot
+ * deadlock against one that is allocating memory).
  */
 static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	unsigned long nr_ranges = 0;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
@@ -368,21 +439,49 @@ static int ashmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	if (!nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry(range, &ashmem_lru_list, lru)
+		nr_ranges++;
+
+	while (nr_ranges-- && !list_empty(&ashmem_lru_list)) {
+		struct ashmem_area *asma;
+		struct inode *inode;
+		loff_t start, end;
+
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		asma = range->asma;
+
+		/*
+		 * The range is on the LRU, so its area has not been released
+		 * yet, and holding the area's mutex keeps it that way.
+		 */
+		if (!mutex_trylock(&asma->mutex)) {
+			list_move_tail(&range->lru, &ashmem_lru_list);
+			continue;
+		}
+		spin_unlock(&ashmem_lru_lock);
+
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
 
 		vmtruncate_range(inode, start, end);
 		range->purged = ASHMEM_WAS_PURGED;
 		lru_del(range);
-
 		nr_to_scan -= range_size(range);
+
+		asma->stats.purge_count++;
+		asma->stats.purged_pages += range_size(range);
+
+		mutex_unlock(&asma->mutex);
+
 		if (nr_to_scan <= 0)
-			break;
+			return lru_count;
+
+		spin_lock(&ashmem_lru_lock);
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
 
 	return lru_count;
 }
@@ -396,7 +495,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -411,15 +510,21 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
 static int set_name(struct ashmem_area *asma, void __user *name)
 {
+	char local_name[ASHMEM_NAME_LEN];
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	/* copy in before locking, a fault must not happen under asma->mutex */
+	if (unlikely(copy_from_user(local_name, name, ASHMEM_NAME_LEN)))
+		return -EFAULT;
+	local_name[ASHMEM_NAME_LEN-1] = '\0';
+
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -427,39 +532,37 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 		goto out;
 	}
 
-	if (unlikely(copy_from_user(asma->name + ASHMEM_NAME_PREFIX_LEN,
-				    name, ASHMEM_NAME_LEN)))
-		ret = -EFAULT;
-	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
+	strcpy(asma->name + ASHMEM_NAME_PREFIX_LEN, local_name);
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
 
 static int get_name(struct ashmem_area *asma, void __user *name)
 {
+	char local_name[ASHMEM_NAME_LEN];
+	size_t len;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
-		size_t len;
-
 		/*
 		 * Copying only `len', instead of ASHMEM_NAME_LEN, bytes
 		 * prevents us from revealing one user's stack to another.
 		 */
 		len = strlen(asma->name + ASHMEM_NAME_PREFIX_LEN) + 1;
-		if (unlikely(copy_to_user(name,
-				asma->name + ASHMEM_NAME_PREFIX_LEN, len)))
-			ret = -EFAULT;
+		memcpy(local_name, asma->name + ASHMEM_NAME_PREFIX_LEN, len);
 	} else {
-		if (unlikely(copy_to_user(name, ASHMEM_NAME_DEF,
-					  sizeof(ASHMEM_NAME_DEF))))
-			ret = -EFAULT;
+		len = sizeof(ASHMEM_NAME_DEF);
+		memcpy(local_name, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+
+	/* copy out after unlocking, a fault must not happen under the mutex */
+	if (unlikely(copy_to_user(name, local_name, len)))
+		ret = -EFAULT;
 
 	return ret;
 }
@@ -468,21 +571,21 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
 		 * or to pin pages that aren't even unpinned, so this is messy.
+		 * Every range we get here overlaps the requested one.
 		 *
 		 * Four cases:
 		 * 1. The requested range subsumes an existing range, so we
@@ -495,98 +598,116 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
-
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
-
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
-
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
-
-			/*
-			 * Case #4: We eat a chunk out of the middle. A bit
-			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
-			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
-			range_shrink(range, range->pgstart, pgstart - 1);
-			break;
+		ret |= range->purged;
+
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+			continue;
 		}
+
+		/* Case #2: We overlap from the start, so adjust it */
+		if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+			continue;
+		}
+
+		/* Case #3: We overlap from the rear, so adjust it */
+		if (range->pgend <= pgend) {
+			range_shrink(range, range->pgstart, pgstart-1);
+			continue;
+		}
+
+		/*
+		 * Case #4: We eat a chunk out of the middle. A bit
+		 * more complicated, we allocate a new range for the
+		 * second half and adjust the first chunk's endpoint.
+		 */
+		range_alloc(asma, range->purged, pgend + 1, range->pgend);
+		range_shrink(range, range->pgstart, pgstart - 1);
+		break;
 	}
 
+	if (ret == ASHMEM_WAS_PURGED)
+		asma->stats.pin_purged++;
+
 	return ret;
 }
 
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to unpin pages that are already entirely
-		 * or partially pinned. We handle those two cases here.
+		 * or partially unpinned. We handle those two cases here, by
+		 * swallowing any overlapping range into the new one.
 		 */
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
 
-	return ret;
+	return ASHMEM_IS_PINNED;
+}
+
+/*
+ * ashmem_pin_pages - validate 'pin' against 'asma' and convert it to an
+ * inclusive page interval. Returns zero on success.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int ashmem_pin_pages(struct ashmem_area *asma, struct ashmem_pin *pin,
+			    size_t *pgstart, size_t *pgend)
+{
+	/* per custom, you can pass zero for len to mean "everything onward" */
+	if (!pin->len)
+		pin->len = PAGE_ALIGN(asma->size) - pin->offset;
+
+	if (unlikely((pin->offset | pin->len) & ~PAGE_MASK))
+		return -EINVAL;
+
+	if (unlikely(((__u32) -1) - pin->offset < pin->len))
+		return -EINVAL;
+
+	if (unlikely(PAGE_ALIGN(asma->size) < pin->offset + pin->len))
+		return -EINVAL;
+
+	*pgstart = pin->offset / PAGE_SIZE;
+	*pgend = *pgstart + (pin->len / PAGE_SIZE) - 1;
+
+	return 0;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -596,29 +717,17 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	size_t pgstart, pgend;
 	int ret = -EINVAL;
 
-	if (unlikely(!asma->file))
-		return -EINVAL;
-
 	if (unlikely(copy_from_user(&pin, p, sizeof(pin))))
 		return -EFAULT;
 
-	/* per custom, you can pass zero for len to mean "everything onward" */
-	if (!pin.len)
-		pin.len = PAGE_ALIGN(asma->size) - pin.offset;
+	mutex_lock(&asma->mutex);
 
-	if (unlikely((pin.offset | pin.len) & ~PAGE_MASK))
-		return -EINVAL;
-
-	if (unlikely(((__u32) -1) - pin.offset < pin.len))
-		return -EINVAL;
-
-	if (unlikely(PAGE_ALIGN(asma->size) < pin.offset + pin.len))
-		return -EINVAL;
-
-	pgstart = pin.offset / PAGE_SIZE;
-	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
+	if (unlikely(!asma->file))
+		goto out_unlock;
 
-	mutex_lock(&ashmem_mutex);
+	ret = ashmem_pin_pages(asma, &pin, &pgstart, &pgend);
+	if (unlikely(ret))
+		goto out_unlock;
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -632,11 +741,95 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+out_unlock:
+	mutex_unlock(&asma->mutex);
+
+	return ret;
+}
+
+/*
+ * ashmem_pin_unpin_batch - pin or unpin many ranges under one lock
+ *
+ * Every range is validated before any is applied. For ASHMEM_PIN_BATCH the
+ * return value is ASHMEM_WAS_PURGED if any of the ranges had been purged.
+ * If unpinning runs out of memory part way, the ranges before the failing
+ * one stay unpinned and -ENOMEM is returned.
+ */
+static int ashmem_pin_unpin_batch(struct ashmem_area *asma, unsigned long cmd,
+				  void __user *p)
+{
+	struct ashmem_pin_batch batch;
+	struct ashmem_pin *pins;
+	size_t *pages;
+	size_t size;
+	int ret = 0;
+	__u32 i;
+
+	if (unlikely(copy_from_user(&batch, p, sizeof(batch))))
+		return -EFAULT;
+
+	if (unlikely(!batch.count || batch.count > ASHMEM_PIN_BATCH_MAX))
+		return -EINVAL;
+
+	size = batch.count * sizeof(*pins);
+	pins = kmalloc(size + 2 * batch.count * sizeof(*pages), GFP_KERNEL);
+	if (unlikely(!pins))
+		return -ENOMEM;
+	pages = (size_t *)((char *)pins + size);
+
+	if (unlikely(copy_from_user(pins,
+			(void __user *)(unsigned long) batch.pins, size))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	mutex_lock(&asma->mutex);
+
+	if (unlikely(!asma->file)) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		ret = ashmem_pin_pages(asma, &pins[i], &pages[2 * i],
+				       &pages[2 * i + 1]);
+		if (unlikely(ret))
+			goto out_unlock;
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		if (cmd == ASHMEM_PIN_BATCH)
+			ret |= ashmem_pin(asma, pages[2 * i], pages[2 * i + 1]);
+		else {
+			ret = ashmem_unpin(asma, pages[2 * i],
+					   pages[2 * i + 1]);
+			if (unlikely(ret))
+				break;
+		}
+	}
+
+out_unlock:
+	mutex_unlock(&asma->mutex);
+out:
+	kfree(pins);
 
 	return ret;
 }
 
+static int get_purge_stats(struct ashmem_area *asma, void __user *p)
+{
+	struct ashmem_purge_stats stats;
+
+	mutex_lock(&asma->mutex);
+	stats = asma->stats;
+	mutex_unlock(&asma->mutex);
+
+	if (unlikely(copy_to_user(p, &stats, sizeof(stats))))
+		return -EFAULT;
+
+	return 0;
+}
+
 static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct ashmem_area *asma = file->private_data;
@@ -651,10 +844,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -670,6 +865,13 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_pin_unpin(asma, cmd, (void __user *) arg);
 		break;
+	case ASHMEM_PIN_BATCH:
+	case ASHMEM_UNPIN_BATCH:
+		ret = ashmem_pin_unpin_batch(asma, cmd, (void __user *) arg);
+		break;
+	case ASHMEM_GET_PURGE_STATS:
+		ret = get_purge_stats(asma, (void __user *) arg);
+		break;
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
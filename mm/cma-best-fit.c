@@ -28,9 +28,21 @@ struct cma_bf_item {
 	struct rb_node by_size;
 };
 
+/*
+ * Chunks of the same size tend to be allocated and freed over and over
+ * again (video frame buffers for instance).  The last few freed chunks
+ * are kept aside as they are, so that such requests are served without
+ * walking the trees or allocating items.  They go back to the trees
+ * when an allocation cannot be satisfied otherwise.
+ */
+#define CMA_BF_CACHE_SIZE 4
+
 struct cma_bf_private {
 	struct rb_root by_start_root;
 	struct rb_root by_size_root;
+
+	unsigned cached;
+	struct cma_bf_item *cache[CMA_BF_CACHE_SIZE];
 };
 
 
@@ -70,6 +82,9 @@ __cma_bf_hole_take(struct cma_bf_item *hole, size_t size, dma_addr_t alignment);
  */
 static void __cma_bf_hole_merge_maybe(struct cma_bf_item *item);
 
+/* Turns a chunk back into a hole, merging it with its neighbours. */
+static void __cma_bf_hole_add(struct cma_bf_item *item);
+
 
 /************************* Device API *************************/
 
@@ -99,12 +114,20 @@ int cma_bf_init(struct cma_region *reg)
 	return 0;
 }
 
+static void __cma_bf_cache_flush(struct cma_bf_private *prv)
+{
+	while (prv->cached)
+		__cma_bf_hole_add(prv->cache[--prv->cached]);
+}
+
 void cma_bf_cleanup(struct cma_region *reg)
 {
 	struct cma_bf_private *prv = reg->private_data;
-	struct cma_bf_item *item =
-		rb_entry(prv->by_size_root.rb_node,
-			 struct cma_bf_item, by_size);
+	struct cma_bf_item *item;
+
+	__cma_bf_cache_flush(prv);
+	item = rb_entry(prv->by_size_root.rb_node,
+			struct cma_bf_item, by_size);
 
 	/* We can assume there is only a single hole in the tree. */
 	WARN_ON(item->by_size.rb_left || item->by_size.rb_right ||
@@ -114,10 +137,9 @@ void cma_bf_cleanup(struct cma_region *reg)
 	kfree(prv);
 }
 
-struct cma_chunk *cma_bf_alloc(struct cma_region *reg,
-			       size_t size, dma_addr_t alignment)
+static struct cma_chunk *__cma_bf_alloc(struct cma_bf_private *prv,
+					size_t size, dma_addr_t alignment)
 {
-	struct cma_bf_private *prv = reg->private_data;
 	struct rb_node *node = prv->by_size_root.rb_node;
 	struct cma_bf_item *item = NULL;
 
@@ -153,10 +175,92 @@ struct cma_chunk *cma_bf_alloc(struct cma_region *reg,
 	}
 }
 
+struct cma_chunk *cma_bf_alloc(struct cma_region *reg,
+			       size_t size, dma_addr_t alignment)
+{
+	struct cma_bf_private *prv = reg->private_data;
+	struct cma_chunk *chunk;
+	unsigned i;
+
+	/* Fast path, a recently freed chunk of the very same size */
+	for (i = 0; i < prv->cached; ++i) {
+		chunk = &prv->cache[i]->ch;
+		if (chunk->size == size && IS_ALIGNED(chunk->start, alignment)) {
+			prv->cache[i] = prv->cache[--prv->cached];
+			return chunk;
+		}
+	}
+
+	chunk = __cma_bf_alloc(prv, size, alignment);
+	if (!chunk && prv->cached) {
+		__cma_bf_cache_flush(prv);
+		chunk = __cma_bf_alloc(prv, size, alignment);
+	}
+	return chunk;
+}
+
 void cma_bf_free(struct cma_chunk *chunk)
 {
 	struct cma_bf_item *item = container_of(chunk, struct cma_bf_item, ch);
+	struct cma_bf_private *prv = item->ch.reg->private_data;
+
+	if (prv->cached < CMA_BF_CACHE_SIZE)
+		prv->cache[prv->cached++] = item;
+	else
+		__cma_bf_hole_add(item);
+}
+
+/*
+ * Cached chunks are free space too, and may touch holes or each other,
+ * so walk the holes by address together with the cached chunks, sorted
+ * the same way, and count runs of adjacent free space as single holes.
+ * The cache is left as it is so that reading the statistics does not
+ * change what the fast path can serve.
+ */
+void cma_bf_holes(struct cma_region *reg, size_t *largest, unsigned *count)
+{
+	struct cma_bf_private *prv = reg->private_data;
+	struct rb_node *node = rb_first(&prv->by_start_root);
+	struct cma_chunk *cached[CMA_BF_CACHE_SIZE], *ch;
+	dma_addr_t end = 0;
+	size_t run = 0;
+	unsigned i, j;
+
+	for (i = 0; i < prv->cached; ++i) {
+		ch = &prv->cache[i]->ch;
+		for (j = i; j && cached[j - 1]->start > ch->start; --j)
+			cached[j] = cached[j - 1];
+		cached[j] = ch;
+	}
+
+	*largest = 0;
+	*count = 0;
+	i = 0;
+	while (node || i < prv->cached) {
+		if (node && (i == prv->cached ||
+			     rb_entry(node, struct cma_chunk, by_start)->start <
+			     cached[i]->start)) {
+			ch = rb_entry(node, struct cma_chunk, by_start);
+			node = rb_next(node);
+		} else {
+			ch = cached[i++];
+		}
 
+		if (!run || ch->start != end) {
+			++*count;
+			run = 0;
+		}
+		run += ch->size;
+		end = ch->start + ch->size;
+		*largest = max(*largest, run);
+	}
+}
+
+
+/************************* Basic Tree Manipulation *************************/
+
+static void __cma_bf_hole_add(struct cma_bf_item *item)
+{
 	/* Add new hole */
 	if (unlikely(__cma_bf_hole_insert_by_start(item))) {
 		/*
@@ -173,9 +277,6 @@ void cma_bf_free(struct cma_chunk *chunk)
 	}
 }
 
-
-/************************* Basic Tree Manipulation *************************/
-
 static void __cma_bf_hole_insert_by_size(struct cma_bf_item *item)
 {
 	struct cma_bf_private *prv = item->ch.reg->private_data;
@@ -401,6 +502,7 @@ static int cma_bf_module_init(void)
 		.cleanup = cma_bf_cleanup,
 		.alloc   = cma_bf_alloc,
 		.free    = cma_bf_free,
+		.holes   = cma_bf_holes,
 	};
 	return cma_allocator_register(&alloc);
 }
@@ -28,10 +28,14 @@
 #include <linux/device.h>      /* struct device, dev_name() */
 #include <linux/errno.h>       /* Error numbers */
 #include <linux/err.h>         /* IS_ERR, PTR_ERR, etc. */
+#include <linux/gfp.h>         /* alloc_contig_range() */
+#include <linux/hrtimer.h>     /* ktime_get() */
 #include <linux/mm.h>          /* PAGE_ALIGN() */
 #include <linux/module.h>      /* EXPORT_SYMBOL_GPL() */
 #include <linux/mutex.h>       /* mutex */
+#include <linux/pfn.h>         /* PFN_UP(), PFN_DOWN() */
 #include <linux/slab.h>        /* kmalloc() */
+#include <linux/spinlock.h>    /* spinlock */
 #include <linux/string.h>      /* str*() */
 
 #include <linux/cma.h>
@@ -39,7 +43,9 @@
 
 /*
  * Protects cma_regions, cma_allocators, cma_map, cma_map_length,
- * cma_kobj, cma_sysfs_regions and cma_chunks_by_start.
+ * cma_kobj and cma_sysfs_regions.  Allocations within a region are
+ * serialised by the region's own mutex (which nests inside this one)
+ * so that regions do not wait for each other.
  */
 static DEFINE_MUTEX(cma_mutex);
 
@@ -295,6 +301,16 @@ int __must_check cma_region_register(struct cma_region *reg)
 	reg->private_data = NULL;
 	reg->registered = 0;
 	reg->free_space = reg->size;
+	mutex_init(&reg->mutex);
+#ifdef CONFIG_CMA_MIGRATE
+	reg->lent_start = 0;
+	reg->lent_end = 0;
+#endif
+#ifdef CONFIG_CMA_SYSFS
+	memset(reg->latency, 0, sizeof reg->latency);
+	reg->latency_max = 0;
+	reg->failures = 0;
+#endif
 
 	/* Copy name and alloc_name */
 	name = reg->name;
@@ -430,8 +446,10 @@ int cma_allocator_register(struct cma_allocator *alloc)
 		  : (!reg->used && first))
 			continue;
 
+		mutex_lock(&reg->mutex);
 		reg->alloc = alloc;
 		__cma_region_attach_alloc(reg);
+		mutex_unlock(&reg->mutex);
 	}
 
 	mutex_unlock(&cma_mutex);
@@ -570,6 +588,54 @@ void __init cma_early_regions_reserve(int (*reserve)(struct cma_region *reg))
 }
 
 
+#ifdef CONFIG_CMA_MIGRATE
+
+/*
+ * Free pages never cross a MAX_ORDER_NR_PAGES boundary, so lending
+ * whole such blocks lets alloc_contig_range() isolate exactly the
+ * lent pageblocks.
+ */
+#define CMA_LEND_PAGES max_t(unsigned long, MAX_ORDER_NR_PAGES, \
+			     pageblock_nr_pages)
+
+static void __init __cma_region_lend(struct cma_region *reg)
+{
+	unsigned long start = PFN_UP(reg->start);
+	unsigned long end = PFN_DOWN(reg->start + reg->size);
+	unsigned long pfn;
+
+	start = ALIGN(start, CMA_LEND_PAGES);
+	end &= ~(CMA_LEND_PAGES - 1);
+	if (start >= end)
+		return;
+
+	for (pfn = start; pfn < end; ++pfn)
+		if (!pfn_valid(pfn) ||
+		    page_zone(pfn_to_page(pfn)) !=
+		    page_zone(pfn_to_page(start))) {
+			pr_warn("init: %s: not lending, region spans a hole or zones\n",
+				reg->name ?: "(private)");
+			return;
+		}
+
+	for (pfn = start; pfn < end; pfn += pageblock_nr_pages)
+		init_cma_reserved_pageblock(pfn_to_page(pfn));
+
+	reg->lent_start = start;
+	reg->lent_end = end;
+	pr_info("init: %s: lent %luKiB to the page allocator\n",
+		reg->name ?: "(private)", (end - start) << (PAGE_SHIFT - 10));
+}
+
+#else
+
+static inline void __cma_region_lend(struct cma_region *reg)
+{
+	/* nop */
+}
+
+#endif
+
 static int __init cma_init(void)
 {
 	struct cma_region *reg, *n;
@@ -597,6 +663,8 @@ static int __init cma_init(void)
 		 */
 		if (reg->reserved && cma_region_register(reg) < 0)
 			/* ignore error */;
+		else if (reg->reserved && reg->movable)
+			__cma_region_lend(reg);
 	}
 
 	INIT_LIST_HEAD(&cma_early_regions);
@@ -824,6 +892,50 @@ static ssize_t cma_sysfs_region_alloc_show(struct cma_region *reg, char *page)
 		return 0;
 }
 
+static ssize_t
+cma_sysfs_region_latency_show(struct cma_region *reg, char *page)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < CMA_LATENCY_BUCKETS - 1; ++i)
+		len += snprintf(page + len, PAGE_SIZE - len, "<%lu %lu\n",
+				1ul << i, reg->latency[i]);
+	len += snprintf(page + len, PAGE_SIZE - len, ">=%lu %lu\nmax %lu\n",
+			1ul << (i - 1), reg->latency[i], reg->latency_max);
+	return len;
+}
+
+static ssize_t
+cma_sysfs_region_failures_show(struct cma_region *reg, char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%lu\n", reg->failures);
+}
+
+static ssize_t
+cma_sysfs_region_holes_show(struct cma_region *reg, char *page)
+{
+	size_t largest;
+	unsigned count;
+
+	if (!reg->alloc || !reg->alloc->holes)
+		return 0;
+	reg->alloc->holes(reg, &largest, &count);
+	return snprintf(page, PAGE_SIZE, "%u\n", count);
+}
+
+static ssize_t
+cma_sysfs_region_largest_hole_show(struct cma_region *reg, char *page)
+{
+	size_t largest;
+	unsigned count;
+
+	if (!reg->alloc || !reg->alloc->holes)
+		return 0;
+	reg->alloc->holes(reg, &largest, &count);
+	return snprintf(page, PAGE_SIZE, "%zu\n", largest);
+}
+
 static int
 cma_sysfs_region_alloc_store(struct cma_region *reg, const char *page)
 {
@@ -870,7 +982,9 @@ cma_sysfs_region_show(struct kobject *kobj, struct attribute *attr,
 	ssize_t ret;
 
 	mutex_lock(&cma_mutex);
+	mutex_lock(&reg->mutex);
 	ret = rattr->show(reg, buf);
+	mutex_unlock(&reg->mutex);
 	mutex_unlock(&cma_mutex);
 
 	return ret;
@@ -886,7 +1000,9 @@ cma_sysfs_region_store(struct kobject *kobj, struct attribute *attr,
 	int ret;
 
 	mutex_lock(&cma_mutex);
+	mutex_lock(&reg->mutex);
 	ret = rattr->store(reg, buf);
+	mutex_unlock(&reg->mutex);
 	mutex_unlock(&cma_mutex);
 
 	return ret < 0 ? ret : count;
@@ -904,6 +1020,10 @@ static struct kobj_type cma_sysfs_region_type = {
 		CMA_ATTR_RO_INLINE(region, free),
 		CMA_ATTR_RO_INLINE(region, users),
 		CMA_ATTR_INLINE(region, alloc),
+		CMA_ATTR_RO_INLINE(region, latency),
+		CMA_ATTR_RO_INLINE(region, failures),
+		CMA_ATTR_RO_INLINE(region, holes),
+		CMA_ATTR_RO_INLINE(region, largest_hole),
 		NULL
 	},
 };
@@ -938,8 +1058,9 @@ static void __cma_sysfs_region_add(struct cma_region *reg)
 
 /************************* Chunks *************************/
 
-/* All chunks sorted by start address. */
+/* All chunks sorted by start address, protected by cma_chunks_lock. */
 static struct rb_root cma_chunks_by_start;
+static DEFINE_SPINLOCK(cma_chunks_lock);
 
 static struct cma_chunk *__must_check __cma_chunk_find(dma_addr_t addr)
 {
@@ -992,9 +1113,75 @@ static int __must_check __cma_chunk_insert(struct cma_chunk *chunk)
 	return 0;
 }
 
+#ifdef CONFIG_CMA_MIGRATE
+
+/* Part of the chunk that was lent to the page allocator, in pfns. */
+static bool __cma_chunk_lent(struct cma_chunk *chunk,
+			     unsigned long *start, unsigned long *end)
+{
+	struct cma_region *reg = chunk->reg;
+
+	*start = max_t(unsigned long, PFN_DOWN(chunk->start), reg->lent_start);
+	*end = min_t(unsigned long, PFN_DOWN(chunk->start + chunk->size),
+		     reg->lent_end);
+	return *start < *end;
+}
+
+/*
+ * Get the lent pages of a freshly allocated chunk back from the page
+ * allocator, migrating whatever is using them.
+ */
+static int __cma_chunk_reclaim(struct cma_chunk *chunk)
+{
+	unsigned long start, end;
+	int ret;
+
+	if (!__cma_chunk_lent(chunk, &start, &end))
+		return 0;
+
+	ret = alloc_contig_range(start, end);
+	if (ret) {
+		pr_debug("%s: unable to migrate pages out of %p/%p\n",
+			 chunk->reg->name ?: "(private)",
+			 (void *)chunk->start, (void *)chunk->size);
+		return ret;
+	}
+
+	cma_arch_flush_range(chunk->start, chunk->size);
+	return 0;
+}
+
+static void __cma_chunk_release(struct cma_chunk *chunk)
+{
+	unsigned long start, end;
+
+	if (__cma_chunk_lent(chunk, &start, &end))
+		free_contig_range(start, end - start);
+}
+
+#else
+
+static inline int __cma_chunk_reclaim(struct cma_chunk *chunk)
+{
+	return 0;
+}
+
+static inline void __cma_chunk_release(struct cma_chunk *chunk)
+{
+	/* nop */
+}
+
+#endif
+
+void __weak cma_arch_flush_range(dma_addr_t start, size_t size)
+{
+	/* nop */
+}
+
+/* Called with the region's mutex held, chunk already off the tree. */
 static void __cma_chunk_free(struct cma_chunk *chunk)
 {
-	rb_erase(&chunk->by_start, &cma_chunks_by_start);
+	__cma_chunk_release(chunk);
 
 	chunk->reg->alloc->free(chunk);
 	--chunk->reg->users;
@@ -1010,49 +1197,107 @@ __cma_where_from(const struct device *dev, const char *type);
 
 /* Allocate. */
 
+static void __cma_account_latency(struct cma_region *reg, ktime_t start)
+{
+#ifdef CONFIG_CMA_SYSFS
+	unsigned long us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	++reg->latency[min_t(unsigned, fls_long(us), CMA_LATENCY_BUCKETS - 1)];
+	if (us > reg->latency_max)
+		reg->latency_max = us;
+#endif
+}
+
+static void __cma_account_failure(struct cma_region *reg)
+{
+#ifdef CONFIG_CMA_SYSFS
+	++reg->failures;
+#endif
+}
+
+/*
+ * Attaches an allocator to the region on first use.  Called with
+ * cma_mutex held since it looks through cma_allocators.
+ */
+static void __cma_region_prepare(struct cma_region *reg)
+{
+	if (reg && !reg->alloc && !reg->used) {
+		mutex_lock(&reg->mutex);
+		if (!reg->alloc && !reg->used)
+			__cma_region_attach_alloc(reg);
+		mutex_unlock(&reg->mutex);
+	}
+}
+
+/*
+ * Called without cma_mutex.  Region's mutex is held for the whole
+ * allocation, including migrating pages out of the chunk, so only
+ * users of the same region wait for each other.
+ */
 static dma_addr_t __must_check
 __cma_alloc_from_region(struct cma_region *reg,
 			size_t size, dma_addr_t alignment)
 {
 	struct cma_chunk *chunk;
+	dma_addr_t addr;
+	ktime_t start;
+	int ret;
 
 	pr_debug("allocate %p/%p from %s\n",
 		 (void *)size, (void *)alignment,
 		 reg ? reg->name ?: "(private)" : "(null)");
 
-	if (!reg || reg->free_space < size)
+	if (!reg)
 		return -ENOMEM;
 
-	if (!reg->alloc) {
-		if (!reg->used)
-			__cma_region_attach_alloc(reg);
-		if (!reg->alloc)
-			return -ENOMEM;
-	}
+	mutex_lock(&reg->mutex);
+
+	addr = -ENOMEM;
+	if (reg->free_space < size || !reg->alloc)
+		goto fail;
+
+	start = ktime_get();
 
 	chunk = reg->alloc->alloc(reg, size, alignment);
 	if (!chunk)
-		return -ENOMEM;
+		goto fail;
+	chunk->reg = reg;
 
-	if (unlikely(__cma_chunk_insert(chunk) < 0)) {
+	if (__cma_chunk_reclaim(chunk) < 0) {
+		reg->alloc->free(chunk);
+		addr = -EBUSY;
+		goto fail;
+	}
+
+	spin_lock(&cma_chunks_lock);
+	ret = __cma_chunk_insert(chunk);
+	spin_unlock(&cma_chunks_lock);
+	if (unlikely(ret < 0)) {
 		/* We should *never* be here. */
-		chunk->reg->alloc->free(chunk);
-		kfree(chunk);
-		return -EADDRINUSE;
+		reg->alloc->free(chunk);
+		addr = -EADDRINUSE;
+		goto fail;
 	}
 
-	chunk->reg = reg;
 	++reg->users;
 	reg->free_space -= chunk->size;
+	__cma_account_latency(reg, start);
+	mutex_unlock(&reg->mutex);
+
 	pr_debug("allocated at %p\n", (void *)chunk->start);
 	return chunk->start;
+
+fail:
+	__cma_account_failure(reg);
+	mutex_unlock(&reg->mutex);
+	return addr;
 }
 
 dma_addr_t __must_check
 cma_alloc_from_region(struct cma_region *reg,
 		      size_t size, dma_addr_t alignment)
 {
-	dma_addr_t addr;
+	int registered;
 
 	pr_debug("allocate %p/%p from %s\n",
 		 (void *)size, (void *)alignment,
@@ -1062,15 +1307,15 @@ cma_alloc_from_region(struct cma_region *reg,
 		return -EINVAL;
 
 	mutex_lock(&cma_mutex);
+	registered = reg->registered;
+	if (registered)
+		__cma_region_prepare(reg);
+	mutex_unlock(&cma_mutex);
 
-	addr = reg->registered ?
+	return registered ?
 		__cma_alloc_from_region(reg, PAGE_ALIGN(size),
 					max(alignment, (dma_addr_t)PAGE_SIZE)) :
 		-EINVAL;
-
-	mutex_unlock(&cma_mutex);
-
-	return addr;
 }
 EXPORT_SYMBOL_GPL(cma_alloc_from_region);
 
@@ -1080,7 +1325,9 @@ __cma_alloc(const struct device *dev, const char *type,
 {
 	struct cma_region *reg;
 	const char *from;
+	char *regions;
 	dma_addr_t addr;
+	size_t len;
 
 	if (dev)
 		pr_debug("allocate %p/%p for %s/%s\n",
@@ -1098,15 +1345,35 @@ __cma_alloc(const struct device *dev, const char *type,
 
 	from = __cma_where_from(dev, type);
 	if (unlikely(IS_ERR(from))) {
-		addr = PTR_ERR(from);
-		goto done;
+		mutex_unlock(&cma_mutex);
+		return PTR_ERR(from);
 	}
 
+	/*
+	 * The map may change once cma_mutex is dropped so take a copy
+	 * of the list of regions.  Regions themselves never go away.
+	 */
+	len = strcspn(from, ";");
+	regions = kmalloc(len + 1, GFP_KERNEL);
+	if (regions) {
+		memcpy(regions, from, len);
+		regions[len] = '\0';
+	}
+
+	mutex_unlock(&cma_mutex);
+
+	if (!regions)
+		return -ENOMEM;
+
 	pr_debug("allocate %p/%p from one of %s\n",
-		 (void *)size, (void *)alignment, from);
+		 (void *)size, (void *)alignment, regions);
 
-	while (*from && *from != ';') {
+	for (from = regions; *from; ) {
+		mutex_lock(&cma_mutex);
 		reg = __cma_region_find(&from);
+		__cma_region_prepare(reg);
+		mutex_unlock(&cma_mutex);
+
 		addr = __cma_alloc_from_region(reg, size, alignment);
 		if (!IS_ERR_VALUE(addr))
 			goto done;
@@ -1116,8 +1383,7 @@ __cma_alloc(const struct device *dev, const char *type,
 	addr = -ENOMEM;
 
 done:
-	mutex_unlock(&cma_mutex);
-
+	kfree(regions);
 	return addr;
 }
 EXPORT_SYMBOL_GPL(__cma_alloc);
@@ -1210,19 +1476,23 @@ int cma_free(dma_addr_t addr)
 	struct cma_chunk *c;
 	int ret;
 
-	mutex_lock(&cma_mutex);
-
+	spin_lock(&cma_chunks_lock);
 	c = __cma_chunk_find(addr);
+	if (c)
+		rb_erase(&c->by_start, &cma_chunks_by_start);
+	spin_unlock(&cma_chunks_lock);
 
 	if (c) {
+		struct cma_region *reg = c->reg;
+
+		mutex_lock(&reg->mutex);
 		__cma_chunk_free(c);
+		mutex_unlock(&reg->mutex);
 		ret = 0;
 	} else {
 		ret = -ENOENT;
 	}
 
-	mutex_unlock(&cma_mutex);
-
 	if (c)
 		pr_debug("free(%p): freed\n", (void *)addr);
 	else
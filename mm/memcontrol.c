@@ -2881,6 +2881,48 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 	return nr_reclaimed;
 }
 
+/*
+ * Global reclaim spares the pages of a group that has a soft limit set
+ * and is within it, all the way up the hierarchy: such a group is
+ * trimmed by mem_cgroup_soft_limit_reclaim(), at its own swappiness,
+ * once it grows past the limit instead.
+ */
+bool mem_cgroup_soft_limit_protected(struct page *page)
+{
+	struct page_cgroup *pc;
+	struct res_counter *cnt;
+	unsigned long flags;
+	bool limited, over;
+	bool ret = false;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	pc = lookup_page_cgroup(page);
+	if (!pc)
+		return false;
+
+	lock_page_cgroup(pc);
+	if (!PageCgroupUsed(pc) || mem_cgroup_is_root(pc->mem_cgroup))
+		goto out;
+
+	for (cnt = &pc->mem_cgroup->res; cnt; cnt = cnt->parent) {
+		spin_lock_irqsave(&cnt->lock, flags);
+		limited = cnt->soft_limit != RESOURCE_MAX;
+		over = cnt->usage > cnt->soft_limit;
+		spin_unlock_irqrestore(&cnt->lock, flags);
+		if (over) {
+			ret = false;
+			break;
+		}
+		if (limited)
+			ret = true;
+	}
+out:
+	unlock_page_cgroup(pc);
+	return ret;
+}
+
 /*
  * This routine traverse page_cgroup in given list and drop them all.
  * *And* this routine doesn't reclaim page itself, just removes page_cgroup.
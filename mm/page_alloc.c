@@ -50,6 +50,8 @@
 #include <linux/kmemleak.h>
 #include <linux/memory.h>
 #include <linux/compaction.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
 #include <trace/events/kmem.h>
 #include <linux/ftrace_event.h>
 
@@ -827,7 +829,12 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
 	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_RESERVE },
 	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_RESERVE },
+#ifdef CONFIG_CMA_MIGRATE
+	[MIGRATE_MOVABLE]     = { MIGRATE_CMA,         MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+	[MIGRATE_CMA]         = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
+#else
 	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+#endif
 	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
 };
 
@@ -943,11 +950,14 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			 * If breaking a large block of pages, move all free
 			 * pages to the preferred allocation list. If falling
 			 * back for a reclaimable kernel allocation, be more
-			 * agressive about taking ownership of free pages
+			 * agressive about taking ownership of free pages.
+			 * CMA pageblocks are only borrowed from, never
+			 * claimed, or the region could not be emptied again.
 			 */
-			if (unlikely(current_order >= (pageblock_order >> 1)) ||
+			if (!is_migrate_cma(migratetype) &&
+			    (unlikely(current_order >= (pageblock_order >> 1)) ||
 					start_migratetype == MIGRATE_RECLAIMABLE ||
-					page_group_by_mobility_disabled) {
+					page_group_by_mobility_disabled)) {
 				unsigned long pages;
 				pages = move_freepages_block(zone, page,
 								start_migratetype);
@@ -966,7 +976,8 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			rmv_page_order(page);
 
 			/* Take ownership for orders >= pageblock_order */
-			if (current_order >= pageblock_order)
+			if (current_order >= pageblock_order &&
+			    !is_migrate_cma(migratetype))
 				change_pageblock_range(page, current_order,
 							start_migratetype);
 
@@ -1042,7 +1053,13 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 			list_add(&page->lru, list);
 		else
 			list_add_tail(&page->lru, list);
-		set_page_private(page, migratetype);
+#ifdef CONFIG_CMA_MIGRATE
+		/* Drained pages must go back to the CMA free list */
+		if (is_migrate_cma(get_pageblock_migratetype(page)))
+			set_page_private(page, MIGRATE_CMA);
+		else
+#endif
+			set_page_private(page, migratetype);
 		list = &page->lru;
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
@@ -5327,6 +5344,7 @@ int set_migratetype_isolate(struct page *page)
 
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE ||
+	    is_migrate_cma(get_pageblock_migratetype(page)) ||
 	    zone_idx == ZONE_MOVABLE) {
 		ret = 0;
 		goto out;
@@ -5379,7 +5397,7 @@ out:
 	return ret;
 }
 
-void unset_migratetype_isolate(struct page *page)
+void unset_migratetype_isolate(struct page *page, unsigned migratetype)
 {
 	struct zone *zone;
 	unsigned long flags;
@@ -5387,12 +5405,198 @@ void unset_migratetype_isolate(struct page *page)
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
-	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-	move_freepages_block(zone, page, MIGRATE_MOVABLE);
+	set_pageblock_migratetype(page, migratetype);
+	move_freepages_block(zone, page, migratetype);
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
+#ifdef CONFIG_CMA_MIGRATE
+/*
+ * Hand a pageblock of a CMA region that was reserved at boot over to
+ * the buddy allocator.  Its pages end up on the MIGRATE_CMA free lists
+ * and are only ever given out to movable allocations.
+ */
+void __init init_cma_reserved_pageblock(struct page *page)
+{
+	unsigned i = pageblock_nr_pages;
+	struct page *p = page;
+
+	do {
+		__ClearPageReserved(p);
+		set_page_count(p, 0);
+	} while (++p, --i);
+
+	set_page_refcounted(page);
+	set_pageblock_migratetype(page, MIGRATE_CMA);
+	__free_pages(page, pageblock_order);
+	totalram_pages += pageblock_nr_pages;
+}
+
+static struct page *
+contig_migrate_alloc(struct page *page, unsigned long private, int **x)
+{
+	return alloc_page(GFP_HIGHUSER_MOVABLE);
+}
+
+#define NR_CONTIG_MIGRATE_AT_ONCE	(256)
+/*
+ * Move all LRU pages in [start_pfn, end_pfn) elsewhere.  Pages that are
+ * not on the LRU are left for the caller to find.  Returns the number
+ * of pages that could not be moved or an error code.
+ */
+static int
+contig_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
+{
+	unsigned long pfn;
+	struct page *page;
+	int ret = 0;
+	LIST_HEAD(source);
+
+	pfn = start_pfn;
+	while (pfn < end_pfn) {
+		int move_pages = NR_CONTIG_MIGRATE_AT_ONCE;
+
+		for (; pfn < end_pfn && move_pages > 0; pfn++) {
+			if (!pfn_valid_within(pfn))
+				continue;
+			page = pfn_to_page(pfn);
+			if (!page_count(page) || isolate_lru_page(page))
+				continue;
+			list_add_tail(&page->lru, &source);
+			move_pages--;
+			inc_zone_page_state(page, NR_ISOLATED_ANON +
+					    page_is_file_cache(page));
+		}
+		if (list_empty(&source))
+			continue;
+		/* this function returns # of failed pages */
+		ret = migrate_pages(&source, contig_migrate_alloc, 0, 0);
+		if (ret)
+			break;
+	}
+	return ret;
+}
+
+/*
+ * Take the free pages covering [start_pfn, end_pfn) off the free lists
+ * and hand them out as order-0 pages.  The range must be isolated.
+ * Returns the first pfn taken, which may be below @start_pfn when a
+ * free page straddles it, or -1UL if some page of the range is still
+ * in use; nothing is taken in that case.
+ */
+static unsigned long
+take_isolated_range(struct zone *zone, unsigned long start_pfn,
+		    unsigned long end_pfn)
+{
+	unsigned long outer_start = start_pfn, pfn, flags;
+	struct page *page;
+	int order = 0;
+
+	spin_lock_irqsave(&zone->lock, flags);
+
+	/* Find the free page start_pfn is part of */
+	while (!PageBuddy(pfn_to_page(outer_start))) {
+		if (++order >= MAX_ORDER)
+			goto busy;
+		outer_start &= ~0UL << order;
+	}
+	if (outer_start + (1UL << page_order(pfn_to_page(outer_start))) <=
+	    start_pfn)
+		goto busy;
+
+	for (pfn = outer_start; pfn < end_pfn; ) {
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page))
+			goto busy;
+		pfn += 1UL << page_order(page);
+	}
+
+	for (pfn = outer_start; pfn < end_pfn; ) {
+		page = pfn_to_page(pfn);
+		order = page_order(page);
+
+		list_del(&page->lru);
+		zone->free_area[order].nr_free--;
+		rmv_page_order(page);
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+		set_page_refcounted(page);
+		split_page(page, order);
+		pfn += 1UL << order;
+	}
+
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	/* Give back what was taken beyond the end of the range */
+	for (; end_pfn < pfn; end_pfn++)
+		__free_page(pfn_to_page(end_pfn));
+	return outer_start;
+
+busy:
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return -1UL;
+}
+
+/**
+ * alloc_contig_range() - take a range of pages away from the allocator
+ * @start_pfn:	first pfn of the range
+ * @end_pfn:	one past the last pfn of the range
+ *
+ * All pageblocks touching the range must be MIGRATE_CMA and lie in one
+ * zone; since free pages never cross a MAX_ORDER_NR_PAGES boundary the
+ * range is isolated in units of that size.  Pages in use are migrated
+ * away.  On success every page in the range has a reference count of
+ * one and must be released with free_contig_range().
+ *
+ * Returns 0 on success, -EBUSY if some page could not be moved.
+ */
+int alloc_contig_range(unsigned long start_pfn, unsigned long end_pfn)
+{
+	unsigned long align = max_t(unsigned long, MAX_ORDER_NR_PAGES,
+				    pageblock_nr_pages);
+	unsigned long iso_start = start_pfn & ~(align - 1);
+	unsigned long iso_end = ALIGN(end_pfn, align);
+	struct zone *zone = page_zone(pfn_to_page(start_pfn));
+	unsigned long outer_start;
+	int tries, ret;
+
+	ret = start_isolate_page_range(iso_start, iso_end, MIGRATE_CMA);
+	if (ret)
+		return ret;
+
+	/*
+	 * Pages sitting on pagevecs are not on the LRU yet and pages freed
+	 * to the pcp lists before isolation may have been allocated
+	 * again, so allow a few rounds before giving up.
+	 */
+	ret = -EBUSY;
+	for (tries = 0; tries < 5; tries++) {
+		lru_add_drain_all();
+		if (contig_migrate_range(start_pfn, end_pfn) < 0)
+			break;
+		drain_all_pages();
+
+		outer_start = take_isolated_range(zone, start_pfn, end_pfn);
+		if (outer_start != -1UL) {
+			for (; outer_start < start_pfn; outer_start++)
+				__free_page(pfn_to_page(outer_start));
+			ret = 0;
+			break;
+		}
+	}
+
+	undo_isolate_page_range(iso_start, iso_end, MIGRATE_CMA);
+	return ret;
+}
+
+void free_contig_range(unsigned long pfn, unsigned nr_pages)
+{
+	for (; nr_pages--; pfn++)
+		__free_page(pfn_to_page(pfn));
+}
+#endif
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * All pages in the range must be isolated before calling this.
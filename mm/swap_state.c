@@ -50,6 +50,55 @@ struct address_space swapper_space = {
 
 #define INC_CACHE_INFO(x)	do { swap_cache_info.x++; } while (0)
 
+/*
+ * Swap readahead is chosen per swap device:
+ *
+ * - devices completing reads synchronously (BDI_CAP_SYNCHRONOUS_IO) get
+ *   none: a read costs about as much as the fault itself, and pages
+ *   read ahead but never used only waste memory and decompression;
+ * - rotating disks read an aligned cluster of slots around the fault,
+ *   as the neighbouring slots come without an extra seek;
+ * - other non-rotational devices read the swap entries found in the
+ *   page tables around the faulting address, since slot order on them
+ *   tells little about what the task touches next.
+ *
+ * The window grows with the number of pages read ahead that were then
+ * faulted in, tracked per vma for the latter and globally otherwise.
+ */
+#define SWAP_RA_ORDER_CEILING	5
+
+/* vma->swap_readahead_info packs the last fault address, window, hits */
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* A vma starts out as if it had a few hits, with a small window */
+#define SWAP_RA_INIT_HITS	4
+
+static atomic_t swapin_readahead_hits = ATOMIC_INIT(SWAP_RA_INIT_HITS);
+
+static inline unsigned long swap_ra_val(struct vm_area_struct *vma)
+{
+	return atomic_long_read(&vma->swap_readahead_info) ? :
+		SWAP_RA_INIT_HITS;
+}
+
+static inline int swap_vma_ra(struct swap_info_struct *si)
+{
+	return (si->flags & (SWP_SOLIDSTATE | SWP_SYNCHRONOUS_IO)) ==
+		SWP_SOLIDSTATE;
+}
+
 static struct {
 	unsigned long add_total;
 	unsigned long del_total;
@@ -133,6 +182,9 @@ void __delete_from_swap_cache(struct page *page)
 	radix_tree_delete(&swapper_space.page_tree, page_private(page));
 	set_page_private(page, 0);
 	ClearPageSwapCache(page);
+	/* Read ahead, but nobody faulted it in before it went away */
+	if (TestClearPageReadahead(page))
+		__count_vm_event(SWAP_RA_MISS);
 	total_swapcache_pages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	INC_CACHE_INFO(del_total);
@@ -256,28 +308,48 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
+ *
+ * @vma and @addr, if given, are those of the fault the lookup is for,
+ * and feed the readahead window of that vma.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page * lookup_swap_cache(swp_entry_t entry,
+			struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
+	unsigned long ra_val;
+	int readahead;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
 
+		readahead = TestClearPageReadahead(page);
+		if (readahead)
+			count_vm_event(SWAP_RA_HIT);
+
+		if (vma && swap_vma_ra(swp_swap_info(entry))) {
+			ra_val = swap_ra_val(vma);
+			atomic_long_set(&vma->swap_readahead_info,
+				SWAP_RA_VAL(addr, SWAP_RA_WIN(ra_val),
+					min_t(unsigned long, SWAP_RA_HITS_MAX,
+					      SWAP_RA_HITS(ra_val) + readahead)));
+		} else if (readahead)
+			atomic_inc(&swapin_readahead_hits);
+	}
+
 	INC_CACHE_INFO(find_total);
 	return page;
 }
 
-/* 
+/*
  * Locate a page of swap in physical memory, reserving swap cache space
- * and reading the disk if it is not already cached.
- * A failure return means that either the page allocation failed or that
- * the swap entry is no longer in use.
+ * and reading the disk if it is not already cached. A page read here
+ * for @readahead is marked so that its first fault counts as a hit.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, int readahead)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -327,6 +399,10 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = __add_to_swap_cache(new_page, entry);
 		if (likely(!err)) {
 			radix_tree_preload_end();
+			if (readahead) {
+				SetPageReadahead(new_page);
+				count_vm_event(SWAP_RA);
+			}
 			/*
 			 * Initiate read into locked page and return.
 			 */
@@ -349,6 +425,69 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+/* 
+ * Locate a page of swap in physical memory, reserving swap cache space
+ * and reading the disk if it is not already cached.
+ * A failure return means that either the page allocation failed or that
+ * the swap entry is no longer in use.
+ */
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, 0);
+}
+
+/*
+ * Size the next readahead window from the hits the previous one got.
+ * Without hits to go by, only read ahead when the fault is next to the
+ * previous one.
+ */
+static unsigned int __swapin_nr_pages(unsigned long prev_offset,
+			unsigned long offset, unsigned int hits,
+			unsigned int max_pages, unsigned int prev_win)
+{
+	unsigned int pages, roundup;
+
+	pages = hits + 2;
+	if (pages == 2) {
+		if (offset != prev_offset + 1 && offset != prev_offset - 1)
+			pages = 1;
+	} else {
+		for (roundup = 4; roundup < pages; roundup <<= 1)
+			;
+		pages = roundup;
+	}
+
+	if (pages > max_pages)
+		pages = max_pages;
+
+	/* Don't shrink the window too fast */
+	if (pages < prev_win / 2)
+		pages = prev_win / 2;
+
+	return pages;
+}
+
+static unsigned int swapin_nr_pages(unsigned long offset)
+{
+	static unsigned long prev_offset;
+	static atomic_t last_readahead_pages;
+	unsigned int hits, pages, max_pages;
+
+	max_pages = 1 << ACCESS_ONCE(page_cluster);
+	if (max_pages <= 1)
+		return 1;
+
+	hits = atomic_xchg(&swapin_readahead_hits, 0);
+	pages = __swapin_nr_pages(prev_offset, offset, hits, max_pages,
+				  atomic_read(&last_readahead_pages));
+	if (!hits)
+		prev_offset = offset;
+	atomic_set(&last_readahead_pages, pages);
+
+	return pages;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -359,9 +498,9 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
  * Returns the struct page for entry and addr, after queueing swapin.
  *
  * Primitive swap readahead code. We simply read an aligned block of
- * (1 << page_cluster) entries in the swap area. This method is chosen
- * because it doesn't cost us any seek time.  We also make sure to queue
- * the 'original' request together with the readahead ones...
+ * up to (1 << page_cluster) entries in the swap area. This method is
+ * chosen because it doesn't cost us any seek time.  We also make sure
+ * to queue the 'original' request together with the readahead ones...
  *
  * This has been extended to use the NUMA policies from the mm triggering
  * the readahead.
@@ -371,10 +510,17 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
 {
-	int nr_pages;
+	struct swap_info_struct *si = swp_swap_info(entry);
+	unsigned long entry_offset = swp_offset(entry);
+	unsigned long offset, end_offset, mask;
 	struct page *page;
-	unsigned long offset;
-	unsigned long end_offset;
+
+	if (si->flags & SWP_SYNCHRONOUS_IO)
+		goto skip;
+
+	mask = swapin_nr_pages(entry_offset) - 1;
+	if (!mask)
+		goto skip;
 
 	/*
 	 * Get starting offset for readaround, and number of pages to read.
@@ -382,16 +528,109 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	 * No, it's very unlikely that swap layout would follow vma layout,
 	 * more likely that neighbouring swap pages came from the same node:
 	 * so use the same "addr" to choose the same node for each swap read.
+	 * Free and bad slots are skipped by swapcache_prepare().
 	 */
-	nr_pages = valid_swaphandles(entry, &offset);
-	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
+	offset = entry_offset & ~mask;
+	end_offset = entry_offset | mask;
+	if (!offset)		/* first page is swap header */
+		offset++;
+	if (end_offset >= si->max)
+		end_offset = si->max - 1;
+
+	for (; offset <= end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
-		if (!page)
-			break;
-		page_cache_release(page);
+		page = __read_swap_cache_async(
+				swp_entry(swp_type(entry), offset),
+				gfp_mask, vma, addr, offset != entry_offset);
+		if (page)
+			page_cache_release(page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(entry, gfp_mask, vma, addr);
+}
+
+/**
+ * swapin_vma_readahead - swap in pages around a faulting address
+ * @entry: swap entry of this memory
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma this address belongs to
+ * @addr: faulting address
+ * @pmd: pmd covering @addr
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ *
+ * On devices where slot order says little, read the swap entries of
+ * the pages around @addr instead, within @vma and the page table of
+ * @addr. The window follows the direction of the faults and is sized
+ * by the hits of the previous window of this vma. Rotating disks fall
+ * back to swapin_readahead().
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+struct page *swapin_vma_readahead(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	struct swap_info_struct *si = swp_swap_info(entry);
+	pte_t ptes[1 << SWAP_RA_ORDER_CEILING];
+	unsigned long ra_val, pfn, fpfn, start, end, left;
+	unsigned int max_win, win, i;
+	swp_entry_t swp;
+	struct page *page;
+	pte_t *pte, *orig_pte;
+
+	if (si->flags & SWP_SYNCHRONOUS_IO)
+		goto skip;
+	if (!swap_vma_ra(si))
+		return swapin_readahead(entry, gfp_mask, vma, addr);
+
+	max_win = 1 << min_t(unsigned int, ACCESS_ONCE(page_cluster),
+				SWAP_RA_ORDER_CEILING);
+	if (max_win == 1)
+		goto skip;
+
+	fpfn = PFN_DOWN(addr);
+	ra_val = swap_ra_val(vma);
+	pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
+	win = __swapin_nr_pages(pfn, fpfn, SWAP_RA_HITS(ra_val), max_win,
+				SWAP_RA_WIN(ra_val));
+	atomic_long_set(&vma->swap_readahead_info, SWAP_RA_VAL(addr, win, 0));
+	if (win == 1)
+		goto skip;
+
+	/* Read ahead in the direction the task walks, else around */
+	if (fpfn == pfn + 1)
+		left = 0;
+	else if (pfn == fpfn + 1)
+		left = win - 1;
+	else
+		left = (win - 1) / 2;
+	start = max(fpfn - min(fpfn, left), PFN_DOWN(vma->vm_start));
+	start = max(start, PFN_DOWN(addr & PMD_MASK));
+	end = min(fpfn - left + win, PFN_DOWN(vma->vm_end));
+	end = min(end, PFN_DOWN((addr & PMD_MASK) + PMD_SIZE));
+
+	/* Copy the ptes: the page table must not stay mapped while we read */
+	orig_pte = pte = pte_offset_map(pmd, addr);
+	pte -= fpfn - start;
+	for (i = 0; i < end - start; i++)
+		ptes[i] = pte[i];
+	pte_unmap(orig_pte);
+
+	for (i = 0; i < end - start; i++) {
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+		    pte_file(ptes[i]))
+			continue;
+		swp = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(swp)))
+			continue;
+		page = __read_swap_cache_async(swp, gfp_mask, vma,
+				(start + i) << PAGE_SHIFT, start + i != fpfn);
+		if (page)
+			page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -81,6 +81,9 @@ struct scan_control {
 	 */
 	bool lumpy_reclaim_mode;
 
+	/* Spare groups within their memcg soft limit? */
+	bool soft_limit_protect;
+
 	/* Which cgroup do we reclaim from */
 	struct mem_cgroup *mem_cgroup;
 
@@ -585,6 +588,16 @@ static enum page_references page_check_references(struct page *page,
 	if (vm_flags & VM_LOCKED)
 		return PAGEREF_RECLAIM;
 
+	/*
+	 * Keep the working set of groups within their soft limit, such
+	 * as the foreground app, while there is other memory to take.
+	 */
+	if (sc->soft_limit_protect && mem_cgroup_soft_limit_protected(page)) {
+		if (referenced_ptes || referenced_page)
+			return PAGEREF_ACTIVATE;
+		return PAGEREF_KEEP;
+	}
+
 	if (referenced_ptes) {
 		if (PageAnon(page))
 			return PAGEREF_ACTIVATE;
@@ -1674,6 +1687,10 @@ static void shrink_zone(int priority, struct zone *zone,
 
 	set_lumpy_reclaim_mode(priority, sc);
 
+	/* Once reclaim gets into trouble, soft limits protect no more */
+	sc->soft_limit_protect = scanning_global_lru(sc) &&
+				 priority >= DEF_PRIORITY - 2;
+
 	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
 					nr[LRU_INACTIVE_FILE]) {
 		for_each_evictable_lru(l) {
@@ -1748,6 +1765,15 @@ static void shrink_zones(int priority, struct zonelist *zonelist,
 
 			if (zone->all_unreclaimable && priority != DEF_PRIORITY)
 				continue;	/* Let kswapd poll it */
+
+			/*
+			 * Take from groups over their soft limit first, as
+			 * kswapd does, each at its own swappiness.
+			 */
+			sc->nr_reclaimed += mem_cgroup_soft_limit_reclaim(zone,
+						sc->order, sc->gfp_mask,
+						zone_to_nid(zone),
+						zone_idx(zone));
 		} else {
 			/*
 			 * Ignore cpuset limitation here. We just want to reduce
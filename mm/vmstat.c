@@ -547,6 +547,9 @@ static char * const migratetype_names[MIGRATE_TYPES] = {
 	"Reclaimable",
 	"Movable",
 	"Reserve",
+#ifdef CONFIG_CMA_MIGRATE
+	"CMA",
+#endif
 	"Isolate",
 };
 
@@ -855,6 +858,12 @@ static const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+#ifdef CONFIG_SWAP
+	"swap_ra",
+	"swap_ra_hit",
+	"swap_ra_miss",
+#endif
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",